@@ -0,0 +1,74 @@
+#ifndef RELATIVE_SLAM_ADMISSION_CONTROLLER_H
+#define RELATIVE_SLAM_ADMISSION_CONTROLLER_H
+
+#include <relative_slam/pipeline_stage.h>
+#include <string>
+
+// Limits on which scans the front-end accepts: every throttle_scans-th scan
+// is queued, and it only becomes a keyframe after the robot moved by
+// minimum_travel_distance (m) or turned by minimum_travel_heading (rad)
+struct AdmissionLimits
+{
+  AdmissionLimits() : throttle_scans(1), minimum_travel_distance(0.2), minimum_travel_heading(0.35) { }
+
+  int throttle_scans;
+  double minimum_travel_distance;
+  double minimum_travel_heading;
+};
+
+struct AdmissionSettings
+{
+  AdmissionSettings() : target_latency(0.2), high_queue_fill(0.75), low_load(0.5), relax_periods(3), step(1.25) { }
+
+  AdmissionLimits min_limits;   // the configured limits, never undercut
+  AdmissionLimits max_limits;   // the furthest load shedding may go
+  double target_latency;   // seconds a scan may spend queued and matched by the front-end
+  double high_queue_fill;  // fraction of a stage's queue counted as full load
+  double low_load;         // load below which the limits are relaxed again
+  int relax_periods;       // consecutive quiet updates needed before relaxing
+  double step;             // factor the motion gating thresholds change by per step,
+                           // but at least a tenth of their min..max range
+};
+
+// Adapts the admission limits to the load of the pipeline. Load is the
+// worst of the front-end latency against its target and the fill of the
+// front-end and back-end queues; above 1, or when scans were dropped, the
+// controller sheds load by one step, first by widening the motion gating,
+// which saves matching and solver work, and only then by throttling scans.
+// After relax_periods quiet updates it steps back in the reverse order.
+class AdmissionController
+{
+public:
+  enum Action { Hold, Shed, Relax };
+
+  // What an update saw and decided
+  struct Decision
+  {
+    Action action;
+    std::string reason;
+    AdmissionLimits limits;
+    double load;
+    double frontend_latency;
+    double frontend_queue_fill;
+    double backend_queue_fill;
+    size_t dropped;   // scans the front-end dropped since the previous update
+  };
+
+  explicit AdmissionController(const AdmissionSettings& settings);
+
+  // Counters of the front-end and back-end stages since the previous update
+  Decision Update(const StageReport& frontend, const StageReport& backend);
+
+  const AdmissionLimits& Limits() const { return limits_; }
+
+private:
+  bool shed(std::string& rReason);
+  bool relax(std::string& rReason);
+
+  AdmissionSettings settings_;
+  AdmissionLimits limits_;
+  size_t last_dropped_;
+  int quiet_periods_;
+};
+
+#endif // RELATIVE_SLAM_ADMISSION_CONTROLLER_H
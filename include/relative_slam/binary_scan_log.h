@@ -0,0 +1,128 @@
+#ifndef RELATIVE_SLAM_BINARY_SCAN_LOG_H
+#define RELATIVE_SLAM_BINARY_SCAN_LOG_H
+
+#include <relative_slam/scan_log.h>
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Append-only binary log of laser scans with their odometry, in native byte
+// order: a file header, then records one after another, each a record
+// header and a payload padded to 8 bytes, so every field of a mapped file
+// is aligned. A laser record declares a laser before its first scan; a
+// scan record is a BinaryScanHeader followed by the packed ranges.
+// Records are only ever appended, so a log cut short by a crash is valid up
+// to its last complete record.
+struct BinaryLogHeader
+{
+  char magic[8];          // BinaryScanLog::Magic
+  uint32_t version;
+  uint32_t byte_order;    // 0x01020304 as written
+};
+
+struct BinaryRecordHeader
+{
+  enum Type { Laser = 1, Scan = 2 };
+
+  uint32_t type;
+  uint32_t size;          // payload bytes that follow, including padding
+};
+
+// Followed by name_length bytes of the laser's frame name
+struct BinaryLaserRecord
+{
+  double x, y, yaw;
+  double min_range, max_range;
+  double min_angle, max_angle, angle_increment;
+  uint32_t laser;         // index scans refer to it by
+  uint32_t name_length;
+};
+
+// Followed by count floats of range (m), counterclockwise from min_angle
+struct BinaryScanHeader
+{
+  double stamp;
+  double odom_x, odom_y, odom_yaw;   // robot in the odometry frame at stamp
+  float min_angle, angle_increment;
+  float min_range, max_range;
+  uint32_t laser;
+  uint32_t count;
+};
+
+// Writes a new binary log. Scans are buffered by stdio; Close() or the
+// destructor flushes them.
+class BinaryScanLogWriter
+{
+public:
+  BinaryScanLogWriter();
+  ~BinaryScanLogWriter();
+
+  // Truncates the file if it exists
+  bool Open(const std::string& path);
+  bool Close();
+
+  // Returns the index scans of the laser refer to, or -1 on error
+  int AddLaser(const LogLaser& rLaser);
+  bool AddScan(const BinaryScanHeader& rHeader, const float* pRanges);
+
+  size_t Scans() const { return scans_; }
+
+private:
+  bool write(uint32_t type, const void* pFirst, size_t firstSize, const void* pSecond, size_t secondSize);
+
+  FILE* file_;
+  uint32_t lasers_;
+  size_t scans_;
+};
+
+// Reads a binary log mapped into memory. Records are walked in place:
+// GetScanHeader() and GetRanges() point straight into the mapping, so
+// nothing is parsed or copied, and the kernel reads the file ahead as it is
+// walked. The pointers stay valid until the log is closed.
+class BinaryScanLog
+{
+public:
+  enum Record { Laser, Scan, End, Error };
+
+  static const char Magic[8];
+  static const uint32_t Version = 1;
+
+  BinaryScanLog();
+  ~BinaryScanLog();
+
+  // True if the file starts like a binary log, for telling it from a text one
+  static bool IsBinaryLog(const std::string& path);
+
+  bool Open(const std::string& path);
+  void Close();
+
+  // Reads the next record. End also covers a last record cut short, in
+  // which case Truncated() is true.
+  Record Next();
+  bool Truncated() const { return truncated_; }
+
+  // The laser of the last laser record; GetLaserName(laser) is that of any
+  // laser declared so far
+  const LogLaser& GetLaser() const { return laser_; }
+  const std::string* GetLaserName(uint32_t laser) const;
+  const BinaryScanHeader& GetScanHeader() const { return *scan_; }
+  const float* GetRanges() const { return ranges_; }
+  const std::string& GetError() const { return error_; }
+
+private:
+  Record fail(const std::string& rMessage);
+
+  const char* data_;
+  size_t size_;
+  size_t offset_;
+  bool truncated_;
+
+  LogLaser laser_;
+  std::vector<std::string> laser_names_;
+  const BinaryScanHeader* scan_;
+  const float* ranges_;
+  std::string error_;
+};
+
+#endif // RELATIVE_SLAM_BINARY_SCAN_LOG_H
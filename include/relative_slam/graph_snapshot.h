@@ -0,0 +1,59 @@
+#ifndef RELATIVE_SLAM_GRAPH_SNAPSHOT_H
+#define RELATIVE_SLAM_GRAPH_SNAPSHOT_H
+
+#include <OpenKarto/Geometry.h>
+#include <OpenKarto/SensorData.h>
+#include <relative_slam/shared_chunk_vector.h>
+#include <boost/shared_ptr.hpp>
+#include <utility>
+#include <vector>
+
+// One keyframe as of a snapshot. The scan is a private copy taken when the
+// keyframe was added or last moved, with its point readings already
+// computed; nothing modifies it afterwards, so any thread may read it.
+struct KeyframeRecord
+{
+  KeyframeRecord() : id(-1) { }
+
+  int id;
+  karto::LocalizedLaserScanPtr scan;
+  karto::Pose2 corrected_pose;
+  karto::Pose2 sensor_pose;
+  karto::Pose2 reference_pose;
+};
+
+// A constraint as it was handed to the solver, in the frame of the from keyframe
+struct GraphEdge
+{
+  int from;
+  int to;
+  karto::Pose2 diff;
+  karto::Matrix3 covariance;
+  bool loop_closure;
+};
+
+// Immutable, versioned copy of the keyframes and constraints of the pose
+// graph. The front-end is the only thread that touches the scan manager and
+// the solver; after every change it publishes a new snapshot, which the
+// other threads take with boost::atomic_load and keep for as long as they
+// need without ever blocking it. Snapshots share the chunks of records that
+// did not change between them.
+struct GraphSnapshot
+{
+  GraphSnapshot() : version(0), loop_closures(0) { }
+
+  // NULL if there is no keyframe with this id
+  const KeyframeRecord* Find(int id) const;
+  // Keyframes at most max_hops constraints away from id, with their hop
+  // count, in breadth first order starting with id itself
+  void FindLinked(int id, int max_hops, std::vector<std::pair<int, int> >& rLinked) const;
+
+  unsigned long version;
+  int loop_closures;
+  SharedChunkVector<KeyframeRecord> keyframes;   // indexed by keyframe id
+  SharedChunkVector<GraphEdge> edges;
+  SharedChunkVector<std::vector<int> > adjacency;   // constrained keyframe ids, indexed by keyframe id
+};
+typedef boost::shared_ptr<const GraphSnapshot> GraphSnapshotPtr;
+
+#endif // RELATIVE_SLAM_GRAPH_SNAPSHOT_H
@@ -0,0 +1,51 @@
+#ifndef RELATIVE_SLAM_GRAPH_VISUALIZER_H
+#define RELATIVE_SLAM_GRAPH_VISUALIZER_H
+
+#include <relative_slam/graph_snapshot.h>
+#include <visualization_msgs/MarkerArray.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Markers of the pose graph for rviz, sent incrementally: each update only
+// carries the keyframes that are new or moved and the edge batches touching
+// them. Reads nothing but the snapshot it is given, so it may run on any
+// thread, though only one at a time.
+class GraphVisualizer
+{
+public:
+  explicit GraphVisualizer(const std::string& frame_id);
+
+  // Appends the markers that changed since the previous call, in frame_id
+  void Update(const GraphSnapshot &graph, visualization_msgs::MarkerArray &marray);
+  // Forgets what was sent, so the next call sends the whole graph
+  void Reset();
+  // Keyframes within detail_distance (m) of the newest one get an arrow and a
+  // label; beyond it only edges are drawn. A keyframe is sent again once it
+  // moves by more than update_distance (m) or update_angle (rad).
+  void SetParams(double detail_distance, double update_distance, double update_angle);
+
+private:
+  // What was last sent for each keyframe, and a hash of the edges in each
+  // batch of edges (LINE_LIST markers covering VisEdgeBatch keyframes each)
+  struct VisNode
+  {
+    karto::Pose2 pose;
+    bool detailed;
+  };
+  enum { VisEdgeBatch = 100 };
+  typedef std::map<int, std::vector<std::pair<int, int> > > VisEdgeBatches;
+  void addEdgeBatches(const VisEdgeBatches& rBatches, const GraphSnapshot& rGraph, const std::set<int>& rMoved,
+                      std::map<int, size_t>& rSent, visualization_msgs::Marker& rMarker, visualization_msgs::MarkerArray& rArray);
+
+  std::string frame_id_;
+  std::map<int, VisNode> vis_nodes_;
+  std::map<int, size_t> vis_loop_batches_;
+  std::map<int, size_t> vis_constraint_batches_;
+  double vis_detail_distance_;
+  double vis_update_distance_;
+  double vis_update_angle_;
+};
+
+#endif // RELATIVE_SLAM_GRAPH_VISUALIZER_H
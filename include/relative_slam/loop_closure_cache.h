@@ -0,0 +1,64 @@
+#ifndef RELATIVE_SLAM_LOOP_CLOSURE_CACHE_H
+#define RELATIVE_SLAM_LOOP_CLOSURE_CACHE_H
+
+#include <boost/thread/mutex.hpp>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+// Bounded memo of loop closure attempts that failed, keyed by the place the
+// query keyframe was taken at (its pose quantized to a cell) and a hash of
+// the candidate chain. Every keyframe is a new query, so keying on the place
+// rather than the keyframe is what lets a drive past the same spot skip the
+// matches that already failed there. An entry is dropped as soon as a pose
+// correction moves any keyframe it involves; the least recently used entry
+// is evicted when the cache is full.
+class LoopClosureCache
+{
+public:
+  struct Result
+  {
+    double coarse_response;
+    double fine_response;   // negative if the fine match never ran
+  };
+
+  explicit LoopClosureCache(size_t max_entries = 1000);
+
+  typedef long long Place;
+
+  static size_t HashChain(const std::vector<int>& rChainIds);
+  // Cell of a pose (m, rad) on a grid of cell_size meters and angle_size radians
+  static Place QuantizePlace(double x, double y, double heading, double cell_size, double angle_size);
+
+  bool Find(Place place, size_t chain_hash, Result& rResult);
+  void Insert(Place place, size_t chain_hash, int query_id, const std::vector<int>& rChainIds, const Result& rResult);
+
+  // Drops every entry whose query or chain contains one of the given keyframes
+  void Invalidate(const std::set<int>& rMovedIds);
+
+  void SetMaxEntries(size_t max_entries);
+  size_t Size() const;
+  size_t Hits() const;
+  size_t Misses() const;
+
+private:
+  typedef std::pair<Place, size_t> Key;
+  struct Entry
+  {
+    Key key;
+    int query_id;   // the keyframe that failed, for invalidation
+    std::vector<int> chain_ids;
+    Result result;
+  };
+  typedef std::list<Entry> EntryList;
+
+  mutable boost::mutex mutex_;
+  EntryList entries_;   // most recently used first
+  std::map<Key, EntryList::iterator> lookup_;
+  size_t max_entries_;
+  size_t hits_;
+  size_t misses_;
+};
+
+#endif // RELATIVE_SLAM_LOOP_CLOSURE_CACHE_H
@@ -0,0 +1,69 @@
+#ifndef RELATIVE_SLAM_MAP_CODEC_H
+#define RELATIVE_SLAM_MAP_CODEC_H
+
+#include <nav_msgs/OccupancyGrid.h>
+#include <relative_slam/CompressedMap.h>
+#include <utility>
+#include <vector>
+
+// Run-length encoding of bytes as (count, value) pairs
+void EncodeRunLength(const int8_t* pData, size_t count, std::vector<uint8_t>& rOut);
+// Returns false unless the runs expand to exactly count bytes
+bool DecodeRunLength(const std::vector<uint8_t>& rIn, int8_t* pData, size_t count);
+
+// Turns successive versions of a map into CompressedMap messages. It keeps a
+// copy of what it sent, so a delta contains exactly the tiles that differ
+// from the previous message. A keyframe is sent first, whenever the map
+// geometry changes, and every keyframe_interval messages so that late
+// subscribers can start decoding.
+class MapEncoder
+{
+public:
+  // Column and row of a tile, counted in tiles from the map origin
+  typedef std::pair<unsigned int, unsigned int> TileIndex;
+
+  explicit MapEncoder(unsigned int tile_size = 64, unsigned int keyframe_interval = 10);
+
+  // Compares every tile of the map with what was sent
+  void Encode(const nav_msgs::OccupancyGrid& rMap, relative_slam::CompressedMap& rMsg);
+  // Unless a keyframe is due, only looks at rTiles; the caller guarantees
+  // that no other tile changed since the previous message
+  void Encode(const nav_msgs::OccupancyGrid& rMap, const std::vector<TileIndex>& rTiles, relative_slam::CompressedMap& rMsg);
+  void ForceKeyframe() { has_sent_ = false; }
+
+private:
+  // Starts the message; returns whether it is a keyframe
+  bool begin(const nav_msgs::OccupancyGrid& rMap, relative_slam::CompressedMap& rMsg);
+  void encodeAll(const nav_msgs::OccupancyGrid& rMap, relative_slam::CompressedMap& rMsg);
+  void encodeTile(const nav_msgs::OccupancyGrid& rMap, unsigned int x0, unsigned int y0, relative_slam::CompressedMap& rMsg);
+
+  unsigned int tile_size_;
+  unsigned int keyframe_interval_;
+  unsigned int since_keyframe_;
+  uint32_t seq_;
+  bool has_sent_;
+  nav_msgs::MapMetaData info_;
+  std::vector<int8_t> sent_;
+  std::vector<int8_t> tile_;
+};
+
+// Rebuilds the full map from CompressedMap messages. After a gap in the
+// sequence, deltas are rejected until the next keyframe arrives.
+class MapDecoder
+{
+public:
+  MapDecoder();
+
+  // Returns false if the message could not be applied
+  bool Apply(const relative_slam::CompressedMap& rMsg);
+  bool HasMap() const { return has_map_; }
+  const nav_msgs::OccupancyGrid& Map() const { return map_; }
+
+private:
+  bool has_map_;
+  uint32_t seq_;
+  nav_msgs::OccupancyGrid map_;
+  std::vector<int8_t> tile_;
+};
+
+#endif // RELATIVE_SLAM_MAP_CODEC_H
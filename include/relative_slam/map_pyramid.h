@@ -0,0 +1,49 @@
+#ifndef RELATIVE_SLAM_MAP_PYRAMID_H
+#define RELATIVE_SLAM_MAP_PYRAMID_H
+
+#include <relative_slam/occupancy_grid.h>
+#include <vector>
+
+// Downsampled copies of an IncrementalOccupancyGrid, in nav_msgs::OccupancyGrid
+// values. Each level covers the grid's bounding box with cells factor times
+// larger, and a coarse cell takes the maximum of the cells it covers, so it
+// is occupied if any of them is, else free if any is, else unknown. Factors
+// must divide the tile size, so every base tile maps to whole coarse cells
+// and only the tiles that changed have to be pooled again.
+class MapPyramid
+{
+public:
+  // Factors that are not valid are left out
+  explicit MapPyramid(const std::vector<int>& rFactors);
+
+  // Whether factor is greater than 1 and divides the tile size
+  static bool IsValidFactor(int factor);
+
+  // Pools the given changed tiles into every level; if the grid bounds
+  // changed since the last call, all levels are resized and rebuilt.
+  // Returns false if nothing changed.
+  bool Update(const IncrementalOccupancyGrid& rGrid, const std::vector<IncrementalOccupancyGrid::TileIndex>& rTiles);
+
+  size_t NumLevels() const { return levels_.size(); }
+  int Factor(size_t level) const { return levels_[level].factor; }
+  int Width(size_t level) const { return width_ / levels_[level].factor; }
+  int Height(size_t level) const { return height_ / levels_[level].factor; }
+  const std::vector<signed char>& Data(size_t level) const { return levels_[level].data; }
+
+private:
+  struct Level
+  {
+    int factor;
+    std::vector<signed char> data;
+  };
+
+  void poolTile(const IncrementalOccupancyGrid& rGrid, const IncrementalOccupancyGrid::TileIndex& rIndex);
+
+  std::vector<Level> levels_;
+  int width_;
+  int height_;
+  int origin_x_;
+  int origin_y_;
+};
+
+#endif // RELATIVE_SLAM_MAP_PYRAMID_H
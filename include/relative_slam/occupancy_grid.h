@@ -0,0 +1,151 @@
+#ifndef RELATIVE_SLAM_OCCUPANCY_GRID_H
+#define RELATIVE_SLAM_OCCUPANCY_GRID_H
+
+#include <cstddef>
+#include <map>
+#include <utility>
+#include <vector>
+
+class ThreadPool;
+
+// Cell states, using the same values as karto::GridStates
+enum CellState
+{
+  CellState_Unknown = 0,
+  CellState_Occupied = 100,
+  CellState_Free = 255
+};
+
+// Converts count cell states to nav_msgs::OccupancyGrid values (-1 unknown,
+// 0 free, 100 occupied) through a lookup table. Values that are not a
+// CellState come out as unknown.
+void ConvertCellStates(const unsigned char* pStates, size_t count, signed char* pValues);
+
+// What the grid needs to raycast one scan: the sensor pose the rays were
+// computed for and the beam end points in world coordinates. Beams longer
+// than the range threshold are clipped and only clear free space.
+struct ScanRays
+{
+  double x;
+  double y;
+  double heading;
+  std::vector<float> end_x;
+  std::vector<float> end_y;
+  std::vector<bool> end_hit;
+};
+
+// Occupancy grid built incrementally from scans. It keeps per-cell pass and
+// hit counts, plus the rays of every scan it has integrated, so a scan whose
+// pose changed can be subtracted and raycast again without rebuilding the
+// map from scratch.
+//
+// Cells are stored in square tiles that are allocated the first time a ray
+// touches them. Tiles whose cell states change are remembered as dirty until
+// the owner collects them, so consumers can update only what changed.
+class IncrementalOccupancyGrid
+{
+public:
+  enum { TileSize = 64 };
+  typedef std::pair<int, int> TileIndex;
+
+  explicit IncrementalOccupancyGrid(double resolution = 0.05, unsigned int min_pass_through = 2, double occupancy_threshold = 0.1);
+  ~IncrementalOccupancyGrid();
+
+  // Raycasts the scan into the grid, replacing its previous contribution
+  void AddScan(int id, const ScanRays& rRays);
+  bool RemoveScan(int id);
+
+  // Like AddScan() for many scans at once. The rays are traced on the pool's
+  // workers into per-worker count deltas, which are summed and then applied
+  // to the grid in one pass, so the counts, the cell states and the dirty
+  // tiles do not depend on how the scans were split among the workers.
+  void AddScans(const std::vector<std::pair<int, ScanRays> >& rScans, ThreadPool* pPool);
+  const ScanRays* GetScan(int id) const;
+  size_t NumScans() const { return scans_.size(); }
+
+  // Drops all scans and tiles, optionally switching resolution
+  void Clear();
+  void Clear(double resolution);
+
+  double Resolution() const { return resolution_; }
+  bool IsEmpty() const { return tiles_.empty(); }
+
+  // Bounding box of all allocated tiles, in cells
+  int Width() const { return IsEmpty() ? 0 : (max_tile_x_ - min_tile_x_ + 1) * TileSize; }
+  int Height() const { return IsEmpty() ? 0 : (max_tile_y_ - min_tile_y_ + 1) * TileSize; }
+  int OriginCellX() const { return min_tile_x_ * TileSize; }
+  int OriginCellY() const { return min_tile_y_ * TileSize; }
+
+  // World coordinates of the corner of cell (0, 0) of the bounding box
+  double OriginX() const { return OriginCellX() * resolution_; }
+  double OriginY() const { return OriginCellY() * resolution_; }
+
+  // State of a cell, relative to the bounding box origin
+  unsigned char State(int x, int y) const;
+
+  // Row-major states of one tile, TileSize cells per row; NULL if the tile
+  // has not been allocated
+  const unsigned char* TileStates(const TileIndex& rIndex) const;
+  void GetTiles(std::vector<TileIndex>& rTiles) const;
+
+  // Tiles whose cell states changed since the previous call
+  void TakeDirtyTiles(std::vector<TileIndex>& rTiles);
+
+private:
+  struct Tile
+  {
+    Tile();
+    unsigned int pass[TileSize * TileSize];
+    unsigned int hits[TileSize * TileSize];
+    unsigned char states[TileSize * TileSize];
+    bool dirty;
+  };
+  typedef std::map<TileIndex, Tile*> TileMap;
+
+  // Count changes of one tile, accumulated by a worker before merging
+  struct TileDelta
+  {
+    TileDelta();
+    int pass[TileSize * TileSize];
+    int hits[TileSize * TileSize];
+  };
+  typedef std::map<TileIndex, TileDelta*> DeltaMap;
+
+  struct RaycastJob
+  {
+    const ScanRays* rays;
+    int delta;
+  };
+
+  class CellUpdater;
+  class DeltaAccumulator;
+  template <typename Visitor>
+  void traceRays(const ScanRays& rRays, int delta, Visitor& rVisitor) const;
+  void raycastJob(const std::vector<RaycastJob>* pJobs, std::vector<DeltaMap>* pDeltas, size_t index, size_t worker) const;
+  void mergeDeltas(std::vector<DeltaMap>& rDeltas);
+
+  void raycast(const ScanRays& rRays, int delta);
+  void traceCell(int cx, int cy, int pass_delta, int hit_delta);
+  void updateState(Tile* pTile, const TileIndex& rIndex, size_t cell);
+  Tile* getTile(int tx, int ty);
+  int worldToCell(double v) const;
+
+  double resolution_;
+  unsigned int min_pass_through_;
+  double occupancy_threshold_;
+
+  TileMap tiles_;
+  int min_tile_x_;
+  int min_tile_y_;
+  int max_tile_x_;
+  int max_tile_y_;
+  std::vector<TileIndex> dirty_;
+
+  // Most recently used tile; consecutive cells of a ray usually share it
+  Tile* last_tile_;
+  TileIndex last_index_;
+
+  std::map<int, ScanRays> scans_;
+};
+
+#endif // RELATIVE_SLAM_OCCUPANCY_GRID_H
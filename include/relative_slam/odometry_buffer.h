@@ -0,0 +1,48 @@
+#ifndef RELATIVE_SLAM_ODOMETRY_BUFFER_H
+#define RELATIVE_SLAM_ODOMETRY_BUFFER_H
+
+#include <boost/atomic.hpp>
+#include <vector>
+
+// Planar odometry pose at a time in seconds
+struct OdometrySample
+{
+  OdometrySample() : stamp(0.0), x(0.0), y(0.0), yaw(0.0) { }
+  OdometrySample(double stamp, double x, double y, double yaw) : stamp(stamp), x(x), y(y), yaw(yaw) { }
+
+  double stamp;
+  double x;
+  double y;
+  double yaw;
+};
+
+// Ring buffer of the most recent odometry poses, written by one thread and
+// interpolated by timestamp from any number of others without locks. The
+// writer fills slots in place and then publishes them by advancing a
+// counter; a reader checks the counter again after copying, and retries if
+// the writer may have overwritten what it read in the meantime. Lookups
+// neither allocate nor throw.
+class OdometryBuffer
+{
+public:
+  enum LookupResult { Found, Empty, TooOld, TooNew };
+
+  explicit OdometryBuffer(size_t capacity = 1000);
+
+  // Only one thread may add; samples not newer than the newest are ignored
+  bool Add(const OdometrySample& rSample);
+
+  // Pose at stamp, interpolated between the samples around it
+  LookupResult Lookup(double stamp, OdometrySample& rSample) const;
+  bool Newest(OdometrySample& rSample) const;
+
+  size_t Capacity() const { return samples_.size(); }
+
+private:
+  bool copy(unsigned long index, OdometrySample& rSample) const;
+
+  std::vector<OdometrySample> samples_;
+  boost::atomic<unsigned long> count_;   // samples ever added
+};
+
+#endif // RELATIVE_SLAM_ODOMETRY_BUFFER_H
@@ -0,0 +1,171 @@
+#ifndef RELATIVE_SLAM_PIPELINE_STAGE_H
+#define RELATIVE_SLAM_PIPELINE_STAGE_H
+
+#include <relative_slam/work_queue.h>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <string>
+
+// What a pipeline stage did since its previous report
+struct StageReport
+{
+  StageReport() : items(0), period(0.0), wait_sum(0.0), busy_sum(0.0), busy_max(0.0),
+                  queue_size(0), queue_capacity(0), dropped(0) { }
+
+  double Throughput() const { return period > 0.0 ? items / period : 0.0; }
+  double MeanWait() const { return items > 0 ? wait_sum / items : 0.0; }
+  double MeanBusy() const { return items > 0 ? busy_sum / items : 0.0; }
+  // Fraction of the period the stage's thread spent working
+  double Utilization() const { return period > 0.0 ? std::min(1.0, busy_sum / period) : 0.0; }
+
+  // Adds the counters of the following report
+  void Merge(const StageReport& rNext)
+  {
+    items += rNext.items;
+    period += rNext.period;
+    wait_sum += rNext.wait_sum;
+    busy_sum += rNext.busy_sum;
+    busy_max = std::max(busy_max, rNext.busy_max);
+    queue_size = rNext.queue_size;
+    queue_capacity = rNext.queue_capacity;
+    dropped = rNext.dropped;
+  }
+
+  size_t items;
+  double period;          // seconds covered by the counters
+  double wait_sum;        // seconds the handled items spent queued
+  double busy_sum;        // seconds spent on items and idle work
+  double busy_max;        // longest single item or idle call
+  size_t queue_size;
+  size_t queue_capacity;  // 0 if unbounded
+  size_t dropped;         // items dropped since the stage started
+};
+
+// One stage of the processing pipeline: a bounded input queue and a
+// dedicated thread handing every item to the stage's handler. When the
+// queue is full it either drops its oldest item, for input where fresh data
+// matters more than complete data, or blocks the producer until there is
+// room, so an overloaded stage slows down the stages feeding it instead of
+// losing their work.
+template <typename T>
+class PipelineStage
+{
+public:
+  typedef WorkQueue<T> Queue;
+  typedef typename Queue::clock_t clock_t;
+  // Handles one item; wait is the time in seconds it spent queued
+  typedef boost::function<void (const T& item, double wait)> Handler;
+  // Called while the queue is empty; returns true if it did some work, in
+  // which case the queue is only polled before calling it again
+  typedef boost::function<bool ()> IdleHandler;
+
+  enum Overflow { DropOldest, Block };
+
+  PipelineStage(const std::string& name, size_t max_size, Overflow overflow) :
+    name_(name), overflow_(overflow), queue_(max_size), stats_start_(clock_t::now())
+  {
+  }
+
+  ~PipelineStage()
+  {
+    Stop();
+  }
+
+  void Start(const Handler& handler, const IdleHandler& idle = IdleHandler())
+  {
+    handler_ = handler;
+    idle_ = idle;
+    thread_.reset(new boost::thread(boost::bind(&PipelineStage::run, this)));
+  }
+
+  // Discards what is still queued and waits for the item in progress
+  void Stop()
+  {
+    queue_.Shutdown();
+    if(thread_)
+    {
+      thread_->join();
+      thread_.reset();
+    }
+  }
+
+  // Returns false if an item was dropped, or the stage was stopped
+  bool Push(const T& value)
+  {
+    return overflow_ == Block ? queue_.PushWait(value) : queue_.Push(value);
+  }
+
+  const std::string& Name() const { return name_; }
+  size_t Size() const { return queue_.Size(); }
+  size_t Dropped() const { return queue_.Dropped(); }
+
+  // Counters since the previous call
+  StageReport TakeReport()
+  {
+    boost::mutex::scoped_lock lock(stats_mutex_);
+    typename clock_t::time_point now = clock_t::now();
+    StageReport report = stats_;
+    report.period = boost::chrono::duration<double>(now - stats_start_).count();
+    report.queue_size = queue_.Size();
+    report.queue_capacity = queue_.MaxSize();
+    report.dropped = queue_.Dropped();
+    stats_ = StageReport();
+    stats_start_ = now;
+    return report;
+  }
+
+private:
+  void run()
+  {
+    bool polling = false;
+    typename Queue::Item item;
+    while(true)
+    {
+      bool gotItem = polling ? queue_.Pop(item, 0.0) : queue_.Pop(item);
+      if(!gotItem)
+      {
+        if(queue_.IsShutdown())
+          break;
+        typename clock_t::time_point start = clock_t::now();
+        polling = idle_ && idle_();
+        if(polling)
+          record(0, 0.0, boost::chrono::duration<double>(clock_t::now() - start).count());
+        continue;
+      }
+
+      typename clock_t::time_point start = clock_t::now();
+      double wait = boost::chrono::duration<double>(start - item.enqueued).count();
+      handler_(item.value, wait);
+      record(1, wait, boost::chrono::duration<double>(clock_t::now() - start).count());
+      // Give idle work a chance between items
+      polling = static_cast<bool>(idle_);
+    }
+  }
+
+  void record(size_t items, double wait, double busy)
+  {
+    boost::mutex::scoped_lock lock(stats_mutex_);
+    stats_.items += items;
+    stats_.wait_sum += wait;
+    stats_.busy_sum += busy;
+    stats_.busy_max = std::max(stats_.busy_max, busy);
+  }
+
+  std::string name_;
+  Overflow overflow_;
+  Queue queue_;
+  Handler handler_;
+  IdleHandler idle_;
+  boost::shared_ptr<boost::thread> thread_;
+
+  boost::mutex stats_mutex_;
+  StageReport stats_;
+  typename clock_t::time_point stats_start_;
+};
+
+#endif // RELATIVE_SLAM_PIPELINE_STAGE_H
@@ -0,0 +1,194 @@
+#ifndef RELATIVE_SLAM_RELATIVE_SLAM_H
+#define RELATIVE_SLAM_RELATIVE_SLAM_H
+
+#include "ros/ros.h"
+#include "message_filters/subscriber.h"
+#include "tf/transform_broadcaster.h"
+#include "tf/transform_listener.h"
+#include "tf/message_filter.h"
+#include "nav_msgs/GetMap.h"
+#include "nav_msgs/Odometry.h"
+#include "sensor_msgs/LaserScan.h"
+#include "map_msgs/OccupancyGridUpdate.h"
+
+#include <relative_slam/slam_core.h>
+#include <relative_slam/admission_controller.h>
+#include <relative_slam/graph_visualizer.h>
+#include <relative_slam/map_codec.h>
+#include <relative_slam/map_pyramid.h>
+#include <relative_slam/occupancy_grid.h>
+#include <relative_slam/odometry_buffer.h>
+#include <relative_slam/pipeline_stage.h>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <map>
+#include <vector>
+#include <set>
+
+// The SLAM node: scans in, map, transforms and pose graph out. The mapping
+// itself is done by SlamCore; the node feeds it scans with odometry from tf
+// or odom_topic, and publishes what it produces. It runs the same way as the
+// relative_slam executable and as the relative_slam/RelativeSlamNodelet
+// nodelet; as a nodelet, scans and the published maps and markers are
+// passed by pointer within the process.
+class RelativeSlam
+{
+  public:
+    // Topics and services are set up on node, parameters read from private_nh
+    RelativeSlam(ros::NodeHandle node, ros::NodeHandle private_nh);
+    ~RelativeSlam();
+
+    void laserCallback(const sensor_msgs::LaserScan::ConstPtr& scan);
+    void odomCallback(const nav_msgs::Odometry::ConstPtr& odom);
+    bool mapCallback(nav_msgs::GetMap::Request  &req,
+                                 nav_msgs::GetMap::Response &res);
+
+  private:
+    bool lookupOdom(const ros::Time& t, karto::Pose2& rOdomPose);
+    // Registers the scan's laser with the core the first time it is seen
+    bool getLaser(const sensor_msgs::LaserScan::ConstPtr& scan);
+    bool updateMap();
+    void mapStep(const ros::Time& stamp, double wait);
+    void localMapStep(const ros::Time& stamp, double wait);
+    bool updateLocalMap();
+    void publishMapPyramid(const std_msgs::Header& rHeader);
+    typedef nav_msgs::GetMap::Response MapResponse;
+    boost::shared_ptr<MapResponse> takeMapBuffer();
+    void exportTile(MapResponse& rMap, const IncrementalOccupancyGrid::TileIndex& rIndex) const;
+    map_msgs::OccupancyGridUpdate makeTileUpdate(const MapResponse& rMap, const IncrementalOccupancyGrid::TileIndex& rIndex) const;
+    void publishTransform();
+    void publishLoop(double transform_publish_period);
+    void publishPoseLoop(double pose_publish_period);
+    void graphExportLoop(double graph_export_period);
+    void publishVis(double vis_publish_period);
+    void publishGraphVisualization();
+    void frontendStep(const sensor_msgs::LaserScan::ConstPtr& scan, double wait);
+    template <typename T> StageReport takeStageReport(PipelineStage<T>& rStage);
+    void monitorPipeline(const ros::WallTimerEvent& event);
+    void updateLogLevel(const ros::WallTimerEvent& event);
+
+     // ROS handles
+    ros::NodeHandle node_;
+    ros::NodeHandle private_nh_;
+    tf::TransformListener tf_;
+    tf::TransformBroadcaster* tfB_;
+    message_filters::Subscriber<sensor_msgs::LaserScan>* scan_filter_sub_;
+    tf::MessageFilter<sensor_msgs::LaserScan>* scan_filter_;
+    // Recent odometry from odom_topic, if set; scans then skip the tf
+    // filter and look up their pose here, waiting up to odom_timeout_ for
+    // odometry to catch up with them
+    boost::shared_ptr<OdometryBuffer> odom_buffer_;
+    ros::Subscriber odom_sub_;
+    double odom_timeout_;
+    ros::Publisher sst_;
+    ros::Publisher marker_publisher_;
+    ros::Publisher sstm_;
+    ros::Publisher sstu_;
+    ros::ServiceServer ss_;
+
+    // The map that will be published / send to service callers. Snapshots
+    // are immutable once stored; readers take a reference with atomic_load
+    // and never block the map thread, which swaps in a new one with
+    // atomic_store. The map thread alternates between two buffers: the one
+    // it writes next is the previous snapshot, brought up to date with the
+    // tiles it missed, unless a reader still holds it.
+    boost::shared_ptr<const MapResponse> map_snapshot_;
+    boost::shared_ptr<MapResponse> map_front_;
+    boost::shared_ptr<MapResponse> map_back_;
+    std::vector<IncrementalOccupancyGrid::TileIndex> map_back_stale_;
+
+    // The full map is republished at this interval or when its bounds change;
+    // in between only changed tiles go out on map_updates
+    ros::Duration map_full_publish_interval_;
+    ros::Time last_full_map_publish_;
+    // The map is built by its own pipeline stage; requests that arrive
+    // while it is busy collapse into a single pending one
+    typedef PipelineStage<ros::Time> MapStage;
+    boost::shared_ptr<MapStage> map_stage_;
+    // Max-pooled coarse copies of the map, updated from the changed tiles
+    // and published on map_level_<n>
+    boost::shared_ptr<MapPyramid> map_pyramid_;
+    std::vector<ros::Publisher> map_pyramid_pubs_;
+    // Run-length encoded keyframes and tile deltas of the map on
+    // map_compressed; with loopback, every message is also decoded here and
+    // checked against the map it was made from
+    bool publish_compressed_map_;
+    bool compressed_map_loopback_;
+    boost::shared_ptr<MapEncoder> map_encoder_;
+    MapDecoder map_loopback_decoder_;
+    ros::Publisher smc_;
+
+    // Grid of the keyframes within local_map_distance_ hops of the newest
+    // one, rebuilt in relative_map_frame_ on its own thread so its cost does
+    // not grow with the mission
+    bool local_map_;
+    int local_map_distance_;
+    ros::Duration local_map_update_interval_;
+    IncrementalOccupancyGrid local_grid_;
+    boost::shared_ptr<MapStage> local_map_stage_;
+    ros::Publisher local_map_pub_;
+
+    // Storage for ROS parameters
+    std::string odom_frame_;
+    std::string global_map_frame_;
+    std::string relative_map_frame_;
+    std::string base_frame_;
+    ros::Duration map_update_interval_;
+
+    // The mapping pipeline, with its back-end and loop closure stages
+    boost::shared_ptr<SlamCore> core_;
+    boost::shared_ptr<GraphVisualizer> visualizer_;
+
+    // Scans are handed to the core by the front-end stage. Its input queue
+    // drops the oldest scan when matching falls behind.
+    typedef PipelineStage<sensor_msgs::LaserScan::ConstPtr> FrontendStage;
+    boost::shared_ptr<FrontendStage> frontend_stage_;
+    ros::Time last_map_update_;
+    ros::Time last_local_map_update_;
+
+    // The stages are sampled at this timer's period, for the admission
+    // controller if it is enabled; their counters are logged every
+    // pipeline_stats_period_ seconds
+    ros::WallTimer pipeline_timer_;
+    // Keeps the core's log level in line with rosconsole's
+    ros::WallTimer log_level_timer_;
+    double pipeline_stats_period_;
+    std::map<std::string, StageReport> stage_totals_;
+
+    // Adapts throttle_scans and the motion gating thresholds to the load of
+    // the pipeline and publishes each decision on admission_decisions. The
+    // limits in effect are kept by the core, since the ROS callback and the
+    // core both read them.
+    boost::shared_ptr<AdmissionController> admission_controller_;
+    ros::Publisher admission_pub_;
+
+    // Lasers mounted upside-down, whose ranges are reversed for the core
+    std::map<std::string, bool> lasers_inverted_;
+
+    // Internal state
+    // Set by the map thread, read by the scan callback
+    boost::atomic<bool> got_map_;
+    // Set by the destructor to end the publishing threads; ros::ok() stays
+    // true when the node runs as a nodelet that is being unloaded
+    boost::atomic<bool> shutdown_;
+    boost::thread* transform_thread_;
+    boost::thread* vis_thread_;
+    size_t marker_subscribers_;
+    // Periodically writes the global graph on a low priority thread
+    boost::shared_ptr<boost::thread> graph_export_thread_;
+    std::string graph_export_file_;
+    std::string graph_export_scene_file_;
+    int graph_export_niceness_;
+    ros::Publisher graph_poses_pub_;
+    // Latest odometry composed with the latest correction, published on
+    // pose at its own rate for consumers that cannot wait for keyframes
+    boost::shared_ptr<boost::thread> pose_thread_;
+    ros::Publisher pose_pub_;
+    int laser_count_;
+    double resolution_;
+};
+
+#endif // RELATIVE_SLAM_RELATIVE_SLAM_H
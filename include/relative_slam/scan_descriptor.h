@@ -0,0 +1,44 @@
+#ifndef RELATIVE_SLAM_SCAN_DESCRIPTOR_H
+#define RELATIVE_SLAM_SCAN_DESCRIPTOR_H
+
+#include <boost/thread/mutex.hpp>
+#include <vector>
+
+// Compact, rotation invariant place signature of a laser scan: the
+// normalized histogram of its beam ranges. Scans taken at the same place
+// with any heading produce similar histograms, which makes the descriptor
+// a cheap test before running a correlative grid match.
+class ScanDescriptor
+{
+public:
+  ScanDescriptor() { }
+  ScanDescriptor(const std::vector<double>& ranges, double max_range, size_t bins);
+
+  // Half the L1 distance between the histograms, in [0, 1]
+  double Distance(const ScanDescriptor& rOther) const;
+  bool IsEmpty() const { return histogram_.empty(); }
+
+private:
+  std::vector<float> histogram_;
+};
+
+// Descriptors of all keyframes, indexed by keyframe id. Written by the
+// front-end and searched from the loop closure thread.
+class ScanDescriptorIndex
+{
+public:
+  void Insert(int id, const ScanDescriptor& rDescriptor);
+  bool Get(int id, ScanDescriptor& rDescriptor) const;
+
+  // Smallest distance from the query to any of the given keyframes; 1.0
+  // (the largest possible distance) if none of them is indexed
+  double MinDistance(const ScanDescriptor& rQuery, const std::vector<int>& rIds) const;
+
+  size_t Size() const;
+
+private:
+  mutable boost::mutex mutex_;
+  std::vector<ScanDescriptor> descriptors_;
+};
+
+#endif // RELATIVE_SLAM_SCAN_DESCRIPTOR_H
@@ -0,0 +1,72 @@
+#ifndef RELATIVE_SLAM_SCAN_LOG_H
+#define RELATIVE_SLAM_SCAN_LOG_H
+
+#include <relative_slam/odometry_buffer.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// A laser's pose on the robot (m, rad) and its beam geometry
+struct LogLaser
+{
+  LogLaser() : x(0.0), y(0.0), yaw(0.0), min_range(0.0), max_range(0.0),
+               min_angle(0.0), max_angle(0.0), angle_increment(0.0) { }
+
+  std::string name;
+  double x, y, yaw;
+  double min_range, max_range;
+  double min_angle, max_angle, angle_increment;
+};
+
+// One scan at a time in seconds, ranges counterclockwise
+struct LogScan
+{
+  LogScan() : stamp(0.0) { }
+
+  double stamp;
+  std::string laser;
+  std::vector<double> ranges;
+};
+
+// Reads a plain text log of laser scans and odometry, one record per line
+// in the order they were recorded:
+//
+//   laser <name> <x> <y> <yaw> <min_range> <max_range> <min_angle> <max_angle> <angle_increment>
+//   odom <stamp> <x> <y> <yaw>
+//   scan <stamp> <laser> <count> <range>...
+//
+// A laser is declared before its first scan. Blank lines and lines starting
+// with # are skipped. Records are read one at a time into buffers that are
+// reused, so a log of any length is read in constant memory.
+class TextScanLog
+{
+public:
+  enum Record { Laser, Odometry, Scan, End, Error };
+
+  explicit TextScanLog(const std::string& path);
+
+  bool IsOpen() const { return file_.is_open(); }
+
+  // Reads the next record; the matching accessor below holds it until the
+  // next call. After Error, GetError() says what and where.
+  Record Next();
+
+  const LogLaser& GetLaser() const { return laser_; }
+  const OdometrySample& GetOdometry() const { return odometry_; }
+  const LogScan& GetScan() const { return scan_; }
+  const std::string& GetError() const { return error_; }
+
+private:
+  Record fail(const std::string& rMessage);
+
+  std::ifstream file_;
+  std::string line_;
+  int line_number_;
+
+  LogLaser laser_;
+  OdometrySample odometry_;
+  LogScan scan_;
+  std::string error_;
+};
+
+#endif // RELATIVE_SLAM_SCAN_LOG_H
@@ -0,0 +1,64 @@
+#ifndef RELATIVE_SLAM_SEQLOCK_H
+#define RELATIVE_SLAM_SEQLOCK_H
+
+#include <boost/atomic.hpp>
+#include <cstring>
+
+// Single writer, many reader value with a sequence lock. The writer never
+// waits; a reader copies the value and retries if the writer changed it
+// meanwhile, so neither side ever blocks the other. The sequence is odd
+// while a write is in progress. T must be a plain struct that may be copied
+// byte by byte, and Store() must only be called from one thread at a time.
+template <typename T>
+class SeqLock
+{
+public:
+  SeqLock() : seq_(0)
+  {
+    std::memset(data_, 0, sizeof(data_));
+  }
+
+  explicit SeqLock(const T& value) : seq_(0)
+  {
+    std::memcpy(data_, &value, sizeof(T));
+  }
+
+  void Store(const T& value)
+  {
+    unsigned long seq = seq_.load(boost::memory_order_relaxed);
+    seq_.store(seq + 1, boost::memory_order_relaxed);
+    boost::atomic_thread_fence(boost::memory_order_release);
+    std::memcpy(data_, &value, sizeof(T));
+    seq_.store(seq + 2, boost::memory_order_release);
+  }
+
+  T Load() const
+  {
+    T value;
+    unsigned long before, after;
+    do
+    {
+      before = seq_.load(boost::memory_order_acquire);
+      if(before & 1)
+        continue;
+      std::memcpy(&value, data_, sizeof(T));
+      boost::atomic_thread_fence(boost::memory_order_acquire);
+      after = seq_.load(boost::memory_order_relaxed);
+      if(before == after)
+        break;
+    } while(true);
+    return value;
+  }
+
+  // Number of completed stores
+  unsigned long Version() const
+  {
+    return seq_.load(boost::memory_order_acquire) / 2;
+  }
+
+private:
+  boost::atomic<unsigned long> seq_;
+  unsigned char data_[sizeof(T)];
+};
+
+#endif // RELATIVE_SLAM_SEQLOCK_H
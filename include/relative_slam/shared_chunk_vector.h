@@ -0,0 +1,70 @@
+#ifndef RELATIVE_SLAM_SHARED_CHUNK_VECTOR_H
+#define RELATIVE_SLAM_SHARED_CHUNK_VECTOR_H
+
+#include <boost/shared_ptr.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// Vector stored in chunks of ChunkSize elements that its copies share, so
+// copying it is linear in the number of chunks rather than elements.
+// Modify() first copies the element's chunk if a copy still shares it, so
+// copies never see each other's changes. Each copy must only be modified by
+// one thread; a chunk only it holds cannot become shared behind its back.
+template <typename T, size_t ChunkSize = 64>
+class SharedChunkVector
+{
+public:
+  SharedChunkVector() : size_(0) { }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  const T& operator[](size_t i) const
+  {
+    return (*chunks_[i / ChunkSize])[i % ChunkSize];
+  }
+
+  const T& back() const { return (*this)[size_ - 1]; }
+
+  T& Modify(size_t i)
+  {
+    return Unshare(i / ChunkSize)[i % ChunkSize];
+  }
+
+  void push_back(const T& value)
+  {
+    resize(size_ + 1);
+    Modify(size_ - 1) = value;
+  }
+
+  // Only grows; new elements are default constructed
+  void resize(size_t size)
+  {
+    while(size_ < size)
+    {
+      if(size_ % ChunkSize == 0)
+        chunks_.push_back(boost::shared_ptr<Chunk>(new Chunk()));
+      Chunk& rChunk = Unshare(chunks_.size() - 1);
+      size_t count = std::min(size - size_, ChunkSize - rChunk.size());
+      rChunk.resize(rChunk.size() + count);
+      size_ += count;
+    }
+  }
+
+private:
+  typedef std::vector<T> Chunk;
+
+  Chunk& Unshare(size_t chunk)
+  {
+    boost::shared_ptr<Chunk>& rChunk = chunks_[chunk];
+    if(!rChunk.unique())
+      rChunk.reset(new Chunk(*rChunk));
+    return *rChunk;
+  }
+
+  std::vector<boost::shared_ptr<Chunk> > chunks_;
+  size_t size_;
+};
+
+#endif // RELATIVE_SLAM_SHARED_CHUNK_VECTOR_H
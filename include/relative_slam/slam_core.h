@@ -0,0 +1,350 @@
+#ifndef RELATIVE_SLAM_SLAM_CORE_H
+#define RELATIVE_SLAM_SLAM_CORE_H
+
+#include "OpenKarto/OpenMapper.h"
+#include <relative_slam/srba_solver.h>
+#include <relative_slam/admission_controller.h>
+#include <relative_slam/graph_snapshot.h>
+#include <relative_slam/loop_closure_cache.h>
+#include <relative_slam/occupancy_grid.h>
+#include <relative_slam/pipeline_stage.h>
+#include <relative_slam/scan_descriptor.h>
+#include <relative_slam/seqlock.h>
+#include <relative_slam/thread_pool.h>
+#include <relative_slam/work_queue.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Everything that configures the mapping itself, with the defaults the
+// node has always used
+struct SlamParams
+{
+  SlamParams() :
+    resolution(0.05),
+    map_reraycast_distance(0.05),
+    map_reraycast_angle(0.01),
+    map_threads(0),
+    scan_buffer_size(70),
+    scan_buffer_max_distance(20),
+    corr_search_space_dim(0.3),
+    corr_search_space_res(0.01),
+    corr_search_space_smear_dev(0.03),
+    laser_range_threshold(15.0),
+    minimum_travel_distance(0.2),
+    minimum_travel_heading(0.35),
+    link_match_min_response_fine(0.8),
+    use_scan_barycenter(true),
+    link_scan_max_distance(10.0),
+    is_multithreaded(false),
+    loop_match_min_chain_size(10),
+    loop_match_max_variance_coarse(0.16),
+    loop_match_min_response_coarse(0.7),
+    loop_match_min_response_fine(0.8),
+    loop_search_space_dim(8),
+    loop_search_space_res(0.05),
+    loop_search_space_smear_dev(0.03),
+    loop_search_max_distance(4.0),
+    loop_match_max_fine_candidates(2),
+    loop_closure_batch_size(8),
+    loop_closure_queue_size(5),
+    loop_closure_max_latency(2.0),
+    loop_closure_threads(0),
+    loop_descriptor_bins(40),
+    loop_descriptor_max_distance(0.35),
+    loop_cache_size(2000),
+    loop_cache_invalidate_distance(0.1),
+    loop_cache_invalidate_angle(0.05),
+    loop_cache_cell_size(0.5),
+    loop_cache_cell_angle(0.5),
+    loop_closure_budget(0.5),
+    loop_backlog_size(100),
+    loop_priority_travel_scale(50.0),
+    backend_queue_size(20),
+    synchronous(false)
+  {
+  }
+
+  // Map cell size (m); scans whose pose changed by more than
+  // map_reraycast_distance (m) or map_reraycast_angle (rad) since they were
+  // raycast are raycast again, on map_threads threads (0 is one per core)
+  double resolution;
+  double map_reraycast_distance;
+  double map_reraycast_angle;
+  int map_threads;
+
+  // Scan matching and linking
+  int scan_buffer_size;
+  double scan_buffer_max_distance;
+  double corr_search_space_dim;
+  double corr_search_space_res;
+  double corr_search_space_smear_dev;
+  double laser_range_threshold;
+  double minimum_travel_distance;
+  double minimum_travel_heading;
+  double link_match_min_response_fine;
+  bool use_scan_barycenter;
+  double link_scan_max_distance;
+  bool is_multithreaded;
+
+  // Loop closure, see the node's parameters of the same names
+  int loop_match_min_chain_size;
+  double loop_match_max_variance_coarse;
+  double loop_match_min_response_coarse;
+  double loop_match_min_response_fine;
+  double loop_search_space_dim;
+  double loop_search_space_res;
+  double loop_search_space_smear_dev;
+  double loop_search_max_distance;
+  int loop_match_max_fine_candidates;
+  int loop_closure_batch_size;
+  int loop_closure_queue_size;
+  double loop_closure_max_latency;
+  int loop_closure_threads;
+  int loop_descriptor_bins;
+  double loop_descriptor_max_distance;
+  int loop_cache_size;
+  double loop_cache_invalidate_distance;
+  double loop_cache_invalidate_angle;
+  double loop_cache_cell_size;
+  double loop_cache_cell_angle;
+  double loop_closure_budget;
+  int loop_backlog_size;
+  double loop_priority_travel_scale;
+
+  // Keyframes waiting for the solver beyond this hold up addScan()
+  int backend_queue_size;
+
+  // Run the solver and loop closure in the thread adding scans, and
+  // evaluate every loop candidate without a time budget, so that the same
+  // scans always give the same map. For offline processing.
+  bool synchronous;
+};
+
+// Planar pose of the robot in the global map at a time in seconds
+struct StampedPose
+{
+  double stamp;
+  double x, y, yaw;
+};
+
+// The latest correction as planar transforms from the global map: to the
+// odometry frame, and to the relative map frame at the newest keyframe
+struct MapCorrection
+{
+  double odom_x, odom_y, odom_yaw;
+  double relative_map_x, relative_map_y, relative_map_yaw;
+};
+
+// Occupancy grid with the cells in row major order from the lower left
+// corner at (origin_x, origin_y): -1 unknown, 0 free, 100 occupied
+struct GridMap
+{
+  GridMap() : resolution(0.0), origin_x(0.0), origin_y(0.0), width(0), height(0) { }
+
+  double resolution;
+  double origin_x;
+  double origin_y;
+  int width;
+  int height;
+  std::vector<signed char> data;
+};
+
+// The mapping pipeline without ROS: laser scans and odometry in, pose graph,
+// correction and map out. Scan matching runs in the thread calling
+// addScan(); the solver and loop closure run on pipeline stages of their
+// own, or in that thread too if SlamParams::synchronous is set. Everything
+// is in karto's frame, in which odometry starts at the origin; there is no
+// tf, no clock but the caller's stamps, and no publishing, which is left to
+// the ROS node or whatever embeds it.
+class SlamCore
+{
+public:
+  explicit SlamCore(const SlamParams& params);
+  ~SlamCore();
+
+  // Registers a laser by name with its pose on the robot and its beam
+  // geometry (m, rad); scans must list their ranges counterclockwise
+  void addLaser(const std::string& name, const karto::Pose2& offset, double min_range, double max_range,
+                double min_angle, double max_angle, double angular_resolution);
+  bool hasLaser(const std::string& name) const;
+
+  // Matches a scan of a registered laser taken at stamp (s) with the robot
+  // at odom_pose in the odometry frame. Returns true if it became a
+  // keyframe. Only one thread may add scans.
+  bool addScan(const std::string& laser, const std::vector<kt_double>& ranges, const karto::Pose2& odom_pose, double stamp);
+  // Applies the loop closures and corrections that are ready, which
+  // addScan() otherwise leaves to the next scan. In synchronous mode that
+  // is all of them, so the graph and map then account for every scan.
+  void flush();
+
+  // Robot pose in the global map as of the last scan added; false before the first
+  bool getPose(StampedPose& rPose) const;
+  MapCorrection getCorrection() const { return map_correction_.Load(); }
+  // Number of corrections stored so far
+  unsigned long getCorrectionVersion() const { return map_correction_.Version(); }
+
+  // The keyframes and constraints as of the latest keyframe or correction;
+  // NULL before the first keyframe
+  GraphSnapshotPtr getGraph() const;
+
+  // Raycasts new and moved keyframes into the grid and returns the tiles
+  // that changed since the previous update; false while the map is empty.
+  // updateMap(), getMap() and getGrid() are for one thread at a time.
+  bool updateMap(std::vector<IncrementalOccupancyGrid::TileIndex>& rChangedTiles);
+  // Brings the grid up to date and copies all of it
+  bool getMap(GridMap& rMap);
+  const IncrementalOccupancyGrid& getGrid() const { return occupancy_grid_; }
+  // Beams of a keyframe's scan from its current pose, clipped to the range threshold
+  ScanRays computeScanRays(const karto::LocalizedLaserScan* pScan) const;
+
+  // Writes the global graph of a snapshot, see SRBASolver::ExportGlobalGraph()
+  bool exportGraph(const GraphSnapshot& rGraph, bool optimize, const std::string& graph_file,
+                   const std::string& scene_file, std::vector<karto::Pose2>* pPoses) const;
+
+  // Motion gating thresholds for new keyframes; may be changed any time
+  void setAdmissionLimits(const AdmissionLimits& limits);
+  boost::shared_ptr<const AdmissionLimits> getAdmissionLimits() const;
+
+  // Counters of the back-end and loop closure stages since the previous
+  // call, by stage name
+  void takeStageReports(std::map<std::string, StageReport>& rReports);
+
+  const SlamParams& getParams() const { return params_; }
+
+private:
+  bool hasMovedEnough(karto::LocalizedRangeScan* pScan, karto::LocalizedRangeScan* pLastScan) const;
+  bool process(karto::LocalizedRangeScan* pScan);
+
+  // These really should be moved back into karto once the graph stuff has been ripped out
+  bool addEdges(karto::LocalizedObject *pObject);
+  void LinkObjects(karto::LocalizedObject* pFromObject, karto::LocalizedObject* pToObject, const karto::Pose2& rMean, const karto::Matrix3& rCovariance);
+  void addConstraint(int fromId, const karto::Pose2& rFromPose, int toId, const karto::Pose2& rMean, const karto::Matrix3& rCovariance, bool loopClosure);
+  bool AddEdges(karto::LocalizedLaserScanPtr pScan, const karto::Matrix3& rCovariance);
+  void LinkChainToScan(const karto::LocalizedLaserScanList& rChain, karto::LocalizedLaserScanPtr pScan, const karto::Pose2& rMean, const karto::Matrix3& rCovariance);
+  void LinkNearChains(karto::LocalizedLaserScanPtr pScan, karto::Pose2List& rMeans, karto::List<karto::Matrix3>& rCovariances);
+  karto::Pose2 ComputeWeightedMean(const karto::Pose2List& rMeans, const karto::List<karto::Matrix3>& rCovariances) const;
+  karto::LocalizedLaserScanPtr GetClosestScanToPose(const karto::LocalizedLaserScanList& rScans, const karto::Pose2& rPose) const;
+  karto::List<karto::LocalizedLaserScanList> FindNearChains(karto::LocalizedLaserScanPtr pScan);
+  karto::LocalizedLaserScanList FindNearLinkedScans(karto::LocalizedLaserScanPtr pScan, kt_double maxDistance);
+  std::set<int> FindNearLinkedIds(const GraphSnapshot& rGraph, int id, kt_double maxDistance) const;
+  void TryCloseLoop(const GraphSnapshot& rGraph, const KeyframeRecord& rQuery);
+  struct LoopCandidate;
+  void GatherLoopCandidates(const GraphSnapshot& rGraph, const KeyframeRecord& rQuery);
+  void EvaluateLoopCandidates(double budget);
+  bool VerifyLoopCandidate(LoopCandidate& rCandidate);
+  void CoarseMatchCandidate(std::vector<LoopCandidate>* pCandidates, size_t index, size_t worker);
+  bool IsCoarseMatchAccepted(kt_double response, const karto::Matrix3& rCovariance) const;
+  ScanDescriptor ComputeDescriptor(const karto::LocalizedLaserScan* pScan) const;
+  void loopClosureStep(const int& id, double wait);
+  bool loopClosureIdle();
+  void FindPossibleLoopClosure(const GraphSnapshot& rGraph, const KeyframeRecord& rQuery, size_t& rStartIndex, std::vector<int>& rChain) const;
+  void CorrectPoses(const IdPoseVector& rCorrections);
+  karto::LocalizedLaserScanPtr freezeScan(const karto::LocalizedLaserScan* pScan) const;
+  void recordKeyframe(karto::LocalizedLaserScan* pScan);
+  void publishGraphSnapshot();
+  void applyLoopClosures();
+  void applyCorrections();
+  struct BackendJob;
+  void submitBackendJob();
+  void backendStep(const BackendJob& rJob, double wait);
+
+  SlamParams params_;
+
+  // Karto bookkeeping. The scan manager and the sequential matcher belong
+  // to the thread adding scans, the solver's graph to the back-end stage; no
+  // other thread may touch them.
+  karto::MapperSensorManager* scan_manager_;
+  karto::ScanMatcher* sequential_scan_matcher_;
+  // One coarse loop matcher per loop closure worker thread, and the fine
+  // matcher of the loop closure thread itself
+  std::vector<karto::ScanMatcher*> loop_scan_matchers_;
+  karto::ScanMatcher* loop_fine_matcher_;
+  SRBASolver solver_;
+  std::map<std::string, karto::LaserRangeFinder*> lasers_;
+  int next_keyframe_id_;
+  // Odometry of the first scan, which karto's frame starts at
+  bool got_initial_pose_;
+  karto::Pose2 initial_pose_;
+
+  // Solver work of one keyframe, or of a batch of loop closures, in the
+  // order the front-end produced it. The back-end stage owns the solver;
+  // its queue blocks the front-end when full, since no job may be lost.
+  struct BackendJob
+  {
+    BackendJob() : node_id(-1), correct(false) { }
+    int node_id;   // keyframe to add before the constraints, -1 for none
+    karto::Pose2 node_pose;
+    std::vector<GraphEdge> constraints;
+    bool correct;  // send the corrected poses back afterwards
+  };
+  typedef PipelineStage<BackendJob> BackendStage;
+  boost::shared_ptr<BackendStage> backend_stage_;
+  BackendJob backend_job_;
+  WorkQueue<IdPoseVector> corrections_queue_;
+  // Keyframe pairs already constrained in graph_, mirroring the solver's
+  // rule for dropping repeated constraints
+  std::set<std::pair<int, int> > constrained_pairs_;
+
+  // Motion gating in effect, swapped in with atomic_store
+  boost::shared_ptr<const AdmissionLimits> admission_limits_;
+
+  // The front-end's working copy of the keyframes and constraints, and the
+  // immutable snapshot of it the other threads read. A new snapshot is
+  // stored with atomic_store after every keyframe and correction.
+  GraphSnapshot graph_;
+  GraphSnapshotPtr graph_snapshot_;
+
+  // The latest correction, stored after every keyframe, and the robot pose
+  // of the latest scan; readers never wait for either
+  SeqLock<MapCorrection> map_correction_;
+  SeqLock<StampedPose> pose_;
+
+  // Persistent grid that scans are raycast into as they arrive or move,
+  // with the raycasting of an update split over map_pool_
+  IncrementalOccupancyGrid occupancy_grid_;
+  boost::shared_ptr<ThreadPool> map_pool_;
+
+  boost::mutex loop_closure_mutex_;
+
+  // Ids of keyframes waiting for a loop closure attempt, each handed out once
+  typedef PipelineStage<int> LoopClosureStage;
+  boost::shared_ptr<LoopClosureStage> loop_closure_stage_;
+  boost::shared_ptr<ThreadPool> loop_closure_pool_;
+
+  // Verified loop closures, found against a snapshot and applied to the
+  // solver by the front-end before its next scan
+  struct LoopClosure
+  {
+    int query_id;
+    int closest_id;
+    karto::Pose2 closest_pose;
+    karto::Pose2 mean;
+    karto::Matrix3 covariance;
+  };
+  typedef WorkQueue<LoopClosure> LoopClosureResultQueue;
+  LoopClosureResultQueue loop_closure_results_;
+
+  // Place descriptors of all keyframes, used to reject chains before coarse matching
+  ScanDescriptorIndex descriptor_index_;
+  int loop_descriptor_rejected_;
+  int loop_descriptor_tested_;
+
+  // Failed loop closure attempts, so the same query/chain pair is not matched twice
+  LoopClosureCache loop_closure_cache_;
+
+  // Ranked candidates not yet evaluated, carried over between keyframes
+  std::vector<LoopCandidate> loop_backlog_;
+  double travel_since_loop_closure_;
+
+  // Loop closure queue statistics
+  int loop_closure_attempts_;
+  int loop_closure_stale_;
+  double loop_closure_latency_sum_;
+  double loop_closure_latency_max_;
+};
+
+#endif // RELATIVE_SLAM_SLAM_CORE_H
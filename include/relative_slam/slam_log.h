@@ -0,0 +1,53 @@
+#ifndef RELATIVE_SLAM_SLAM_LOG_H
+#define RELATIVE_SLAM_SLAM_LOG_H
+
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <string>
+
+// Logging of the ROS-free parts. Messages go to stderr unless a handler is
+// set; the ROS node sets one that passes them on to rosconsole. Both are
+// process wide, shared by every SlamCore.
+enum LogLevel { LogDebug, LogInfo, LogWarn, LogError };
+
+typedef boost::function<void (LogLevel level, const std::string& rMessage)> LogHandler;
+
+// May not be called while other threads are logging, so set it once, before
+// the first SlamCore starts, and leave it
+void SetLogHandler(const LogHandler& handler);
+// May be called any time; messages below level are not even formatted
+void SetLogLevel(LogLevel level);
+
+bool LogEnabled(LogLevel level);
+void LogPrintf(LogLevel level, const char* format, ...)
+#ifdef __GNUC__
+  __attribute__((format(printf, 2, 3)))
+#endif
+  ;
+// Monotonic seconds, for throttling
+double LogTime();
+
+#define SLAM_LOG(level, ...) \
+  do { if(LogEnabled(level)) LogPrintf(level, __VA_ARGS__); } while(0)
+// At most once per period seconds from this statement, whichever thread
+// gets there first
+#define SLAM_LOG_THROTTLE(level, period, ...) \
+  do { \
+    static boost::atomic<double> slam_log_last_(-1e300); \
+    if(LogEnabled(level)) { \
+      double slam_log_now_ = LogTime(); \
+      double slam_log_prev_ = slam_log_last_.load(boost::memory_order_relaxed); \
+      if(slam_log_now_ - slam_log_prev_ >= (period) && \
+         slam_log_last_.compare_exchange_strong(slam_log_prev_, slam_log_now_, boost::memory_order_relaxed)) \
+        LogPrintf(level, __VA_ARGS__); \
+    } \
+  } while(0)
+
+#define SLAM_DEBUG(...) SLAM_LOG(LogDebug, __VA_ARGS__)
+#define SLAM_INFO(...) SLAM_LOG(LogInfo, __VA_ARGS__)
+#define SLAM_WARN(...) SLAM_LOG(LogWarn, __VA_ARGS__)
+#define SLAM_ERROR(...) SLAM_LOG(LogError, __VA_ARGS__)
+#define SLAM_INFO_THROTTLE(period, ...) SLAM_LOG_THROTTLE(LogInfo, period, __VA_ARGS__)
+#define SLAM_WARN_THROTTLE(period, ...) SLAM_LOG_THROTTLE(LogWarn, period, __VA_ARGS__)
+
+#endif // RELATIVE_SLAM_SLAM_LOG_H
@@ -3,11 +3,12 @@
 
 #include <srba/srba.h>
 #include <srba/srba_types.h>
-#include <visualization_msgs/MarkerArray.h>
 #include <OpenKarto/SensorData.h>
 #include <OpenKarto/Geometry.h>
-#include <ros/ros.h>
+#include <relative_slam/graph_snapshot.h>
 #include <vector>
+#include <set>
+#include <boost/thread/mutex.hpp>
 #include <mrpt/graphslam.h>
 #include <mrpt/opengl/graph_tools.h>
 using namespace srba;
@@ -134,14 +135,18 @@ public:
   virtual IdPoseVector& GetCorrections();
 
   int AddNode(const karto::Pose2 &pose);
-  void AddConstraint(int sourceId, int targetId, const karto::Pose2 &rDiff, const karto::Matrix3& rCovariance);
-
-  //virtual void AddConstraint(karto::Edge<karto::LocalizedRangeScan>* pEdge);
-  virtual void getActiveIds(std::vector<int> &ids);
-
-  void publishGraphVisualization(visualization_msgs::MarkerArray &marray);
-  void publishGlobalGraph();
-  void setLoopClosed(){loop_closed_ = true;};
+  // Returns false if the observation was dropped: the pair of keyframes is
+  // already constrained, or the constraint links a keyframe to itself
+  bool AddConstraint(int sourceId, int targetId, const karto::Pose2 &rDiff, const karto::Matrix3& rCovariance);
+
+  // The global graph of all keyframes of the snapshot, optimized first if
+  // asked to; false if there are too few keyframes
+  bool GetGlobalGraph(const GraphSnapshot &graph, bool optimize, mrpt::graphs::CNetworkOfPoses3D &poseGraph) const;
+  // Writes the global graph as an MRPT text graph and/or a .3Dscene file for
+  // offline viewing (empty names are skipped) and fills poses, in keyframe
+  // id order, if given. Runs without a display and never waits for user input.
+  bool ExportGlobalGraph(const GraphSnapshot &graph, bool optimize, const std::string &graph_file, const std::string &scene_file,
+                         std::vector<karto::Pose2> *poses) const;
   std::vector<int> GetNearLinkedObjects(int kf_id, int max_topo_distance);
 
 protected:
@@ -151,11 +156,16 @@ protected:
   int curr_kf_id_;
   bool first_keyframe_;
   bool first_edge_;
-  int marker_count_;
   IdPoseVector corrections_;
-  std::string relative_map_frame_;
-  std::string global_map_frame_;
-  bool loop_closed_;
+
+  // Keyframe pairs passed to SRBA, as (lower id, higher id). SRBA offers no
+  // way to update an observation, so repeated constraints between the same
+  // keyframes are dropped instead of growing the graph.
+  std::set<std::pair<int, int> > constrained_pairs_;
+  boost::mutex constraint_mutex_;
+  int constraints_added_;
+  int constraints_duplicate_;
+  int constraints_self_;
 };
 
 #endif // KARTO_SRBA_SOLVER_H
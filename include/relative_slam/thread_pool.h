@@ -0,0 +1,47 @@
+#ifndef RELATIVE_SLAM_THREAD_POOL_H
+#define RELATIVE_SLAM_THREAD_POOL_H
+
+#include <boost/exception_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <vector>
+
+// Fixed set of worker threads running batches of indexed tasks. Each task
+// is told which worker runs it, so callers can keep per-worker resources
+// (e.g. one scan matcher per thread) without further locking.
+class ThreadPool
+{
+public:
+  typedef boost::function<void(size_t task, size_t worker)> Task;
+
+  explicit ThreadPool(size_t num_threads);
+  ~ThreadPool();
+
+  size_t Size() const { return threads_.size(); }
+
+  // Runs task(i, worker) for every i in [0, count) and blocks until all
+  // of them have finished. Batches from different callers are serialized.
+  // If tasks throw, the rest of the batch still runs and the first
+  // exception is rethrown here.
+  void Run(size_t count, const Task& task);
+
+private:
+  void workerLoop(size_t worker);
+
+  std::vector<boost::thread*> threads_;
+  boost::mutex run_mutex_;
+
+  boost::mutex mutex_;
+  boost::condition_variable work_cond_;
+  boost::condition_variable done_cond_;
+  Task task_;
+  size_t count_;
+  size_t next_;
+  size_t finished_;
+  boost::exception_ptr error_;
+  bool shutdown_;
+};
+
+#endif // RELATIVE_SLAM_THREAD_POOL_H
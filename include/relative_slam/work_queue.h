@@ -0,0 +1,159 @@
+#ifndef RELATIVE_SLAM_WORK_QUEUE_H
+#define RELATIVE_SLAM_WORK_QUEUE_H
+
+#include <boost/chrono.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <deque>
+
+// Bounded FIFO handing work from a producer thread to a worker thread.
+// Every pushed item is handed out exactly once. When the backlog limit is
+// reached Push() drops the oldest item, so a worker that falls behind always
+// continues with the most recent data, while PushWait() makes the producer
+// wait for room instead.
+template <typename T>
+class WorkQueue
+{
+public:
+  typedef boost::chrono::steady_clock clock_t;
+
+  struct Item
+  {
+    T value;
+    clock_t::time_point enqueued;
+  };
+
+  explicit WorkQueue(size_t max_size = 0) : max_size_(max_size), dropped_(0), shutdown_(false) { }
+
+  // Returns false if an older item had to be dropped to make room.
+  bool Push(const T& value)
+  {
+    bool dropped = false;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if(shutdown_)
+        return false;
+      while(max_size_ > 0 && items_.size() >= max_size_)
+      {
+        items_.pop_front();
+        dropped_++;
+        dropped = true;
+      }
+      Item item;
+      item.value = value;
+      item.enqueued = clock_t::now();
+      items_.push_back(item);
+    }
+    cond_.notify_one();
+    return !dropped;
+  }
+
+  // As Push(), but blocks while the queue is full instead of dropping.
+  // Returns false if the queue was shut down.
+  bool PushWait(const T& value)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while(max_size_ > 0 && items_.size() >= max_size_ && !shutdown_)
+        space_cond_.wait(lock);
+      if(shutdown_)
+        return false;
+      Item item;
+      item.value = value;
+      item.enqueued = clock_t::now();
+      items_.push_back(item);
+    }
+    cond_.notify_one();
+    return true;
+  }
+
+  // Blocks until an item is available. Returns false once the queue is shut down.
+  bool Pop(Item& item)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    while(items_.empty() && !shutdown_)
+      cond_.wait(lock);
+    return popLocked(item);
+  }
+
+  // As Pop(), but gives up after timeout seconds and returns false.
+  bool Pop(Item& item, double timeout)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    clock_t::time_point deadline = clock_t::now() +
+      boost::chrono::duration_cast<clock_t::duration>(boost::chrono::duration<double>(timeout));
+    while(items_.empty() && !shutdown_)
+    {
+      if(cond_.wait_until(lock, deadline) == boost::cv_status::timeout)
+        break;
+    }
+    return popLocked(item);
+  }
+
+  // Wakes all waiting consumers; subsequent pushes are ignored.
+  void Shutdown()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      shutdown_ = true;
+      items_.clear();
+    }
+    cond_.notify_all();
+    space_cond_.notify_all();
+  }
+
+  bool IsShutdown() const
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return shutdown_;
+  }
+
+  size_t Size() const
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return items_.size();
+  }
+
+  // Number of items discarded because the backlog limit was reached
+  size_t Dropped() const
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return dropped_;
+  }
+
+  size_t MaxSize() const
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return max_size_;
+  }
+
+  void SetMaxSize(size_t max_size)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      max_size_ = max_size;
+    }
+    space_cond_.notify_all();
+  }
+
+private:
+  bool popLocked(Item& item)
+  {
+    if(shutdown_ || items_.empty())
+      return false;
+    item = items_.front();
+    items_.pop_front();
+    space_cond_.notify_one();
+    return true;
+  }
+
+  mutable boost::mutex mutex_;
+  boost::condition_variable cond_;
+  boost::condition_variable space_cond_;
+  std::deque<Item> items_;
+  size_t max_size_;
+  size_t dropped_;
+  bool shutdown_;
+};
+
+#endif // RELATIVE_SLAM_WORK_QUEUE_H
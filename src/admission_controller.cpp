@@ -0,0 +1,107 @@
+#include <relative_slam/admission_controller.h>
+#include <algorithm>
+
+static double QueueFill(const StageReport& rReport)
+{
+  return rReport.queue_capacity > 0 ? (double)rReport.queue_size / rReport.queue_capacity : 0.0;
+}
+
+// Each step moves a gating threshold by at least this fraction of its
+// range, so that a threshold configured as 0 can widen at all
+static const double MinStepFraction = 0.1;
+
+static double Widen(double value, double min, double max, double step)
+{
+  return std::min(max, std::max(value * step, value + (max - min) * MinStepFraction));
+}
+
+static double Narrow(double value, double min, double max, double step)
+{
+  return std::max(min, std::min(value / step, value - (max - min) * MinStepFraction));
+}
+
+AdmissionController::AdmissionController(const AdmissionSettings& settings) :
+  settings_(settings), limits_(settings.min_limits), last_dropped_(0), quiet_periods_(0)
+{
+}
+
+AdmissionController::Decision AdmissionController::Update(const StageReport& frontend, const StageReport& backend)
+{
+  Decision decision;
+  decision.action = Hold;
+  decision.frontend_latency = frontend.MeanWait() + frontend.MeanBusy();
+  decision.frontend_queue_fill = QueueFill(frontend);
+  decision.backend_queue_fill = QueueFill(backend);
+  decision.dropped = frontend.dropped >= last_dropped_ ? frontend.dropped - last_dropped_ : frontend.dropped;
+  last_dropped_ = frontend.dropped;
+
+  double highFill = std::max(settings_.high_queue_fill, 1e-3);
+  decision.load = std::max(settings_.target_latency > 0.0 ? decision.frontend_latency / settings_.target_latency : 0.0,
+                           std::max(decision.frontend_queue_fill, decision.backend_queue_fill) / highFill);
+
+  if(decision.load > 1.0 || decision.dropped > 0)
+  {
+    quiet_periods_ = 0;
+    if(shed(decision.reason))
+      decision.action = Shed;
+    else
+      decision.reason = "overloaded at the maximum limits";
+  }
+  else if(decision.load < settings_.low_load && ++quiet_periods_ >= settings_.relax_periods)
+  {
+    quiet_periods_ = 0;
+    if(relax(decision.reason))
+      decision.action = Relax;
+  }
+  else if(decision.load >= settings_.low_load)
+    quiet_periods_ = 0;
+
+  decision.limits = limits_;
+  return decision;
+}
+
+bool AdmissionController::shed(std::string& rReason)
+{
+  const AdmissionLimits& min = settings_.min_limits;
+  const AdmissionLimits& max = settings_.max_limits;
+  if(limits_.minimum_travel_distance < max.minimum_travel_distance ||
+     limits_.minimum_travel_heading < max.minimum_travel_heading)
+  {
+    limits_.minimum_travel_distance = Widen(limits_.minimum_travel_distance, min.minimum_travel_distance,
+                                            max.minimum_travel_distance, settings_.step);
+    limits_.minimum_travel_heading = Widen(limits_.minimum_travel_heading, min.minimum_travel_heading,
+                                           max.minimum_travel_heading, settings_.step);
+    rReason = "widened motion gating";
+    return true;
+  }
+  if(limits_.throttle_scans < max.throttle_scans)
+  {
+    limits_.throttle_scans++;
+    rReason = "throttled scans";
+    return true;
+  }
+  return false;
+}
+
+bool AdmissionController::relax(std::string& rReason)
+{
+  const AdmissionLimits& min = settings_.min_limits;
+  const AdmissionLimits& max = settings_.max_limits;
+  if(limits_.throttle_scans > min.throttle_scans)
+  {
+    limits_.throttle_scans--;
+    rReason = "unthrottled scans";
+    return true;
+  }
+  if(limits_.minimum_travel_distance > min.minimum_travel_distance ||
+     limits_.minimum_travel_heading > min.minimum_travel_heading)
+  {
+    limits_.minimum_travel_distance = Narrow(limits_.minimum_travel_distance, min.minimum_travel_distance,
+                                             max.minimum_travel_distance, settings_.step);
+    limits_.minimum_travel_heading = Narrow(limits_.minimum_travel_heading, min.minimum_travel_heading,
+                                            max.minimum_travel_heading, settings_.step);
+    rReason = "narrowed motion gating";
+    return true;
+  }
+  return false;
+}
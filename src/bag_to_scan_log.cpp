@@ -0,0 +1,211 @@
+// Converts sensor_msgs/LaserScan recordings in a bag to a binary scan log
+// for offline_slam. The laser's mounting and the odometry at every scan
+// are looked up in the bag's tf, or taken from a nav_msgs/Odometry topic,
+// the same way the node does it live; upside-down lasers are stored
+// counterclockwise like any other.
+//
+// Usage: bag_to_scan_log [-s scan_topic] [-d odom_topic] [-b base_frame] [-f odom_frame] <bag> <log>
+
+#include <relative_slam/binary_scan_log.h>
+#include <relative_slam/odometry_buffer.h>
+#include <nav_msgs/Odometry.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/LaserScan.h>
+#include <tf/transform_datatypes.h>
+#include <tf2/buffer_core.h>
+#include <tf2/exceptions.h>
+#include <tf2_msgs/TFMessage.h>
+#include <boost/foreach.hpp>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+static bool LookupTransform(const tf2::BufferCore& rBuffer, const std::string& target, const std::string& source,
+                            const ros::Time& stamp, tf::Transform& rTransform)
+{
+  try
+  {
+    tf::transformMsgToTF(rBuffer.lookupTransform(target, source, stamp).transform, rTransform);
+    return true;
+  }
+  catch(tf2::TransformException&)
+  {
+    return false;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  std::string scan_topic = "scan";
+  std::string odom_topic;
+  std::string base_frame = "base_link";
+  std::string odom_frame = "odom";
+  std::vector<std::string> files;
+  for(int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if(arg.size() == 2 && arg[0] == '-' && i + 1 < argc)
+    {
+      std::string value = argv[++i];
+      switch(arg[1])
+      {
+        case 's': scan_topic = value; continue;
+        case 'd': odom_topic = value; continue;
+        case 'b': base_frame = value; continue;
+        case 'f': odom_frame = value; continue;
+      }
+    }
+    if(arg[0] == '-')
+    {
+      files.clear();
+      break;
+    }
+    files.push_back(arg);
+  }
+  if(files.size() != 2)
+  {
+    fprintf(stderr, "usage: %s [-s scan_topic] [-d odom_topic] [-b base_frame] [-f odom_frame] <bag> <log>\n", argv[0]);
+    return 1;
+  }
+
+  ros::Time::init();
+  rosbag::Bag bag;
+  try
+  {
+    bag.open(files[0], rosbag::bagmode::Read);
+  }
+  catch(rosbag::BagException& e)
+  {
+    fprintf(stderr, "Could not open %s: %s\n", files[0].c_str(), e.what());
+    return 1;
+  }
+
+  // First pass: all of the bag's tf, and the odometry if it has its own
+  // topic, so every scan can be looked up at its stamp
+  std::vector<std::string> topics;
+  topics.push_back("/tf");
+  topics.push_back("/tf_static");
+  if(!odom_topic.empty())
+    topics.push_back(odom_topic);
+  rosbag::View tf_view(bag, rosbag::TopicQuery(topics));
+  tf2::BufferCore tf_buffer(tf_view.getEndTime() - tf_view.getBeginTime() + ros::Duration(1.0));
+  OdometryBuffer odometry(odom_topic.empty() ? 1 : tf_view.size() + 2);
+  BOOST_FOREACH(const rosbag::MessageInstance& m, tf_view)
+  {
+    tf2_msgs::TFMessage::ConstPtr transforms = m.instantiate<tf2_msgs::TFMessage>();
+    if(transforms)
+    {
+      bool is_static = m.getTopic() == "/tf_static";
+      for(size_t i = 0; i < transforms->transforms.size(); i++)
+        tf_buffer.setTransform(transforms->transforms[i], "bag", is_static);
+      continue;
+    }
+    nav_msgs::Odometry::ConstPtr odom = m.instantiate<nav_msgs::Odometry>();
+    if(odom)
+      odometry.Add(OdometrySample(odom->header.stamp.toSec(), odom->pose.pose.position.x,
+                                  odom->pose.pose.position.y, tf::getYaw(odom->pose.pose.orientation)));
+  }
+
+  BinaryScanLogWriter writer;
+  if(!writer.Open(files[1]))
+  {
+    fprintf(stderr, "Could not create %s\n", files[1].c_str());
+    return 1;
+  }
+
+  // Second pass: the scans, in the order they were recorded
+  std::map<std::string, int> lasers;
+  std::map<std::string, bool> inverted;
+  std::vector<float> ranges;
+  int skipped = 0;
+  rosbag::View scan_view(bag, rosbag::TopicQuery(scan_topic));
+  BOOST_FOREACH(const rosbag::MessageInstance& m, scan_view)
+  {
+    sensor_msgs::LaserScan::ConstPtr scan = m.instantiate<sensor_msgs::LaserScan>();
+    if(!scan)
+      continue;
+    const std::string& frame = scan->header.frame_id;
+
+    if(lasers.find(frame) == lasers.end())
+    {
+      tf::Transform laser_pose;
+      if(!LookupTransform(tf_buffer, base_frame, frame, scan->header.stamp, laser_pose))
+      {
+        skipped++;
+        continue;
+      }
+
+      // A point above the laser that ends up below it means it is mounted upside-down
+      tf::Vector3 up = laser_pose.inverse() * tf::Vector3(0, 0, 1 + laser_pose.getOrigin().z());
+      inverted[frame] = up.z() <= 0;
+
+      LogLaser laser;
+      laser.name = frame;
+      laser.x = laser_pose.getOrigin().x();
+      laser.y = laser_pose.getOrigin().y();
+      laser.yaw = tf::getYaw(laser_pose.getRotation());
+      laser.min_range = scan->range_min;
+      laser.max_range = scan->range_max;
+      laser.min_angle = scan->angle_min;
+      laser.max_angle = scan->angle_max;
+      laser.angle_increment = scan->angle_increment;
+      lasers[frame] = writer.AddLaser(laser);
+      printf("laser %s at %.3f %.3f %.3f%s\n", frame.c_str(), laser.x, laser.y, laser.yaw,
+             inverted[frame] ? ", upside-down" : "");
+    }
+
+    BinaryScanHeader header;
+    header.stamp = scan->header.stamp.toSec();
+    if(odom_topic.empty())
+    {
+      tf::Transform odom_pose;
+      if(!LookupTransform(tf_buffer, odom_frame, base_frame, scan->header.stamp, odom_pose))
+      {
+        skipped++;
+        continue;
+      }
+      header.odom_x = odom_pose.getOrigin().x();
+      header.odom_y = odom_pose.getOrigin().y();
+      header.odom_yaw = tf::getYaw(odom_pose.getRotation());
+    }
+    else
+    {
+      OdometrySample sample;
+      if(odometry.Lookup(header.stamp, sample) != OdometryBuffer::Found)
+      {
+        skipped++;
+        continue;
+      }
+      header.odom_x = sample.x;
+      header.odom_y = sample.y;
+      header.odom_yaw = sample.yaw;
+    }
+    header.min_angle = scan->angle_min;
+    header.angle_increment = scan->angle_increment;
+    header.min_range = scan->range_min;
+    header.max_range = scan->range_max;
+    header.laser = lasers[frame];
+    header.count = scan->ranges.size();
+
+    if(inverted[frame])
+      ranges.assign(scan->ranges.rbegin(), scan->ranges.rend());
+    else
+      ranges.assign(scan->ranges.begin(), scan->ranges.end());
+    if(!writer.AddScan(header, ranges.empty() ? NULL : &ranges[0]))
+    {
+      fprintf(stderr, "Failed to write %s\n", files[1].c_str());
+      return 1;
+    }
+  }
+
+  size_t scans = writer.Scans();
+  if(!writer.Close())
+  {
+    fprintf(stderr, "Failed to write %s\n", files[1].c_str());
+    return 1;
+  }
+  printf("%d scans written, %d skipped without a transform or odometry\n", (int)scans, skipped);
+  return 0;
+}
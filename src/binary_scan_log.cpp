@@ -0,0 +1,248 @@
+#include <relative_slam/binary_scan_log.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <sstream>
+
+const char BinaryScanLog::Magic[8] = { 'R', 'S', 'S', 'C', 'A', 'N', 'S', '\0' };
+const uint32_t BinaryScanLog::Version;
+
+static const uint32_t ByteOrder = 0x01020304;
+
+static size_t Padded(size_t size)
+{
+  return (size + 7) & ~(size_t)7;
+}
+
+BinaryScanLogWriter::BinaryScanLogWriter() : file_(NULL), lasers_(0), scans_(0)
+{
+}
+
+BinaryScanLogWriter::~BinaryScanLogWriter()
+{
+  Close();
+}
+
+bool BinaryScanLogWriter::Open(const std::string& path)
+{
+  Close();
+  file_ = fopen(path.c_str(), "wb");
+  if(!file_)
+    return false;
+
+  BinaryLogHeader header;
+  memcpy(header.magic, BinaryScanLog::Magic, sizeof(header.magic));
+  header.version = BinaryScanLog::Version;
+  header.byte_order = ByteOrder;
+  return fwrite(&header, sizeof(header), 1, file_) == 1;
+}
+
+bool BinaryScanLogWriter::Close()
+{
+  if(!file_)
+    return true;
+  bool ok = !ferror(file_);
+  ok = fclose(file_) == 0 && ok;
+  file_ = NULL;
+  lasers_ = 0;
+  scans_ = 0;
+  return ok;
+}
+
+bool BinaryScanLogWriter::write(uint32_t type, const void* pFirst, size_t firstSize, const void* pSecond, size_t secondSize)
+{
+  static const char zeros[8] = { 0 };
+  BinaryRecordHeader header;
+  header.type = type;
+  header.size = Padded(firstSize + secondSize);
+  size_t padding = header.size - firstSize - secondSize;
+  return file_ &&
+         fwrite(&header, sizeof(header), 1, file_) == 1 &&
+         fwrite(pFirst, 1, firstSize, file_) == firstSize &&
+         fwrite(pSecond, 1, secondSize, file_) == secondSize &&
+         fwrite(zeros, 1, padding, file_) == padding;
+}
+
+int BinaryScanLogWriter::AddLaser(const LogLaser& rLaser)
+{
+  BinaryLaserRecord record;
+  memset(&record, 0, sizeof(record));
+  record.x = rLaser.x;
+  record.y = rLaser.y;
+  record.yaw = rLaser.yaw;
+  record.min_range = rLaser.min_range;
+  record.max_range = rLaser.max_range;
+  record.min_angle = rLaser.min_angle;
+  record.max_angle = rLaser.max_angle;
+  record.angle_increment = rLaser.angle_increment;
+  record.laser = lasers_;
+  record.name_length = rLaser.name.size();
+  if(!write(BinaryRecordHeader::Laser, &record, sizeof(record), rLaser.name.data(), rLaser.name.size()))
+    return -1;
+  return lasers_++;
+}
+
+bool BinaryScanLogWriter::AddScan(const BinaryScanHeader& rHeader, const float* pRanges)
+{
+  if(rHeader.laser >= lasers_)
+    return false;
+  if(!write(BinaryRecordHeader::Scan, &rHeader, sizeof(rHeader), pRanges, rHeader.count * sizeof(float)))
+    return false;
+  scans_++;
+  return true;
+}
+
+BinaryScanLog::BinaryScanLog() : data_(NULL), size_(0), offset_(0), truncated_(false), scan_(NULL), ranges_(NULL)
+{
+}
+
+BinaryScanLog::~BinaryScanLog()
+{
+  Close();
+}
+
+bool BinaryScanLog::IsBinaryLog(const std::string& path)
+{
+  char magic[sizeof(Magic)];
+  FILE* file = fopen(path.c_str(), "rb");
+  if(!file)
+    return false;
+  bool binary = fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, Magic, sizeof(magic)) == 0;
+  fclose(file);
+  return binary;
+}
+
+bool BinaryScanLog::Open(const std::string& path)
+{
+  Close();
+  int fd = open(path.c_str(), O_RDONLY);
+  if(fd < 0)
+  {
+    fail("could not open " + path);
+    return false;
+  }
+  struct stat info;
+  if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(BinaryLogHeader))
+  {
+    close(fd);
+    fail("too short for a binary scan log");
+    return false;
+  }
+  void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps the file open
+  close(fd);
+  if(data == MAP_FAILED)
+  {
+    fail("could not map " + path);
+    return false;
+  }
+  // Read ahead aggressively; each page is looked at once
+  madvise(data, info.st_size, MADV_SEQUENTIAL);
+  data_ = static_cast<const char*>(data);
+  size_ = info.st_size;
+
+  const BinaryLogHeader* header = reinterpret_cast<const BinaryLogHeader*>(data_);
+  if(memcmp(header->magic, Magic, sizeof(Magic)) != 0)
+    fail("not a binary scan log");
+  else if(header->byte_order != ByteOrder)
+    fail("written with a different byte order");
+  else if(header->version != Version)
+    fail("unsupported version");
+  else
+  {
+    offset_ = sizeof(BinaryLogHeader);
+    return true;
+  }
+  Close();
+  return false;
+}
+
+void BinaryScanLog::Close()
+{
+  if(data_)
+    munmap(const_cast<char*>(data_), size_);
+  data_ = NULL;
+  size_ = 0;
+  offset_ = 0;
+  truncated_ = false;
+  laser_names_.clear();
+  scan_ = NULL;
+  ranges_ = NULL;
+}
+
+BinaryScanLog::Record BinaryScanLog::fail(const std::string& rMessage)
+{
+  std::ostringstream error;
+  if(data_)
+    error << "offset " << offset_ << ": ";
+  error << rMessage;
+  error_ = error.str();
+  return Error;
+}
+
+const std::string* BinaryScanLog::GetLaserName(uint32_t laser) const
+{
+  return laser < laser_names_.size() ? &laser_names_[laser] : NULL;
+}
+
+BinaryScanLog::Record BinaryScanLog::Next()
+{
+  if(!data_)
+    return fail("not open");
+
+  while(true)
+  {
+    if(size_ - offset_ < sizeof(BinaryRecordHeader))
+    {
+      truncated_ = offset_ != size_;
+      return End;
+    }
+    const BinaryRecordHeader* header = reinterpret_cast<const BinaryRecordHeader*>(data_ + offset_);
+    if(header->size % 8 != 0)
+      return fail("misaligned record");
+    if(size_ - offset_ - sizeof(BinaryRecordHeader) < header->size)
+    {
+      truncated_ = true;
+      return End;
+    }
+    const char* payload = data_ + offset_ + sizeof(BinaryRecordHeader);
+
+    if(header->type == BinaryRecordHeader::Laser)
+    {
+      const BinaryLaserRecord* record = reinterpret_cast<const BinaryLaserRecord*>(payload);
+      if(header->size < sizeof(BinaryLaserRecord) || header->size - sizeof(BinaryLaserRecord) < record->name_length)
+        return fail("laser record too short");
+      if(record->laser != laser_names_.size())
+        return fail("lasers out of order");
+      laser_.name.assign(payload + sizeof(BinaryLaserRecord), record->name_length);
+      laser_.x = record->x;
+      laser_.y = record->y;
+      laser_.yaw = record->yaw;
+      laser_.min_range = record->min_range;
+      laser_.max_range = record->max_range;
+      laser_.min_angle = record->min_angle;
+      laser_.max_angle = record->max_angle;
+      laser_.angle_increment = record->angle_increment;
+      laser_names_.push_back(laser_.name);
+      offset_ += sizeof(BinaryRecordHeader) + header->size;
+      return Laser;
+    }
+    if(header->type == BinaryRecordHeader::Scan)
+    {
+      const BinaryScanHeader* scan = reinterpret_cast<const BinaryScanHeader*>(payload);
+      if(header->size < sizeof(BinaryScanHeader) || (header->size - sizeof(BinaryScanHeader)) / sizeof(float) < scan->count)
+        return fail("scan record too short");
+      if(scan->laser >= laser_names_.size())
+        return fail("scan of an undeclared laser");
+      scan_ = scan;
+      ranges_ = reinterpret_cast<const float*>(payload + sizeof(BinaryScanHeader));
+      offset_ += sizeof(BinaryRecordHeader) + header->size;
+      return Scan;
+    }
+
+    // Left for newer readers
+    offset_ += sizeof(BinaryRecordHeader) + header->size;
+  }
+}
@@ -0,0 +1,39 @@
+#include <relative_slam/graph_snapshot.h>
+#include <deque>
+
+const KeyframeRecord* GraphSnapshot::Find(int id) const
+{
+  if(id < 0 || (size_t)id >= keyframes.size() || keyframes[id].id != id)
+    return NULL;
+  return &keyframes[id];
+}
+
+void GraphSnapshot::FindLinked(int id, int max_hops, std::vector<std::pair<int, int> >& rLinked) const
+{
+  rLinked.clear();
+  if(Find(id) == NULL)
+    return;
+
+  std::vector<bool> visited(keyframes.size(), false);
+  std::deque<std::pair<int, int> > open;
+  open.push_back(std::make_pair(id, 0));
+  visited[id] = true;
+  while(!open.empty())
+  {
+    std::pair<int, int> current = open.front();
+    open.pop_front();
+    rLinked.push_back(current);
+    if(current.second >= max_hops || (size_t)current.first >= adjacency.size())
+      continue;
+
+    const std::vector<int>& neighbours = adjacency[current.first];
+    for(size_t i = 0; i < neighbours.size(); i++)
+    {
+      int next = neighbours[i];
+      if(next < 0 || (size_t)next >= visited.size() || visited[next])
+        continue;
+      visited[next] = true;
+      open.push_back(std::make_pair(next, current.second + 1));
+    }
+  }
+}
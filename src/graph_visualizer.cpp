@@ -0,0 +1,201 @@
+#include <relative_slam/graph_visualizer.h>
+#include <ros/console.h>
+#include <tf/transform_datatypes.h>
+#include <boost/functional/hash.hpp>
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <cmath>
+
+GraphVisualizer::GraphVisualizer(const std::string& frame_id) : frame_id_(frame_id),
+  vis_detail_distance_(20.0), vis_update_distance_(0.05), vis_update_angle_(0.02)
+{
+}
+
+void GraphVisualizer::Reset()
+{
+  vis_nodes_.clear();
+  vis_loop_batches_.clear();
+  vis_constraint_batches_.clear();
+}
+
+void GraphVisualizer::SetParams(double detail_distance, double update_distance, double update_angle)
+{
+  vis_detail_distance_ = detail_distance;
+  vis_update_distance_ = update_distance;
+  vis_update_angle_ = update_angle;
+}
+
+void GraphVisualizer::Update(const GraphSnapshot &graph, visualization_msgs::MarkerArray &marray)
+{
+  if(graph.keyframes.empty())
+  {
+    ROS_INFO("Graph is empty");
+    return;
+  }
+
+  ros::Time now = ros::Time::now();
+
+  // Vertices are red arrows
+  visualization_msgs::Marker m;
+  m.header.frame_id = frame_id_;
+  m.header.stamp = now;
+  m.ns = "keyframes";
+  m.type = visualization_msgs::Marker::ARROW;
+  m.scale.x = 0.15;
+  m.scale.y = 0.15;
+  m.scale.z = 0.15;
+  m.color.r = 1.0;
+  m.color.g = 0;
+  m.color.b = 0.0;
+  m.color.a = 1.0;
+  m.lifetime = ros::Duration(0);
+
+  visualization_msgs::Marker node_text;
+  node_text.header.frame_id = frame_id_;
+  node_text.header.stamp = now;
+  node_text.ns = "keyframe_labels";
+  node_text.type = visualization_msgs::Marker::TEXT_VIEW_FACING;
+  node_text.scale.z = 0.3;
+  node_text.color.a = 1.0;
+  node_text.color.r = 1.0;
+  node_text.color.g = 1.0;
+  node_text.color.b = 1.0;
+
+  // Loop closure constraints are purple line lists
+  visualization_msgs::Marker loop_edge;
+  loop_edge.header.frame_id = frame_id_;
+  loop_edge.header.stamp = now;
+  loop_edge.ns = "loop_closures";
+  loop_edge.type = visualization_msgs::Marker::LINE_LIST;
+  loop_edge.scale.x = 0.1;
+  loop_edge.color.a = 1.0;
+  loop_edge.color.r = 1.0;
+  loop_edge.color.g = 0.0;
+  loop_edge.color.b = 1.0;
+
+  // Other pose constraints are opaque blue line lists
+  visualization_msgs::Marker edge;
+  edge.header.frame_id = frame_id_;
+  edge.header.stamp = now;
+  edge.ns = "karto";
+  edge.type = visualization_msgs::Marker::LINE_LIST;
+  edge.scale.x = 0.1;
+  edge.color.a = 1.0;
+  edge.color.r = 0.0;
+  edge.color.g = 0.0;
+  edge.color.b = 1.0;
+
+  const karto::Pose2& newest = graph.keyframes.back().sensor_pose;
+
+  // Only send nodes that are new, moved or crossed the detail distance
+  std::set<int> moved;
+  for (size_t i = 0; i < graph.keyframes.size(); i++)
+  {
+    const KeyframeRecord& keyframe = graph.keyframes[i];
+    if (keyframe.id < 0)
+      continue;
+    const karto::Pose2& pose = keyframe.sensor_pose;
+    bool detailed = pose.GetPosition().SquaredDistance(newest.GetPosition()) <= vis_detail_distance_ * vis_detail_distance_;
+
+    std::map<int, VisNode>::iterator itN = vis_nodes_.find(keyframe.id);
+    bool hasMoved = itN == vis_nodes_.end() ||
+      itN->second.pose.GetPosition().SquaredDistance(pose.GetPosition()) > vis_update_distance_ * vis_update_distance_ ||
+      fabs(karto::math::NormalizeAngle(itN->second.pose.GetHeading() - pose.GetHeading())) > vis_update_angle_;
+    bool wasDetailed = itN != vis_nodes_.end() && itN->second.detailed;
+
+    m.id = keyframe.id;
+    node_text.id = keyframe.id;
+    if (detailed && (hasMoved || !wasDetailed))
+    {
+      m.action = visualization_msgs::Marker::ADD;
+      m.pose.position.x = pose.GetX();
+      m.pose.position.y = pose.GetY();
+      m.pose.orientation = tf::createQuaternionMsgFromYaw(pose.GetHeading());
+      marray.markers.push_back(m);
+
+      node_text.action = visualization_msgs::Marker::ADD;
+      node_text.text = boost::lexical_cast<std::string>(keyframe.id);
+      node_text.pose.position.x = pose.GetX()+0.15; 
+      node_text.pose.position.y = pose.GetY()+0.15; 
+      marray.markers.push_back(node_text);
+    }
+    else if (!detailed && wasDetailed)
+    {
+      m.action = visualization_msgs::Marker::DELETE;
+      marray.markers.push_back(m);
+      node_text.action = visualization_msgs::Marker::DELETE;
+      marray.markers.push_back(node_text);
+    }
+
+    VisNode& node = vis_nodes_[keyframe.id];
+    if (hasMoved)
+    {
+      moved.insert(keyframe.id);
+      node.pose = pose;
+    }
+    node.detailed = detailed;
+  }
+
+  // Group the edges into batches by their lower keyframe id
+  VisEdgeBatches loopBatches;
+  VisEdgeBatches constraintBatches;
+  for (size_t i = 0; i < graph.edges.size(); i++)
+  {
+    const GraphEdge& e = graph.edges[i];
+    if (graph.Find(e.from) == NULL || graph.Find(e.to) == NULL)
+      continue;
+    VisEdgeBatches& batches = e.loop_closure ? loopBatches : constraintBatches;
+    batches[std::min(e.from, e.to) / VisEdgeBatch].push_back(std::make_pair(e.from, e.to));
+  }
+
+  addEdgeBatches(loopBatches, graph, moved, vis_loop_batches_, loop_edge, marray);
+  addEdgeBatches(constraintBatches, graph, moved, vis_constraint_batches_, edge, marray);
+}
+
+void GraphVisualizer::addEdgeBatches(const VisEdgeBatches& rBatches, const GraphSnapshot& rGraph, const std::set<int>& rMoved,
+                                std::map<int, size_t>& rSent, visualization_msgs::Marker& rMarker, visualization_msgs::MarkerArray& rArray)
+{
+  // A batch is sent again when its edges changed or one of their ends moved
+  for (VisEdgeBatches::const_iterator itB = rBatches.begin(); itB != rBatches.end(); ++itB)
+  {
+    const std::vector<std::pair<int, int> >& edges = itB->second;
+    // Covers edges replaced by others as well as added or removed ones
+    size_t hash = boost::hash_range(edges.begin(), edges.end());
+    std::map<int, size_t>::iterator itS = rSent.find(itB->first);
+    bool dirty = itS == rSent.end() || itS->second != hash;
+    for (size_t i = 0; !dirty && i < edges.size(); i++)
+      dirty = rMoved.count(edges[i].first) || rMoved.count(edges[i].second);
+    if (!dirty)
+      continue;
+
+    rMarker.id = itB->first;
+    rMarker.action = visualization_msgs::Marker::ADD;
+    rMarker.points.resize(2 * edges.size());
+    for (size_t i = 0; i < edges.size(); i++)
+    {
+      const karto::Pose2& p1 = rGraph.Find(edges[i].first)->sensor_pose;
+      const karto::Pose2& p2 = rGraph.Find(edges[i].second)->sensor_pose;
+      rMarker.points[2 * i].x = p1.GetX();
+      rMarker.points[2 * i].y = p1.GetY();
+      rMarker.points[2 * i + 1].x = p2.GetX();
+      rMarker.points[2 * i + 1].y = p2.GetY();
+    }
+    rArray.markers.push_back(rMarker);
+    rSent[itB->first] = hash;
+  }
+
+  // Batches whose edges all disappeared
+  for (std::map<int, size_t>::iterator itS = rSent.begin(); itS != rSent.end(); )
+  {
+    if (rBatches.count(itS->first))
+    {
+      ++itS;
+      continue;
+    }
+    rMarker.id = itS->first;
+    rMarker.action = visualization_msgs::Marker::DELETE;
+    rMarker.points.clear();
+    rArray.markers.push_back(rMarker);
+    rSent.erase(itS++);
+  }
+}
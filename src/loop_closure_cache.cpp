@@ -0,0 +1,121 @@
+#include <relative_slam/loop_closure_cache.h>
+#include <boost/functional/hash.hpp>
+#include <cmath>
+
+LoopClosureCache::LoopClosureCache(size_t max_entries) : max_entries_(max_entries), hits_(0), misses_(0)
+{
+}
+
+size_t LoopClosureCache::HashChain(const std::vector<int>& rChainIds)
+{
+  return boost::hash_range(rChainIds.begin(), rChainIds.end());
+}
+
+LoopClosureCache::Place LoopClosureCache::QuantizePlace(double x, double y, double heading, double cell_size, double angle_size)
+{
+  // 24 bits per coordinate and 16 for the heading; far enough for any map
+  Place cellX = (Place)floor(x / cell_size) & 0xffffff;
+  Place cellY = (Place)floor(y / cell_size) & 0xffffff;
+  Place cellHeading = (Place)floor(atan2(sin(heading), cos(heading)) / angle_size) & 0xffff;
+  return (cellX << 40) | (cellY << 16) | cellHeading;
+}
+
+bool LoopClosureCache::Find(Place place, size_t chain_hash, Result& rResult)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  std::map<Key, EntryList::iterator>::iterator it = lookup_.find(Key(place, chain_hash));
+  if(it == lookup_.end())
+  {
+    misses_++;
+    return false;
+  }
+
+  // Move to the front of the LRU list; list iterators stay valid
+  entries_.splice(entries_.begin(), entries_, it->second);
+  rResult = it->second->result;
+  hits_++;
+  return true;
+}
+
+void LoopClosureCache::Insert(Place place, size_t chain_hash, int query_id, const std::vector<int>& rChainIds, const Result& rResult)
+{
+  if(max_entries_ == 0)
+    return;
+
+  boost::mutex::scoped_lock lock(mutex_);
+  Key key(place, chain_hash);
+  std::map<Key, EntryList::iterator>::iterator it = lookup_.find(key);
+  if(it != lookup_.end())
+  {
+    it->second->query_id = query_id;
+    it->second->result = rResult;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return;
+  }
+
+  Entry entry;
+  entry.key = key;
+  entry.query_id = query_id;
+  entry.chain_ids = rChainIds;
+  entry.result = rResult;
+  entries_.push_front(entry);
+  lookup_[key] = entries_.begin();
+
+  while(entries_.size() > max_entries_)
+  {
+    lookup_.erase(entries_.back().key);
+    entries_.pop_back();
+  }
+}
+
+void LoopClosureCache::Invalidate(const std::set<int>& rMovedIds)
+{
+  if(rMovedIds.empty())
+    return;
+
+  boost::mutex::scoped_lock lock(mutex_);
+  EntryList::iterator it = entries_.begin();
+  while(it != entries_.end())
+  {
+    bool moved = rMovedIds.count(it->query_id) > 0;
+    for(size_t i = 0; !moved && i < it->chain_ids.size(); i++)
+      moved = rMovedIds.count(it->chain_ids[i]) > 0;
+
+    if(moved)
+    {
+      lookup_.erase(it->key);
+      it = entries_.erase(it);
+    }
+    else
+      ++it;
+  }
+}
+
+void LoopClosureCache::SetMaxEntries(size_t max_entries)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  max_entries_ = max_entries;
+  while(entries_.size() > max_entries_)
+  {
+    lookup_.erase(entries_.back().key);
+    entries_.pop_back();
+  }
+}
+
+size_t LoopClosureCache::Size() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return entries_.size();
+}
+
+size_t LoopClosureCache::Hits() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return hits_;
+}
+
+size_t LoopClosureCache::Misses() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return misses_;
+}
@@ -0,0 +1,196 @@
+#include <relative_slam/map_codec.h>
+#include <algorithm>
+#include <cstring>
+
+void EncodeRunLength(const int8_t* pData, size_t count, std::vector<uint8_t>& rOut)
+{
+  size_t i = 0;
+  while(i < count)
+  {
+    size_t run = 1;
+    while(i + run < count && run < 255 && pData[i + run] == pData[i])
+      run++;
+    rOut.push_back((uint8_t)run);
+    rOut.push_back((uint8_t)pData[i]);
+    i += run;
+  }
+}
+
+bool DecodeRunLength(const std::vector<uint8_t>& rIn, int8_t* pData, size_t count)
+{
+  if(rIn.size() % 2 != 0)
+    return false;
+
+  size_t n = 0;
+  for(size_t i = 0; i < rIn.size(); i += 2)
+  {
+    size_t run = rIn[i];
+    if(run == 0 || n + run > count)
+      return false;
+    memset(pData + n, (int8_t)rIn[i + 1], run);
+    n += run;
+  }
+  return n == count;
+}
+
+static bool sameGeometry(const nav_msgs::MapMetaData& rA, const nav_msgs::MapMetaData& rB)
+{
+  return rA.width == rB.width && rA.height == rB.height && rA.resolution == rB.resolution &&
+         rA.origin.position.x == rB.origin.position.x && rA.origin.position.y == rB.origin.position.y &&
+         rA.origin.orientation.z == rB.origin.orientation.z && rA.origin.orientation.w == rB.origin.orientation.w;
+}
+
+MapEncoder::MapEncoder(unsigned int tile_size, unsigned int keyframe_interval) :
+  tile_size_(std::max(1u, tile_size)),
+  keyframe_interval_(keyframe_interval),
+  since_keyframe_(0),
+  seq_(0),
+  has_sent_(false)
+{
+}
+
+void MapEncoder::Encode(const nav_msgs::OccupancyGrid& rMap, relative_slam::CompressedMap& rMsg)
+{
+  begin(rMap, rMsg);
+  encodeAll(rMap, rMsg);
+}
+
+void MapEncoder::Encode(const nav_msgs::OccupancyGrid& rMap, const std::vector<TileIndex>& rTiles, relative_slam::CompressedMap& rMsg)
+{
+  // A keyframe has to send the tiles that did not change as well
+  if(begin(rMap, rMsg))
+  {
+    encodeAll(rMap, rMsg);
+    return;
+  }
+
+  // Sent in the same order as a full scan would
+  std::vector<TileIndex> tiles(rTiles);
+  for(size_t i = 0; i < tiles.size(); i++)
+    std::swap(tiles[i].first, tiles[i].second);
+  std::sort(tiles.begin(), tiles.end());
+  tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+  for(size_t i = 0; i < tiles.size(); i++)
+  {
+    unsigned int x0 = tiles[i].second * tile_size_;
+    unsigned int y0 = tiles[i].first * tile_size_;
+    if(x0 < rMap.info.width && y0 < rMap.info.height)
+      encodeTile(rMap, x0, y0, rMsg);
+  }
+}
+
+bool MapEncoder::begin(const nav_msgs::OccupancyGrid& rMap, relative_slam::CompressedMap& rMsg)
+{
+  bool keyframe = !has_sent_ || !sameGeometry(info_, rMap.info) ||
+                  (keyframe_interval_ > 0 && since_keyframe_ + 1 >= keyframe_interval_);
+
+  rMsg.header = rMap.header;
+  rMsg.base_seq = seq_;
+  rMsg.seq = ++seq_;
+  rMsg.keyframe = keyframe;
+  rMsg.info = rMap.info;
+  rMsg.tiles.clear();
+
+  if(keyframe)
+  {
+    rMsg.base_seq = rMsg.seq;
+    sent_.assign(rMap.info.width * rMap.info.height, -1);
+    info_ = rMap.info;
+    since_keyframe_ = 0;
+    has_sent_ = true;
+  }
+  else
+    since_keyframe_++;
+  return keyframe;
+}
+
+void MapEncoder::encodeAll(const nav_msgs::OccupancyGrid& rMap, relative_slam::CompressedMap& rMsg)
+{
+  for(unsigned int y0 = 0; y0 < rMap.info.height; y0 += tile_size_)
+  {
+    for(unsigned int x0 = 0; x0 < rMap.info.width; x0 += tile_size_)
+      encodeTile(rMap, x0, y0, rMsg);
+  }
+}
+
+void MapEncoder::encodeTile(const nav_msgs::OccupancyGrid& rMap, unsigned int x0, unsigned int y0, relative_slam::CompressedMap& rMsg)
+{
+  unsigned int width = rMap.info.width;
+  unsigned int w = std::min(tile_size_, width - x0);
+  unsigned int h = std::min(tile_size_, rMap.info.height - y0);
+
+  bool changed = rMsg.keyframe;
+  for(unsigned int y = 0; !changed && y < h; y++)
+    changed = memcmp(&rMap.data[(y0 + y) * width + x0], &sent_[(y0 + y) * width + x0], w) != 0;
+  if(!changed)
+    return;
+
+  // Keyframe tiles hold plain values, delta tiles the XOR with what was sent
+  tile_.resize(w * h);
+  for(unsigned int y = 0; y < h; y++)
+  {
+    const int8_t* src = &rMap.data[(y0 + y) * width + x0];
+    int8_t* sent = &sent_[(y0 + y) * width + x0];
+    for(unsigned int x = 0; x < w; x++)
+      tile_[y * w + x] = rMsg.keyframe ? src[x] : (int8_t)(src[x] ^ sent[x]);
+    memcpy(sent, src, w);
+  }
+
+  relative_slam::CompressedMapTile msgTile;
+  msgTile.x = x0;
+  msgTile.y = y0;
+  msgTile.width = w;
+  msgTile.height = h;
+  EncodeRunLength(&tile_[0], tile_.size(), msgTile.data);
+  rMsg.tiles.push_back(msgTile);
+}
+
+MapDecoder::MapDecoder() : has_map_(false), seq_(0)
+{
+}
+
+bool MapDecoder::Apply(const relative_slam::CompressedMap& rMsg)
+{
+  if(!rMsg.keyframe && (!has_map_ || rMsg.base_seq != seq_ || !sameGeometry(map_.info, rMsg.info)))
+  {
+    has_map_ = false;
+    return false;
+  }
+
+  if(rMsg.keyframe)
+  {
+    map_.info = rMsg.info;
+    map_.data.assign(rMsg.info.width * rMsg.info.height, -1);
+  }
+
+  unsigned int width = map_.info.width;
+  for(size_t i = 0; i < rMsg.tiles.size(); i++)
+  {
+    const relative_slam::CompressedMapTile& rTile = rMsg.tiles[i];
+    if(rTile.x + rTile.width > width || rTile.y + rTile.height > map_.info.height)
+    {
+      has_map_ = false;
+      return false;
+    }
+
+    tile_.resize(rTile.width * rTile.height);
+    if(!tile_.empty() && !DecodeRunLength(rTile.data, &tile_[0], tile_.size()))
+    {
+      has_map_ = false;
+      return false;
+    }
+
+    for(unsigned int y = 0; y < rTile.height; y++)
+    {
+      int8_t* dst = &map_.data[(rTile.y + y) * width + rTile.x];
+      const int8_t* src = &tile_[y * rTile.width];
+      for(unsigned int x = 0; x < rTile.width; x++)
+        dst[x] = rMsg.keyframe ? src[x] : (int8_t)(dst[x] ^ src[x]);
+    }
+  }
+
+  map_.header = rMsg.header;
+  seq_ = rMsg.seq;
+  has_map_ = true;
+  return true;
+}
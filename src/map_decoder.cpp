@@ -0,0 +1,53 @@
+// Rebuilds the full occupancy grid from the compressed map published by
+// relative_slam and republishes it for consumers that need a plain
+// nav_msgs/OccupancyGrid.
+
+#include "ros/ros.h"
+#include "nav_msgs/OccupancyGrid.h"
+#include <relative_slam/CompressedMap.h>
+#include <relative_slam/map_codec.h>
+
+class MapDecoderNode
+{
+  public:
+    MapDecoderNode();
+
+  private:
+    void compressedMapCallback(const relative_slam::CompressedMap::ConstPtr& msg);
+
+    ros::NodeHandle node_;
+    ros::Subscriber sub_;
+    ros::Publisher pub_;
+    MapDecoder decoder_;
+    int skipped_;
+};
+
+MapDecoderNode::MapDecoderNode() : skipped_(0)
+{
+  pub_ = node_.advertise<nav_msgs::OccupancyGrid>("map_decoded", 1, true);
+  sub_ = node_.subscribe("map_compressed", 10, &MapDecoderNode::compressedMapCallback, this);
+}
+
+void MapDecoderNode::compressedMapCallback(const relative_slam::CompressedMap::ConstPtr& msg)
+{
+  if(!decoder_.Apply(*msg))
+  {
+    // A message was lost or we joined mid-stream; wait for the next keyframe
+    skipped_++;
+    ROS_WARN_THROTTLE(5.0, "Skipped compressed map %u, waiting for a keyframe (%d skipped)", msg->seq, skipped_);
+    return;
+  }
+
+  pub_.publish(decoder_.Map());
+}
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "map_decoder");
+
+  MapDecoderNode decoder;
+
+  ros::spin();
+
+  return 0;
+}
@@ -0,0 +1,94 @@
+// Compares the per-cell switch that used to convert grid states for
+// nav_msgs::OccupancyGrid with the table-driven ConvertCellStates().
+//
+// Usage: map_export_benchmark [width] [height] [iterations]
+
+#include <relative_slam/occupancy_grid.h>
+#include <boost/chrono.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#define MAP_IDX(sx, i, j) ((sx) * (j) + (i))
+
+typedef boost::chrono::steady_clock benchmark_clock;
+
+static int convertSwitch(const std::vector<unsigned char>& rStates, int width, int height, std::vector<signed char>& rData)
+{
+  int unknown = 0;
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      switch (rStates[MAP_IDX(width, x, y)])
+      {
+        case CellState_Unknown:
+          rData[MAP_IDX(width, x, y)] = -1;
+          break;
+        case CellState_Occupied:
+          rData[MAP_IDX(width, x, y)] = 100;
+          break;
+        case CellState_Free:
+          rData[MAP_IDX(width, x, y)] = 0;
+          break;
+        default:
+          unknown++;
+          break;
+      }
+    }
+  }
+  return unknown;
+}
+
+static void convertTable(const std::vector<unsigned char>& rStates, int width, int height, std::vector<signed char>& rData)
+{
+  for (int y = 0; y < height; y++)
+    ConvertCellStates(&rStates[MAP_IDX(width, 0, y)], width, &rData[MAP_IDX(width, 0, y)]);
+}
+
+int main(int argc, char** argv)
+{
+  int width = argc > 1 ? atoi(argv[1]) : 4000;
+  int height = argc > 2 ? atoi(argv[2]) : 4000;
+  int iterations = argc > 3 ? atoi(argv[3]) : 10;
+  if (width <= 0 || height <= 0 || iterations <= 0)
+  {
+    fprintf(stderr, "usage: %s [width] [height] [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  // Mostly unknown and free space with scattered obstacles, like a real map
+  std::vector<unsigned char> states(width * height);
+  srand(42);
+  for (size_t i = 0; i < states.size(); i++)
+  {
+    int r = rand() % 100;
+    states[i] = r < 50 ? CellState_Unknown : (r < 90 ? CellState_Free : CellState_Occupied);
+  }
+
+  std::vector<signed char> expected(states.size());
+  std::vector<signed char> actual(states.size());
+  double cells = (double)width * height * iterations;
+
+  benchmark_clock::time_point start = benchmark_clock::now();
+  int unknown = 0;
+  for (int i = 0; i < iterations; i++)
+    unknown += convertSwitch(states, width, height, expected);
+  double switchSeconds = boost::chrono::duration<double>(benchmark_clock::now() - start).count();
+
+  start = benchmark_clock::now();
+  for (int i = 0; i < iterations; i++)
+    convertTable(states, width, height, actual);
+  double tableSeconds = boost::chrono::duration<double>(benchmark_clock::now() - start).count();
+
+  if (unknown != 0 || expected != actual)
+  {
+    fprintf(stderr, "Conversions disagree\n");
+    return 1;
+  }
+
+  printf("%d x %d cells, %d iterations\n", width, height, iterations);
+  printf("switch: %8.1f Mcells/s\n", cells / switchSeconds * 1e-6);
+  printf("table:  %8.1f Mcells/s (%.1fx)\n", cells / tableSeconds * 1e-6, switchSeconds / tableSeconds);
+  return 0;
+}
@@ -0,0 +1,81 @@
+#include <relative_slam/map_pyramid.h>
+#include <algorithm>
+
+MapPyramid::MapPyramid(const std::vector<int>& rFactors) : width_(0), height_(0), origin_x_(0), origin_y_(0)
+{
+  for(size_t i = 0; i < rFactors.size(); i++)
+  {
+    if(!IsValidFactor(rFactors[i]))
+      continue;
+    Level level;
+    level.factor = rFactors[i];
+    levels_.push_back(level);
+  }
+}
+
+bool MapPyramid::IsValidFactor(int factor)
+{
+  return factor > 1 && IncrementalOccupancyGrid::TileSize % factor == 0;
+}
+
+bool MapPyramid::Update(const IncrementalOccupancyGrid& rGrid, const std::vector<IncrementalOccupancyGrid::TileIndex>& rTiles)
+{
+  if(levels_.empty())
+    return false;
+
+  if(rGrid.Width() != width_ || rGrid.Height() != height_ ||
+     rGrid.OriginCellX() != origin_x_ || rGrid.OriginCellY() != origin_y_)
+  {
+    width_ = rGrid.Width();
+    height_ = rGrid.Height();
+    origin_x_ = rGrid.OriginCellX();
+    origin_y_ = rGrid.OriginCellY();
+    for(size_t i = 0; i < levels_.size(); i++)
+      levels_[i].data.assign((width_ / levels_[i].factor) * (height_ / levels_[i].factor), -1);
+
+    std::vector<IncrementalOccupancyGrid::TileIndex> tiles;
+    rGrid.GetTiles(tiles);
+    for(size_t i = 0; i < tiles.size(); i++)
+      poolTile(rGrid, tiles[i]);
+    return true;
+  }
+
+  for(size_t i = 0; i < rTiles.size(); i++)
+    poolTile(rGrid, rTiles[i]);
+  return !rTiles.empty();
+}
+
+void MapPyramid::poolTile(const IncrementalOccupancyGrid& rGrid, const IncrementalOccupancyGrid::TileIndex& rIndex)
+{
+  const int tileSize = IncrementalOccupancyGrid::TileSize;
+  const unsigned char* states = rGrid.TileStates(rIndex);
+  if(states == NULL)
+    return;
+
+  signed char values[tileSize * tileSize];
+  ConvertCellStates(states, tileSize * tileSize, values);
+
+  int x0 = rIndex.first * tileSize - origin_x_;
+  int y0 = rIndex.second * tileSize - origin_y_;
+  for(size_t i = 0; i < levels_.size(); i++)
+  {
+    Level& level = levels_[i];
+    int cells = tileSize / level.factor;
+    int levelWidth = width_ / level.factor;
+    for(int cy = 0; cy < cells; cy++)
+    {
+      signed char* row = &level.data[(y0 / level.factor + cy) * levelWidth + x0 / level.factor];
+      for(int cx = 0; cx < cells; cx++)
+      {
+        // -1 unknown < 0 free < 100 occupied
+        signed char value = -1;
+        for(int y = cy * level.factor; y < (cy + 1) * level.factor; y++)
+        {
+          const signed char* cell = values + y * tileSize + cx * level.factor;
+          value = std::max(value, *std::max_element(cell, cell + level.factor));
+        }
+        row[cx] = value;
+      }
+    }
+  }
+}
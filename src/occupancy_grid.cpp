@@ -0,0 +1,380 @@
+#include <relative_slam/occupancy_grid.h>
+#include <relative_slam/thread_pool.h>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+// Integer division rounding towards negative infinity
+static inline int floorDiv(int a, int b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// nav_msgs::OccupancyGrid value of every possible cell state byte
+struct CellValueTable
+{
+  CellValueTable()
+  {
+    memset(values, -1, sizeof(values));
+    values[CellState_Occupied] = 100;
+    values[CellState_Free] = 0;
+  }
+  signed char values[256];
+};
+static const CellValueTable cellValueTable;
+
+void ConvertCellStates(const unsigned char* pStates, size_t count, signed char* pValues)
+{
+  const signed char* table = cellValueTable.values;
+  for(size_t i = 0; i < count; i++)
+    pValues[i] = table[pStates[i]];
+}
+
+IncrementalOccupancyGrid::Tile::Tile() : dirty(false)
+{
+  memset(pass, 0, sizeof(pass));
+  memset(hits, 0, sizeof(hits));
+  memset(states, CellState_Unknown, sizeof(states));
+}
+
+IncrementalOccupancyGrid::TileDelta::TileDelta()
+{
+  memset(pass, 0, sizeof(pass));
+  memset(hits, 0, sizeof(hits));
+}
+
+// Applies traced cells straight to the grid
+class IncrementalOccupancyGrid::CellUpdater
+{
+public:
+  explicit CellUpdater(IncrementalOccupancyGrid& rGrid) : grid_(rGrid) { }
+  void operator()(int cx, int cy, int pass_delta, int hit_delta) { grid_.traceCell(cx, cy, pass_delta, hit_delta); }
+
+private:
+  IncrementalOccupancyGrid& grid_;
+};
+
+// Collects traced cells into a worker's own tile deltas
+class IncrementalOccupancyGrid::DeltaAccumulator
+{
+public:
+  explicit DeltaAccumulator(DeltaMap& rDeltas) : deltas_(rDeltas), last_(NULL) { }
+
+  void operator()(int cx, int cy, int pass_delta, int hit_delta)
+  {
+    int tx = floorDiv(cx, TileSize);
+    int ty = floorDiv(cy, TileSize);
+    TileIndex index(tx, ty);
+    if(last_ == NULL || last_index_ != index)
+    {
+      TileDelta*& pDelta = deltas_[index];
+      if(pDelta == NULL)
+        pDelta = new TileDelta();
+      last_ = pDelta;
+      last_index_ = index;
+    }
+    size_t cell = (cy - ty * TileSize) * TileSize + (cx - tx * TileSize);
+    last_->pass[cell] += pass_delta;
+    last_->hits[cell] += hit_delta;
+  }
+
+private:
+  DeltaMap& deltas_;
+  TileDelta* last_;
+  TileIndex last_index_;
+};
+
+IncrementalOccupancyGrid::IncrementalOccupancyGrid(double resolution, unsigned int min_pass_through, double occupancy_threshold) :
+  resolution_(resolution),
+  min_pass_through_(min_pass_through),
+  occupancy_threshold_(occupancy_threshold),
+  min_tile_x_(0),
+  min_tile_y_(0),
+  max_tile_x_(-1),
+  max_tile_y_(-1),
+  last_tile_(NULL)
+{
+}
+
+IncrementalOccupancyGrid::~IncrementalOccupancyGrid()
+{
+  Clear();
+}
+
+void IncrementalOccupancyGrid::Clear()
+{
+  for(TileMap::iterator it = tiles_.begin(); it != tiles_.end(); ++it)
+    delete it->second;
+  tiles_.clear();
+  dirty_.clear();
+  scans_.clear();
+  last_tile_ = NULL;
+  min_tile_x_ = min_tile_y_ = 0;
+  max_tile_x_ = max_tile_y_ = -1;
+}
+
+void IncrementalOccupancyGrid::Clear(double resolution)
+{
+  Clear();
+  resolution_ = resolution;
+}
+
+void IncrementalOccupancyGrid::AddScan(int id, const ScanRays& rRays)
+{
+  RemoveScan(id);
+  raycast(rRays, 1);
+  scans_[id] = rRays;
+}
+
+bool IncrementalOccupancyGrid::RemoveScan(int id)
+{
+  std::map<int, ScanRays>::iterator it = scans_.find(id);
+  if(it == scans_.end())
+    return false;
+
+  raycast(it->second, -1);
+  scans_.erase(it);
+  return true;
+}
+
+void IncrementalOccupancyGrid::AddScans(const std::vector<std::pair<int, ScanRays> >& rScans, ThreadPool* pPool)
+{
+  if(pPool == NULL)
+  {
+    for(size_t i = 0; i < rScans.size(); i++)
+      AddScan(rScans[i].first, rScans[i].second);
+    return;
+  }
+
+  // Subtract the previous rays of a scan and add the new ones
+  std::vector<RaycastJob> jobs;
+  for(size_t i = 0; i < rScans.size(); i++)
+  {
+    RaycastJob job;
+    const ScanRays* pOld = GetScan(rScans[i].first);
+    if(pOld != NULL)
+    {
+      job.rays = pOld;
+      job.delta = -1;
+      jobs.push_back(job);
+    }
+    job.rays = &rScans[i].second;
+    job.delta = 1;
+    jobs.push_back(job);
+  }
+
+  std::vector<DeltaMap> deltas(pPool->Size());
+  pPool->Run(jobs.size(), boost::bind(&IncrementalOccupancyGrid::raycastJob, this, &jobs, &deltas, _1, _2));
+
+  mergeDeltas(deltas);
+
+  for(size_t i = 0; i < rScans.size(); i++)
+    scans_[rScans[i].first] = rScans[i].second;
+}
+
+void IncrementalOccupancyGrid::raycastJob(const std::vector<RaycastJob>* pJobs, std::vector<DeltaMap>* pDeltas, size_t index, size_t worker) const
+{
+  DeltaAccumulator accumulator((*pDeltas)[worker]);
+  traceRays(*(*pJobs)[index].rays, (*pJobs)[index].delta, accumulator);
+}
+
+void IncrementalOccupancyGrid::mergeDeltas(std::vector<DeltaMap>& rDeltas)
+{
+  if(rDeltas.empty())
+    return;
+
+  // Sum the workers' deltas first, so a cell's state is only updated for its
+  // net change: a cell one worker turns occupied and another turns back does
+  // not make its tile dirty
+  DeltaMap& rSum = rDeltas[0];
+  for(size_t i = 1; i < rDeltas.size(); i++)
+  {
+    for(DeltaMap::iterator it = rDeltas[i].begin(); it != rDeltas[i].end(); ++it)
+    {
+      TileDelta*& pSum = rSum[it->first];
+      if(pSum == NULL)
+      {
+        pSum = it->second;
+        continue;
+      }
+      for(size_t cell = 0; cell < TileSize * TileSize; cell++)
+      {
+        pSum->pass[cell] += it->second->pass[cell];
+        pSum->hits[cell] += it->second->hits[cell];
+      }
+      delete it->second;
+    }
+    rDeltas[i].clear();
+  }
+
+  for(DeltaMap::iterator it = rSum.begin(); it != rSum.end(); ++it)
+  {
+    Tile* pTile = getTile(it->first.first, it->first.second);
+    const TileDelta* pDelta = it->second;
+    for(size_t cell = 0; cell < TileSize * TileSize; cell++)
+    {
+      if(pDelta->pass[cell] == 0 && pDelta->hits[cell] == 0)
+        continue;
+      pTile->pass[cell] += pDelta->pass[cell];
+      pTile->hits[cell] += pDelta->hits[cell];
+      updateState(pTile, it->first, cell);
+    }
+    delete it->second;
+  }
+  rSum.clear();
+}
+
+const ScanRays* IncrementalOccupancyGrid::GetScan(int id) const
+{
+  std::map<int, ScanRays>::const_iterator it = scans_.find(id);
+  return it == scans_.end() ? NULL : &it->second;
+}
+
+unsigned char IncrementalOccupancyGrid::State(int x, int y) const
+{
+  int cx = OriginCellX() + x;
+  int cy = OriginCellY() + y;
+  int tx = floorDiv(cx, TileSize);
+  int ty = floorDiv(cy, TileSize);
+  TileMap::const_iterator it = tiles_.find(TileIndex(tx, ty));
+  if(it == tiles_.end())
+    return CellState_Unknown;
+  return it->second->states[(cy - ty * TileSize) * TileSize + (cx - tx * TileSize)];
+}
+
+const unsigned char* IncrementalOccupancyGrid::TileStates(const TileIndex& rIndex) const
+{
+  TileMap::const_iterator it = tiles_.find(rIndex);
+  return it == tiles_.end() ? NULL : it->second->states;
+}
+
+void IncrementalOccupancyGrid::GetTiles(std::vector<TileIndex>& rTiles) const
+{
+  rTiles.reserve(rTiles.size() + tiles_.size());
+  for(TileMap::const_iterator it = tiles_.begin(); it != tiles_.end(); ++it)
+    rTiles.push_back(it->first);
+}
+
+void IncrementalOccupancyGrid::TakeDirtyTiles(std::vector<TileIndex>& rTiles)
+{
+  for(size_t i = 0; i < dirty_.size(); i++)
+  {
+    tiles_[dirty_[i]]->dirty = false;
+    rTiles.push_back(dirty_[i]);
+  }
+  dirty_.clear();
+}
+
+int IncrementalOccupancyGrid::worldToCell(double v) const
+{
+  return (int)floor(v / resolution_);
+}
+
+IncrementalOccupancyGrid::Tile* IncrementalOccupancyGrid::getTile(int tx, int ty)
+{
+  TileIndex index(tx, ty);
+  if(last_tile_ != NULL && last_index_ == index)
+    return last_tile_;
+
+  Tile*& pTile = tiles_[index];
+  if(pTile == NULL)
+  {
+    pTile = new Tile();
+    if(tiles_.size() == 1)
+    {
+      min_tile_x_ = max_tile_x_ = tx;
+      min_tile_y_ = max_tile_y_ = ty;
+    }
+    else
+    {
+      min_tile_x_ = std::min(min_tile_x_, tx);
+      min_tile_y_ = std::min(min_tile_y_, ty);
+      max_tile_x_ = std::max(max_tile_x_, tx);
+      max_tile_y_ = std::max(max_tile_y_, ty);
+    }
+  }
+  last_tile_ = pTile;
+  last_index_ = index;
+  return pTile;
+}
+
+void IncrementalOccupancyGrid::traceCell(int cx, int cy, int pass_delta, int hit_delta)
+{
+  int tx = floorDiv(cx, TileSize);
+  int ty = floorDiv(cy, TileSize);
+  Tile* pTile = getTile(tx, ty);
+
+  size_t cell = (cy - ty * TileSize) * TileSize + (cx - tx * TileSize);
+  pTile->pass[cell] += pass_delta;
+  pTile->hits[cell] += hit_delta;
+  updateState(pTile, TileIndex(tx, ty), cell);
+}
+
+void IncrementalOccupancyGrid::updateState(Tile* pTile, const TileIndex& rIndex, size_t cell)
+{
+  unsigned int pass = pTile->pass[cell];
+  unsigned int hits = pTile->hits[cell];
+
+  // Same rule as karto::OccupancyGrid::UpdateCell
+  unsigned char state = CellState_Unknown;
+  if(pass > min_pass_through_)
+    state = (double)hits / pass > occupancy_threshold_ ? CellState_Occupied : CellState_Free;
+
+  if(pTile->states[cell] != state)
+  {
+    pTile->states[cell] = state;
+    if(!pTile->dirty)
+    {
+      pTile->dirty = true;
+      dirty_.push_back(rIndex);
+    }
+  }
+}
+
+void IncrementalOccupancyGrid::raycast(const ScanRays& rRays, int delta)
+{
+  CellUpdater updater(*this);
+  traceRays(rRays, delta, updater);
+}
+
+template <typename Visitor>
+void IncrementalOccupancyGrid::traceRays(const ScanRays& rRays, int delta, Visitor& rVisitor) const
+{
+  int x0 = worldToCell(rRays.x);
+  int y0 = worldToCell(rRays.y);
+
+  for(size_t i = 0; i < rRays.end_x.size(); i++)
+  {
+    int x1 = worldToCell(rRays.end_x[i]);
+    int y1 = worldToCell(rRays.end_y[i]);
+
+    // Bresenham from the sensor to the end point; every cell but the last is passed through
+    int dx = abs(x1 - x0);
+    int dy = abs(y1 - y0);
+    int sx = x0 < x1 ? 1 : -1;
+    int sy = y0 < y1 ? 1 : -1;
+    int error = dx - dy;
+    int x = x0;
+    int y = y0;
+    while(x != x1 || y != y1)
+    {
+      rVisitor(x, y, delta, 0);
+      int e2 = 2 * error;
+      if(e2 > -dy)
+      {
+        error -= dy;
+        x += sx;
+      }
+      if(e2 < dx)
+      {
+        error += dx;
+        y += sy;
+      }
+    }
+
+    if(rRays.end_hit[i])
+      rVisitor(x1, y1, delta, delta);
+  }
+}
@@ -0,0 +1,96 @@
+#include <relative_slam/odometry_buffer.h>
+#include <algorithm>
+#include <cmath>
+
+// Slots this close to being overwritten are not read, so a reader that is
+// slightly behind the writer rarely has to retry
+static const unsigned long ReadMargin = 2;
+static const int MaxRetries = 8;
+
+OdometryBuffer::OdometryBuffer(size_t capacity) : samples_(std::max<size_t>(capacity, ReadMargin + 2)), count_(0)
+{
+}
+
+bool OdometryBuffer::Add(const OdometrySample& rSample)
+{
+  unsigned long count = count_.load(boost::memory_order_relaxed);
+  if(count > 0 && rSample.stamp <= samples_[(count - 1) % samples_.size()].stamp)
+    return false;
+  // As in SeqLock::Store(): the count announcing that this slot's old
+  // sample is gone must be visible before any of the new one is
+  boost::atomic_thread_fence(boost::memory_order_release);
+  samples_[count % samples_.size()] = rSample;
+  count_.store(count + 1, boost::memory_order_release);
+  return true;
+}
+
+bool OdometryBuffer::copy(unsigned long index, OdometrySample& rSample) const
+{
+  rSample = samples_[index % samples_.size()];
+  boost::atomic_thread_fence(boost::memory_order_acquire);
+  // The slot is rewritten once the writer starts on sample index + capacity
+  return count_.load(boost::memory_order_relaxed) < index + samples_.size();
+}
+
+bool OdometryBuffer::Newest(OdometrySample& rSample) const
+{
+  for(int attempt = 0; attempt < MaxRetries; attempt++)
+  {
+    unsigned long count = count_.load(boost::memory_order_acquire);
+    if(count == 0)
+      return false;
+    if(copy(count - 1, rSample))
+      return true;
+  }
+  return false;
+}
+
+OdometryBuffer::LookupResult OdometryBuffer::Lookup(double stamp, OdometrySample& rSample) const
+{
+  for(int attempt = 0; attempt < MaxRetries; attempt++)
+  {
+    unsigned long count = count_.load(boost::memory_order_acquire);
+    if(count == 0)
+      return Empty;
+    unsigned long capacity = samples_.size();
+    unsigned long first = count > capacity - ReadMargin ? count - (capacity - ReadMargin) : 0;
+
+    OdometrySample newest, oldest;
+    if(!copy(count - 1, newest) || !copy(first, oldest))
+      continue;
+    if(stamp > newest.stamp)
+      return TooNew;
+    if(stamp < oldest.stamp)
+      return TooOld;
+    if(stamp == newest.stamp)
+    {
+      rSample = newest;
+      return Found;
+    }
+
+    // Last sample at or before stamp
+    unsigned long lo = first, hi = count - 1;
+    while(hi - lo > 1)
+    {
+      unsigned long mid = lo + (hi - lo) / 2;
+      if(samples_[mid % capacity].stamp <= stamp)
+        lo = mid;
+      else
+        hi = mid;
+    }
+
+    OdometrySample before, after;
+    if(!copy(lo, before) || !copy(lo + 1, after) || before.stamp > stamp || after.stamp <= stamp)
+      continue;
+
+    double t = (stamp - before.stamp) / (after.stamp - before.stamp);
+    double dyaw = std::atan2(std::sin(after.yaw - before.yaw), std::cos(after.yaw - before.yaw));
+    rSample.stamp = stamp;
+    rSample.x = before.x + t * (after.x - before.x);
+    rSample.y = before.y + t * (after.y - before.y);
+    rSample.yaw = std::atan2(std::sin(before.yaw + t * dyaw), std::cos(before.yaw + t * dyaw));
+    return Found;
+  }
+  // The writer kept overtaking us, so what we want is about to fall out
+  return TooOld;
+}
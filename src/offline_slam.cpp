@@ -0,0 +1,377 @@
+// Builds a map from a recorded log of laser scans and odometry as fast as
+// the CPU allows, without a ROS master or tf. The core runs synchronously
+// and the log is read in order, so the same log and parameters always give
+// the same map. The log is either a text one (see TextScanLog) or a binary
+// one (see BinaryScanLog), told apart by its first bytes.
+//
+// Usage: offline_slam [-o prefix] [-p name=value]... <log>
+//
+// Writes <prefix>.pgm and <prefix>.yaml (map_server format), the optimized
+// global graph to <prefix>.graph and the keyframe poses, one "id x y yaw"
+// per line, to <prefix>_poses.txt; prints timing statistics when done.
+
+#include <relative_slam/slam_core.h>
+#include <relative_slam/binary_scan_log.h>
+#include <relative_slam/scan_log.h>
+#include <relative_slam/slam_log.h>
+#include <boost/chrono.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <string>
+#include <vector>
+
+typedef boost::chrono::steady_clock offline_clock;
+
+static double Seconds(offline_clock::duration d)
+{
+  return boost::chrono::duration<double>(d).count();
+}
+
+// Sets one of SlamParams by the name of the node parameter it comes from
+static bool SetParam(SlamParams& rParams, const std::string& name, const std::string& value)
+{
+  char* end;
+  errno = 0;
+  double number = strtod(value.c_str(), &end);
+  bool isNumber = !value.empty() && *end == '\0' && errno == 0;
+  bool isBool = value == "true" || value == "false";
+
+#define DOUBLE_PARAM(param) if(name == #param) { rParams.param = number; return isNumber; }
+#define INT_PARAM(param) if(name == #param) { rParams.param = (int)number; return isNumber && number == (int)number; }
+#define BOOL_PARAM(param) if(name == #param) { rParams.param = value == "true"; return isBool; }
+  DOUBLE_PARAM(resolution)
+  DOUBLE_PARAM(map_reraycast_distance)
+  DOUBLE_PARAM(map_reraycast_angle)
+  INT_PARAM(map_threads)
+  INT_PARAM(scan_buffer_size)
+  DOUBLE_PARAM(scan_buffer_max_distance)
+  DOUBLE_PARAM(corr_search_space_dim)
+  DOUBLE_PARAM(corr_search_space_res)
+  DOUBLE_PARAM(corr_search_space_smear_dev)
+  DOUBLE_PARAM(laser_range_threshold)
+  DOUBLE_PARAM(minimum_travel_distance)
+  DOUBLE_PARAM(minimum_travel_heading)
+  DOUBLE_PARAM(link_match_min_response_fine)
+  BOOL_PARAM(use_scan_barycenter)
+  DOUBLE_PARAM(link_scan_max_distance)
+  INT_PARAM(loop_match_min_chain_size)
+  DOUBLE_PARAM(loop_match_max_variance_coarse)
+  DOUBLE_PARAM(loop_match_min_response_coarse)
+  DOUBLE_PARAM(loop_match_min_response_fine)
+  DOUBLE_PARAM(loop_search_space_dim)
+  DOUBLE_PARAM(loop_search_space_res)
+  DOUBLE_PARAM(loop_search_space_smear_dev)
+  DOUBLE_PARAM(loop_search_max_distance)
+  INT_PARAM(loop_match_max_fine_candidates)
+  INT_PARAM(loop_closure_batch_size)
+  INT_PARAM(loop_closure_threads)
+  INT_PARAM(loop_descriptor_bins)
+  DOUBLE_PARAM(loop_descriptor_max_distance)
+  INT_PARAM(loop_cache_size)
+  DOUBLE_PARAM(loop_cache_invalidate_distance)
+  DOUBLE_PARAM(loop_cache_invalidate_angle)
+  DOUBLE_PARAM(loop_cache_cell_size)
+  DOUBLE_PARAM(loop_cache_cell_angle)
+  INT_PARAM(loop_backlog_size)
+  DOUBLE_PARAM(loop_priority_travel_scale)
+#undef DOUBLE_PARAM
+#undef INT_PARAM
+#undef BOOL_PARAM
+  return false;
+}
+
+static bool WriteMap(const GridMap& rMap, const std::string& prefix)
+{
+  // Same values and layout as map_saver: top row first
+  std::string image = prefix + ".pgm";
+  FILE* file = fopen(image.c_str(), "wb");
+  if(!file)
+    return false;
+  fprintf(file, "P5\n# CREATOR: offline_slam %.3f m/pix\n%d %d\n255\n", rMap.resolution, rMap.width, rMap.height);
+  std::vector<unsigned char> row(rMap.width);
+  for(int y = rMap.height - 1; y >= 0; y--)
+  {
+    const signed char* cells = &rMap.data[(size_t)y * rMap.width];
+    for(int x = 0; x < rMap.width; x++)
+      row[x] = cells[x] == 0 ? 254 : cells[x] == 100 ? 0 : 205;
+    fwrite(&row[0], 1, row.size(), file);
+  }
+  bool ok = !ferror(file);
+  fclose(file);
+  if(!ok)
+    return false;
+
+  // The image is referenced relative to the YAML file, so strip the directory
+  std::string yaml = prefix + ".yaml";
+  file = fopen(yaml.c_str(), "w");
+  if(!file)
+    return false;
+  size_t slash = image.find_last_of('/');
+  fprintf(file, "image: %s\nresolution: %f\norigin: [%f, %f, 0.0]\nnegate: 0\noccupied_thresh: 0.65\nfree_thresh: 0.196\n",
+          slash == std::string::npos ? image.c_str() : image.c_str() + slash + 1,
+          rMap.resolution, rMap.origin_x, rMap.origin_y);
+  ok = !ferror(file);
+  fclose(file);
+  return ok;
+}
+
+static bool WritePoses(const GraphSnapshot& rGraph, const std::string& path)
+{
+  FILE* file = fopen(path.c_str(), "w");
+  if(!file)
+    return false;
+  for(size_t i = 0; i < rGraph.keyframes.size(); i++)
+  {
+    const KeyframeRecord& keyframe = rGraph.keyframes[i];
+    if(keyframe.id >= 0)
+      fprintf(file, "%d %.6f %.6f %.6f\n", keyframe.id, keyframe.corrected_pose.GetX(),
+              keyframe.corrected_pose.GetY(), keyframe.corrected_pose.GetHeading());
+  }
+  bool ok = !ferror(file);
+  fclose(file);
+  return ok;
+}
+
+// Mean, median, 95th percentile and maximum of durations in seconds
+static void PrintTimes(const char* name, std::vector<double> times)
+{
+  if(times.empty())
+  {
+    printf("  %-10s none\n", name);
+    return;
+  }
+  std::sort(times.begin(), times.end());
+  double sum = 0.0;
+  for(size_t i = 0; i < times.size(); i++)
+    sum += times[i];
+  printf("  %-10s %7d  mean %8.3f ms  median %8.3f ms  95%% %8.3f ms  max %8.3f ms\n", name, (int)times.size(),
+         1000.0 * sum / times.size(), 1000.0 * times[times.size() / 2],
+         1000.0 * times[std::min(times.size() - 1, times.size() * 95 / 100)], 1000.0 * times.back());
+}
+
+struct ReplayStats
+{
+  ReplayStats() : scans(0), skipped(0), first_stamp(0.0), last_stamp(0.0) { }
+
+  int scans;
+  int skipped;
+  double first_stamp, last_stamp;
+  std::vector<double> scan_times, keyframe_times;
+};
+
+static void AddLaser(SlamCore& rCore, const LogLaser& rLaser)
+{
+  if(!rCore.hasLaser(rLaser.name))
+    rCore.addLaser(rLaser.name, karto::Pose2(rLaser.x, rLaser.y, rLaser.yaw), rLaser.min_range, rLaser.max_range,
+                   rLaser.min_angle, rLaser.max_angle, rLaser.angle_increment);
+}
+
+static void MatchScan(SlamCore& rCore, const std::string& laser, const std::vector<kt_double>& rRanges,
+                      const karto::Pose2& rOdomPose, double stamp, ReplayStats& rStats)
+{
+  if(rStats.scans++ == 0)
+    rStats.first_stamp = stamp;
+  rStats.last_stamp = stamp;
+  offline_clock::time_point start = offline_clock::now();
+  bool keyframe = rCore.addScan(laser, rRanges, rOdomPose, stamp);
+  (keyframe ? rStats.keyframe_times : rStats.scan_times).push_back(Seconds(offline_clock::now() - start));
+}
+
+static bool ReplayText(const std::string& path, SlamCore& rCore, ReplayStats& rStats)
+{
+  TextScanLog reader(path);
+  if(!reader.IsOpen())
+  {
+    fprintf(stderr, "Could not open %s\n", path.c_str());
+    return false;
+  }
+
+  // Scans wait here until the log has odometry past them, as the node waits
+  // for the odometry topic; a small window of it is enough
+  OdometryBuffer odometry(10000);
+  std::deque<LogScan> pending;
+  bool end = false;
+  while(!end)
+  {
+    switch(reader.Next())
+    {
+      case TextScanLog::Laser:
+        AddLaser(rCore, reader.GetLaser());
+        continue;
+      case TextScanLog::Odometry:
+        if(!odometry.Add(reader.GetOdometry()))
+          SLAM_WARN_THROTTLE(5.0, "Odometry at %.3f is not newer than the previous; ignoring it", reader.GetOdometry().stamp);
+        break;
+      case TextScanLog::Scan:
+        pending.push_back(reader.GetScan());
+        break;
+      case TextScanLog::Error:
+        fprintf(stderr, "%s: %s\n", path.c_str(), reader.GetError().c_str());
+        return false;
+      case TextScanLog::End:
+        end = true;
+        break;
+    }
+
+    // Match every scan the odometry has caught up with, in log order
+    while(!pending.empty())
+    {
+      const LogScan& scan = pending.front();
+      OdometrySample sample;
+      OdometryBuffer::LookupResult result = odometry.Lookup(scan.stamp, sample);
+      if((result == OdometryBuffer::TooNew || result == OdometryBuffer::Empty) && !end)
+        break;
+      if(result == OdometryBuffer::Found)
+        MatchScan(rCore, scan.laser, scan.ranges, karto::Pose2(sample.x, sample.y, sample.yaw), scan.stamp, rStats);
+      else
+        rStats.skipped++;
+      pending.pop_front();
+    }
+  }
+  return true;
+}
+
+static bool ReplayBinary(const std::string& path, SlamCore& rCore, ReplayStats& rStats)
+{
+  BinaryScanLog reader;
+  if(!reader.Open(path))
+  {
+    fprintf(stderr, "%s: %s\n", path.c_str(), reader.GetError().c_str());
+    return false;
+  }
+
+  // Scans carry their odometry; the ranges are only widened to what karto takes
+  std::vector<kt_double> ranges;
+  while(true)
+  {
+    switch(reader.Next())
+    {
+      case BinaryScanLog::Laser:
+        AddLaser(rCore, reader.GetLaser());
+        break;
+      case BinaryScanLog::Scan:
+      {
+        const BinaryScanHeader& scan = reader.GetScanHeader();
+        ranges.assign(reader.GetRanges(), reader.GetRanges() + scan.count);
+        MatchScan(rCore, *reader.GetLaserName(scan.laser), ranges,
+                  karto::Pose2(scan.odom_x, scan.odom_y, scan.odom_yaw), scan.stamp, rStats);
+        break;
+      }
+      case BinaryScanLog::Error:
+        fprintf(stderr, "%s: %s\n", path.c_str(), reader.GetError().c_str());
+        return false;
+      case BinaryScanLog::End:
+        if(reader.Truncated())
+          SLAM_WARN("%s ends in a partial record, probably cut short while recording", path.c_str());
+        return true;
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  std::string prefix = "map";
+  std::string log;
+  SlamParams params;
+  for(int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if((arg == "-o" || arg == "-p") && i + 1 < argc)
+    {
+      std::string value = argv[++i];
+      if(arg == "-o")
+      {
+        prefix = value;
+        continue;
+      }
+      size_t equals = value.find('=');
+      if(equals != std::string::npos && SetParam(params, value.substr(0, equals), value.substr(equals + 1)))
+        continue;
+      fprintf(stderr, "Invalid parameter %s\n", value.c_str());
+      return 1;
+    }
+    if(arg[0] == '-' || !log.empty())
+    {
+      log.clear();
+      break;
+    }
+    log = arg;
+  }
+  if(log.empty())
+  {
+    fprintf(stderr, "usage: %s [-o prefix] [-p name=value]... <log>\n", argv[0]);
+    return 1;
+  }
+
+  params.synchronous = true;
+  SlamCore core(params);
+
+  ReplayStats stats;
+  offline_clock::time_point start = offline_clock::now();
+  bool replayed = BinaryScanLog::IsBinaryLog(log) ? ReplayBinary(log, core, stats) : ReplayText(log, core, stats);
+  if(!replayed)
+    return 1;
+  core.flush();
+  double processTime = Seconds(offline_clock::now() - start);
+
+  offline_clock::time_point mapStart = offline_clock::now();
+  GridMap map;
+  bool gotMap = core.getMap(map);
+  double mapTime = Seconds(offline_clock::now() - mapStart);
+
+  int status = 0;
+  if(!gotMap)
+  {
+    fprintf(stderr, "No keyframes, so no map\n");
+    status = 1;
+  }
+  else if(!WriteMap(map, prefix))
+  {
+    fprintf(stderr, "Failed to write %s.pgm and %s.yaml\n", prefix.c_str(), prefix.c_str());
+    status = 1;
+  }
+
+  offline_clock::time_point graphStart = offline_clock::now();
+  GraphSnapshotPtr graph = core.getGraph();
+  if(graph)
+  {
+    // MRPT throws on some graphs; the map and poses are still worth writing
+    std::string error;
+    try
+    {
+      if(!core.exportGraph(*graph, true, prefix + ".graph", "", NULL))
+        error = "Failed to export the graph";
+    }
+    catch(std::exception& e)
+    {
+      error = std::string("Failed to export the graph: ") + e.what();
+    }
+    if(!error.empty())
+    {
+      fprintf(stderr, "%s\n", error.c_str());
+      status = 1;
+    }
+    if(!WritePoses(*graph, prefix + "_poses.txt"))
+    {
+      fprintf(stderr, "Failed to write %s_poses.txt\n", prefix.c_str());
+      status = 1;
+    }
+  }
+  double graphTime = Seconds(offline_clock::now() - graphStart);
+
+  double logTime = stats.last_stamp - stats.first_stamp;
+  printf("%d scans (%d skipped without odometry), %d keyframes, %d loop closures\n", stats.scans, stats.skipped,
+         graph ? (int)graph->keyframes.size() : 0, graph ? graph->loop_closures : 0);
+  printf("%.3f s of log processed in %.3f s (%.1fx real time)\n", logTime, processTime,
+         processTime > 0.0 ? logTime / processTime : 0.0);
+  PrintTimes("scans", stats.scan_times);
+  PrintTimes("keyframes", stats.keyframe_times);
+  printf("  map %.3f s, graph export %.3f s\n", mapTime, graphTime);
+  if(gotMap)
+    printf("Map: %d x %d cells at %.3f m\n", map.width, map.height, map.resolution);
+  return status;
+}
@@ -1,226 +1,84 @@
-#include "ros/ros.h"
+#include <relative_slam/relative_slam.h>
 #include "ros/console.h"
-#include "message_filters/subscriber.h"
-#include "tf/transform_broadcaster.h"
-#include "tf/transform_listener.h"
-#include "tf/message_filter.h"
 #include "visualization_msgs/MarkerArray.h"
+#include "geometry_msgs/PoseArray.h"
+#include "geometry_msgs/PoseStamped.h"
 
 #include "nav_msgs/MapMetaData.h"
-#include "sensor_msgs/LaserScan.h"
-#include "nav_msgs/GetMap.h"
-
-//#include "OpenKarto/ScanMatcher.h"
-//#include "OpenKarto/ScanManager.h"
-#include "OpenKarto/OpenMapper.h"
-#include <relative_slam/srba_solver.h>
-#include <boost/thread/thread.hpp>
-#include <boost/thread/mutex.hpp>
+#include <relative_slam/AdmissionDecision.h>
+#include <relative_slam/slam_log.h>
 #include <boost/bind.hpp>
-#include <string>
-#include <map>
-#include <vector>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/once.hpp>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include <list>
+#include <algorithm>
 
 // compute linear index for given map coords
 #define MAP_IDX(sx, i, j) ((sx) * (j) + (i))
 
-#define MAX_VARIANCE            500.0
 using namespace karto;
-using namespace srba;
 
-// Also belongs back in karto
-
-
-/*class NearScanVisitor : public Visitor<LocalizedObjectPtr>
+// Passes the core's messages on to rosconsole
+// The core's messages go to their own named logger, ros.relative_slam.core
+static void LogToRos(LogLevel level, const std::string& rMessage)
 {
-public:
-  NearScanVisitor(LocalizedLaserScan* pScan, kt_double maxDistance, kt_bool useScanBarycenter)
-    : m_MaxDistanceSquared(math::Square(maxDistance))
-    , m_UseScanBarycenter(useScanBarycenter)
+  switch(level)
   {
-    m_CenterPose = pScan->GetReferencePose(m_UseScanBarycenter);
+    case LogDebug: ROS_DEBUG_NAMED("core", "%s", rMessage.c_str()); break;
+    case LogInfo: ROS_INFO_NAMED("core", "%s", rMessage.c_str()); break;
+    case LogWarn: ROS_WARN_NAMED("core", "%s", rMessage.c_str()); break;
+    default: ROS_ERROR_NAMED("core", "%s", rMessage.c_str()); break;
   }
+}
 
-  virtual kt_bool Visit(Vertex<LocalizedObjectPtr>* pVertex)
+// The lowest level rosconsole currently lets through on the core's logger
+static LogLevel RosLogLevel()
+{
   {
-    LocalizedObject* pObject = pVertex->GetVertexObject();
-
-    LocalizedLaserScan* pScan = dynamic_cast<LocalizedLaserScan*>(pObject);
-    
-    // object is not a scan or wasn't scan matched, ignore
-    if (pScan == NULL)
-    {
-      return false;
-    }
-    
-    Pose2 pose = pScan->GetReferencePose(m_UseScanBarycenter);
-
-    kt_double squaredDistance = pose.GetPosition().SquaredDistance(m_CenterPose.GetPosition());
-    return (squaredDistance <= m_MaxDistanceSquared - KT_TOLERANCE);
+    ROSCONSOLE_DEFINE_LOCATION(true, ::ros::console::levels::Debug, ROSCONSOLE_DEFAULT_NAME ".core");
+    if(__rosconsole_define_location__enabled)
+      return LogDebug;
   }
+  {
+    ROSCONSOLE_DEFINE_LOCATION(true, ::ros::console::levels::Info, ROSCONSOLE_DEFAULT_NAME ".core");
+    if(__rosconsole_define_location__enabled)
+      return LogInfo;
+  }
+  {
+    ROSCONSOLE_DEFINE_LOCATION(true, ::ros::console::levels::Warn, ROSCONSOLE_DEFAULT_NAME ".core");
+    if(__rosconsole_define_location__enabled)
+      return LogWarn;
+  }
+  return LogError;
+}
 
-protected:
-  Pose2 m_CenterPose;
-  kt_double m_MaxDistanceSquared;
-  kt_bool m_UseScanBarycenter;
-
-}; // NearScanVisitor
-
-*/
-
+// The handler is process wide and stays installed: with several nodes in
+// one nodelet manager, none may replace or remove it under the others
+static boost::once_flag log_handler_once = BOOST_ONCE_INIT;
 
-class RelativeSlam
+static void InstallLogHandler()
 {
-  public:
-    RelativeSlam();
-    ~RelativeSlam();
-
-    void laserCallback(const sensor_msgs::LaserScan::ConstPtr& scan);
-    bool mapCallback(nav_msgs::GetMap::Request  &req,
-                                 nav_msgs::GetMap::Response &res);
-
-  private:
-    bool getOdomPose(karto::Pose2& karto_pose, const ros::Time& t);
-    karto::LaserRangeFinder* getLaser(const sensor_msgs::LaserScan::ConstPtr& scan);
-    bool addScan(karto::LaserRangeFinder* laser,
-      const sensor_msgs::LaserScan::ConstPtr& scan,
-      karto::Pose2& karto_pose);
-    bool updateMap();
-    void publishTransform();
-    void publishLoop(double transform_publish_period);
-    void publishVis(double vis_publish_period);
-    void publishGraphVisualization();
-    bool hasMovedEnough(karto::LocalizedRangeScan* pScan, karto::LocalizedRangeScan* pLastScan) const;
-    bool process(karto::LocalizedRangeScan* pScan);
-
-    // These really should be moved back into karto once the graph stuff has been ripped out
-    bool addEdges(karto::LocalizedObject *pObject);
-    void LinkObjects(LocalizedObject* pFromObject, LocalizedObject* pToObject, const Pose2& rMean, const Matrix3& rCovariance);
-    bool AddEdges(LocalizedLaserScanPtr pScan, const Matrix3& rCovariance);
-    void LinkChainToScan(const LocalizedLaserScanList& rChain, LocalizedLaserScanPtr pScan, const Pose2& rMean, const Matrix3& rCovariance);
-    void LinkNearChains(LocalizedLaserScanPtr pScan, Pose2List& rMeans, List<Matrix3>& rCovariances);
-    Pose2 ComputeWeightedMean(const Pose2List& rMeans, const List<Matrix3>& rCovariances) const;
-    LocalizedLaserScanPtr GetClosestScanToPose(const LocalizedLaserScanList& rScans, const Pose2& rPose) const;
-    List<LocalizedLaserScanList> FindNearChains(LocalizedLaserScanPtr pScan);
-    LocalizedLaserScanList FindNearLinkedScans(LocalizedLaserScanPtr pScan, kt_double maxDistance);   
-    //kt_bool //TryCloseLoop(LocalizedLaserScanPtr pScan, const Identifier& rSensorName);
-    void TryCloseLoop(LocalizedLaserScanPtr pScan);
-    //void TryCloseLoop();
-    void TryCloseLoopThread();
-    std::list<LocalizedLaserScanPtr> FindPossibleLoopClosure(LocalizedLaserScanPtr pScan, const Identifier& rSensorName, kt_int32u& rStartScanIndex);
-    void CorrectPoses();
-
-     // ROS handles
-    ros::NodeHandle node_;
-    tf::TransformListener tf_;
-    tf::TransformBroadcaster* tfB_;
-    message_filters::Subscriber<sensor_msgs::LaserScan>* scan_filter_sub_;
-    tf::MessageFilter<sensor_msgs::LaserScan>* scan_filter_;
-    ros::Publisher sst_;
-    ros::Publisher marker_publisher_;
-    ros::Publisher sstm_;
-    ros::ServiceServer ss_;
-
-    // The map that will be published / send to service callers
-    nav_msgs::GetMap::Response map_;
-
-    // Storage for ROS parameters
-    std::string odom_frame_;
-    std::string global_map_frame_;
-    std::string relative_map_frame_;
-    std::string base_frame_;
-    int throttle_scans_;
-    ros::Duration map_update_interval_;
-    double resolution_;
-    boost::mutex map_mutex_;
-    boost::mutex map_to_odom_mutex_;
-
-    boost::mutex scan_manager_mutex_;
-    boost::mutex scan_matcher_mutex_;
-    boost::mutex loop_closure_mutex_;
-
-    // Karto bookkeeping
-    karto::MapperSensorManager* scan_manager_;
-    karto::ScanMatcher* sequential_scan_matcher_;
-    karto::ScanMatcher* loop_scan_matcher_;
-    SRBASolver solver_;
-    std::map<std::string, karto::LaserRangeFinder*> lasers_;
-    std::map<std::string, bool> lasers_inverted_;
-    karto::Identifier sensor_name_;
-
-    // Internal state
-    bool got_map_;
-    boost::thread* transform_thread_;
-    boost::thread* vis_thread_;
-    tf::Transform global_map_to_odom_;
-    tf::Transform global_map_to_relative_map_;
-    bool inverted_laser_;
-    //const Identifier& sensor_name_;
-   
-    // These need to be params here
-    int scan_buffer_size_; 
-    double scan_buffer_max_distance_;
-    double corr_search_space_dim_;
-    double corr_search_space_res_;
-    double corr_search_space_smear_dev_;
-    double laser_range_threshold_;
-    double minimum_travel_heading_;
-    double minimum_travel_distance_;
-    double link_match_min_response_fine_; 
-    bool use_scan_barycenter_;
-    double link_scan_max_distance_;
-    int laser_count_;
-    int loop_match_min_chain_size_;
-    double loop_match_max_variance_coarse_;
-    double loop_match_min_response_coarse_;
-    double loop_match_min_response_fine_;
-    double loop_search_space_dim_;
-    double loop_search_space_res_;
-    double loop_search_space_smear_dev_;
-    double loop_search_max_distance_;
-    bool is_multithreaded_;
-
-    LocalizedLaserScanPtr loop_closure_candidate_;
-    boost::shared_ptr<boost::thread> loop_closure_thread_;
-
-    bool loop_closed_;
-    // cosmetic
-    bool got_initial_pose_;
-    karto::Pose2 initial_pose_;
-    tf::Stamped<tf::Pose> initial_odom_;
-};
-
-RelativeSlam::RelativeSlam() : got_map_(false),
+  SetLogHandler(&LogToRos);
+}
+
+RelativeSlam::RelativeSlam(ros::NodeHandle node, ros::NodeHandle private_nh) : node_(node), private_nh_(private_nh),
+  got_map_(false),
+  shutdown_(false),
   transform_thread_(NULL),
-  scan_buffer_size_(70),
-  scan_buffer_max_distance_(20),
-  corr_search_space_dim_(0.3),
-  corr_search_space_res_(0.01),
-  corr_search_space_smear_dev_(0.03),
-  laser_range_threshold_(15.0),
-  minimum_travel_heading_(0.35),
-  minimum_travel_distance_(0.2),
-  link_match_min_response_fine_(0.8),
-  use_scan_barycenter_(true),
-  link_scan_max_distance_(10.0),
-  is_multithreaded_(false),
-  loop_match_min_chain_size_(10),
-  loop_match_max_variance_coarse_(0.16),
-  loop_match_min_response_coarse_(0.7),
-  loop_match_min_response_fine_(0.8),
-  loop_search_space_dim_(8),
-  loop_search_space_res_(0.05),
-  loop_search_space_smear_dev_(0.03),
-  loop_search_max_distance_(4.0),
-  laser_count_(0),
-  loop_closed_(false),
-  got_initial_pose_(false)
+  vis_thread_(NULL),
+  laser_count_(0)
 {
-  global_map_to_relative_map_.setIdentity();
-  global_map_to_odom_.setIdentity();
+  // The core skips messages rosconsole would drop; the level is checked
+  // again periodically in case it is changed at run time
+  boost::call_once(log_handler_once, &InstallLogHandler);
+  SetLogLevel(RosLogLevel());
+  log_level_timer_ = node_.createWallTimer(ros::WallDuration(1.0), &RelativeSlam::updateLogLevel, this);
+
   // Retrieve parameters
-  ros::NodeHandle private_nh_("~");
   if(!private_nh_.getParam("odom_frame", odom_frame_))
     odom_frame_ = "odom";
   if(!private_nh_.getParam("relative_map_frame", relative_map_frame_))
@@ -229,66 +87,323 @@ RelativeSlam::RelativeSlam() : got_map_(false),
     global_map_frame_ = "global_map";
   if(!private_nh_.getParam("base_frame", base_frame_))
     base_frame_ = "base_link";
-  if(!private_nh_.getParam("throttle_scans", throttle_scans_))
-    throttle_scans_ = 1;
+  int throttle_scans;
+  if(!private_nh_.getParam("throttle_scans", throttle_scans))
+    throttle_scans = 1;
+  throttle_scans = std::max(1, throttle_scans);
   double tmp;
   if(!private_nh_.getParam("map_update_interval", tmp))
     tmp = 5.0;
   map_update_interval_.fromSec(tmp);
-  if(!private_nh_.getParam("resolution", resolution_))
+  SlamParams params;
+  if(!private_nh_.getParam("resolution", params.resolution))
   {
     // Compatibility with slam_gmapping, which uses "delta" to mean
     // resolution
-    if(!private_nh_.getParam("delta", resolution_))
-      resolution_ = 0.05;
+    if(!private_nh_.getParam("delta", params.resolution))
+      params.resolution = 0.05;
   }
+  resolution_ = params.resolution;
+  // Scans whose pose changed by more than this (m, rad) since they were
+  // raycast are subtracted from the map and raycast again
+  private_nh_.param("map_reraycast_distance", params.map_reraycast_distance, params.resolution);
+  private_nh_.param("map_reraycast_angle", params.map_reraycast_angle, 0.01);
+  private_nh_.param("map_full_publish_interval", tmp, 30.0);
+  map_full_publish_interval_.fromSec(tmp);
+  // Scans of a map update are raycast on this many threads; 0 uses one per core
+  private_nh_.param("map_threads", params.map_threads, 0);
+  // Cell size multiples of the coarse map levels; each must divide the tile size
+  std::vector<int> map_pyramid_factors;
+  if(!private_nh_.getParam("map_pyramid_factors", map_pyramid_factors))
+  {
+    map_pyramid_factors.push_back(4);
+    map_pyramid_factors.push_back(16);
+  }
+  for(size_t i = 0; i < map_pyramid_factors.size(); i++)
+  {
+    if(!MapPyramid::IsValidFactor(map_pyramid_factors[i]))
+      ROS_WARN("Ignoring map pyramid factor %d: it must be greater than 1 and divide the tile size (%d)",
+               map_pyramid_factors[i], (int)IncrementalOccupancyGrid::TileSize);
+  }
+  map_pyramid_ = boost::make_shared<MapPyramid>(map_pyramid_factors);
+  // Also publish the map compressed, with a full keyframe every
+  // compressed_map_keyframe_interval messages and changed tiles in between
+  private_nh_.param("publish_compressed_map", publish_compressed_map_, false);
+  private_nh_.param("compressed_map_loopback", compressed_map_loopback_, false);
+  int compressed_map_keyframe_interval;
+  private_nh_.param("compressed_map_keyframe_interval", compressed_map_keyframe_interval, 10);
+  map_encoder_ = boost::make_shared<MapEncoder>(IncrementalOccupancyGrid::TileSize, std::max(0, compressed_map_keyframe_interval));
+  // Publish a map of only the keyframes within local_map_distance hops of
+  // the newest one, in the relative map frame, every local_map_update_interval seconds
+  private_nh_.param("local_map", local_map_, false);
+  private_nh_.param("local_map_distance", local_map_distance_, 10);
+  private_nh_.param("local_map_update_interval", tmp, 1.0);
+  local_map_update_interval_.fromSec(tmp);
+  local_grid_.Clear(resolution_);
   double transform_publish_period;
   private_nh_.param("transform_publish_period", transform_publish_period, 0.05);
   double vis_publish_period;
   private_nh_.param("vis_publish_period", vis_publish_period, 5.0);
+  // The robot pose in the global map, from the latest odometry and
+  // correction, is published on pose at this interval (s); 0 disables
+  double pose_publish_period;
+  private_nh_.param("pose_publish_period", pose_publish_period, 0.0);
+  // Odometry (nav_msgs/Odometry of base_frame in odom_frame) is buffered from
+  // this topic instead of being looked up in tf for every scan; empty uses tf
+  std::string odom_topic;
+  private_nh_.param("odom_topic", odom_topic, std::string());
+  int odom_buffer_size;
+  private_nh_.param("odom_buffer_size", odom_buffer_size, 1000);
+  private_nh_.param("odom_timeout", odom_timeout_, 0.1);
+  if(!odom_topic.empty())
+    odom_buffer_ = boost::make_shared<OdometryBuffer>(std::max(odom_buffer_size, 1));
+  // Keyframes further than vis_detail_distance (m) from the newest one are
+  // drawn as edges only; markers are resent after moving vis_update_distance (m) or vis_update_angle (rad)
+  double vis_detail_distance, vis_update_distance, vis_update_angle;
+  private_nh_.param("vis_detail_distance", vis_detail_distance, 20.0);
+  private_nh_.param("vis_update_distance", vis_update_distance, 0.05);
+  private_nh_.param("vis_update_angle", vis_update_angle, 0.02);
+  visualizer_ = boost::make_shared<GraphVisualizer>(global_map_frame_);
+  visualizer_->SetParams(vis_detail_distance, vis_update_distance, vis_update_angle);
+  // Every graph_export_period seconds the optimized global graph is written to
+  // graph_export_file (MRPT text graph) and graph_export_scene_file (.3Dscene),
+  // when set, and published on global_graph_poses; 0 disables the export
+  double graph_export_period;
+  private_nh_.param("graph_export_period", graph_export_period, 0.0);
+  private_nh_.param("graph_export_file", graph_export_file_, std::string());
+  private_nh_.param("graph_export_scene_file", graph_export_scene_file_, std::string());
+  private_nh_.param("graph_export_niceness", graph_export_niceness_, 19);
+  marker_subscribers_ = 0;
+  // Keyframes queued for loop closure beyond this backlog are dropped, oldest first
+  private_nh_.param("loop_closure_queue_size", params.loop_closure_queue_size, 5);
+  // Candidates that waited longer than this (seconds) are skipped; 0 disables
+  private_nh_.param("loop_closure_max_latency", params.loop_closure_max_latency, 2.0);
+  // Coarse loop matches run concurrently on this many threads; 0 uses one per core
+  private_nh_.param("loop_closure_threads", params.loop_closure_threads, 0);
+  // Candidates are coarse matched in batches of this size, and only this
+  // many of the best coarse matches of a batch go on to fine verification
+  private_nh_.param("loop_closure_batch_size", params.loop_closure_batch_size, 8);
+  private_nh_.param("loop_match_max_fine_candidates", params.loop_match_max_fine_candidates, 2);
+  // Range histogram size of the place descriptor, and the largest descriptor
+  // distance (0..1) a chain may have to be coarse matched; 1 disables the prefilter
+  private_nh_.param("loop_descriptor_bins", params.loop_descriptor_bins, 40);
+  private_nh_.param("loop_descriptor_max_distance", params.loop_descriptor_max_distance, 0.35);
+  // Failed attempts are remembered until a correction moves one of their
+  // keyframes by more than these thresholds (m, rad)
+  private_nh_.param("loop_cache_size", params.loop_cache_size, 2000);
+  private_nh_.param("loop_cache_invalidate_distance", params.loop_cache_invalidate_distance, 0.1);
+  private_nh_.param("loop_cache_invalidate_angle", params.loop_cache_invalidate_angle, 0.05);
+  // Queries within the same cell (m, rad) count as the same place for the cache
+  private_nh_.param("loop_cache_cell_size", params.loop_cache_cell_size, 0.5);
+  private_nh_.param("loop_cache_cell_angle", params.loop_cache_cell_angle, 0.5);
+  // CPU time (s) loop closure may spend per keyframe or idle period; 0 is unlimited
+  private_nh_.param("loop_closure_budget", params.loop_closure_budget, 0.5);
+  // Unevaluated candidates kept for idle periods, lowest priority dropped first
+  private_nh_.param("loop_backlog_size", params.loop_backlog_size, 100);
+  // Distance (m) at which travel and drift count fully towards a candidate's priority
+  private_nh_.param("loop_priority_travel_scale", params.loop_priority_travel_scale, 50.0);
+  // Scans waiting for the front-end beyond this are dropped, oldest first;
+  // keyframes waiting for the back-end beyond this hold up the front-end
+  int frontend_queue_size;
+  private_nh_.param("frontend_queue_size", frontend_queue_size, 5);
+  private_nh_.param("backend_queue_size", params.backend_queue_size, 20);
+  // Throughput and queue depth of every pipeline stage are logged this often (s); 0 disables
+  private_nh_.param("pipeline_stats_period", pipeline_stats_period_, 10.0);
+  // A scan becomes a keyframe after this much motion (m, rad)
+  private_nh_.param("minimum_travel_distance", params.minimum_travel_distance, params.minimum_travel_distance);
+  private_nh_.param("minimum_travel_heading", params.minimum_travel_heading, params.minimum_travel_heading);
+  // Under load, admission control raises throttle_scans and the motion
+  // gating thresholds up to these bounds, and lowers them again to the
+  // configured values once the load is gone. It samples the pipeline every
+  // admission_period seconds; 0 keeps the configured values fixed.
+  AdmissionSettings admission;
+  admission.min_limits.throttle_scans = throttle_scans;
+  admission.min_limits.minimum_travel_distance = params.minimum_travel_distance;
+  admission.min_limits.minimum_travel_heading = params.minimum_travel_heading;
+  double admission_period;
+  private_nh_.param("admission_period", admission_period, 1.0);
+  private_nh_.param("admission_max_throttle_scans", admission.max_limits.throttle_scans, 4 * throttle_scans);
+  private_nh_.param("admission_max_travel_distance", admission.max_limits.minimum_travel_distance, 2.0 * params.minimum_travel_distance);
+  private_nh_.param("admission_max_travel_heading", admission.max_limits.minimum_travel_heading, 2.0 * params.minimum_travel_heading);
+  admission.max_limits.throttle_scans = std::max(admission.max_limits.throttle_scans, throttle_scans);
+  admission.max_limits.minimum_travel_distance = std::max(admission.max_limits.minimum_travel_distance, params.minimum_travel_distance);
+  admission.max_limits.minimum_travel_heading = std::max(admission.max_limits.minimum_travel_heading, params.minimum_travel_heading);
+  // Seconds a scan may take through the front-end, and the queue fill
+  // counted as full load; below admission_low_load for
+  // admission_relax_periods samples the limits step back
+  private_nh_.param("admission_target_latency", admission.target_latency, 0.2);
+  private_nh_.param("admission_high_queue_fill", admission.high_queue_fill, 0.75);
+  private_nh_.param("admission_low_load", admission.low_load, 0.5);
+  private_nh_.param("admission_relax_periods", admission.relax_periods, 3);
+  private_nh_.param("admission_step", admission.step, 1.25);
+  if(admission_period > 0.0)
+    admission_controller_ = boost::make_shared<AdmissionController>(admission);
+
+  // The mapping itself; it starts its back-end and loop closure stages
+  core_ = boost::make_shared<SlamCore>(params);
+  core_->setAdmissionLimits(admission.min_limits);
 
   // Set up advertisements and subscriptions
   tfB_ = new tf::TransformBroadcaster();
   sst_ = node_.advertise<nav_msgs::OccupancyGrid>("map", 1, true);
   sstm_ = node_.advertise<nav_msgs::MapMetaData>("map_metadata", 1, true);
+  sstu_ = node_.advertise<map_msgs::OccupancyGridUpdate>("map_updates", 100);
   ss_ = node_.advertiseService("dynamic_map", &RelativeSlam::mapCallback, this);
+  for(size_t i = 0; i < map_pyramid_->NumLevels(); i++)
+    map_pyramid_pubs_.push_back(node_.advertise<nav_msgs::OccupancyGrid>("map_level_" + boost::lexical_cast<std::string>(i + 1), 1, true));
+  if(publish_compressed_map_)
+    smc_ = node_.advertise<relative_slam::CompressedMap>("map_compressed", 10);
+  if(local_map_)
+    local_map_pub_ = node_.advertise<nav_msgs::OccupancyGrid>("local_map", 1);
   scan_filter_sub_ = new message_filters::Subscriber<sensor_msgs::LaserScan>(node_, "scan", 5);
-  scan_filter_ = new tf::MessageFilter<sensor_msgs::LaserScan>(*scan_filter_sub_, tf_, odom_frame_, 5);
-  scan_filter_->registerCallback(boost::bind(&RelativeSlam::laserCallback, this, _1));
+  if(odom_buffer_)
+  {
+    scan_filter_ = NULL;
+    scan_filter_sub_->registerCallback(boost::bind(&RelativeSlam::laserCallback, this, _1));
+    odom_sub_ = node_.subscribe(odom_topic, 100, &RelativeSlam::odomCallback, this);
+  }
+  else
+  {
+    scan_filter_ = new tf::MessageFilter<sensor_msgs::LaserScan>(*scan_filter_sub_, tf_, odom_frame_, 5);
+    scan_filter_->registerCallback(boost::bind(&RelativeSlam::laserCallback, this, _1));
+  }
   marker_publisher_ = node_.advertise<visualization_msgs::MarkerArray>("visualization_marker_array",1);
+  if(graph_export_period > 0.0)
+    graph_poses_pub_ = node_.advertise<geometry_msgs::PoseArray>("global_graph_poses", 1, true);
+  if(admission_controller_)
+    admission_pub_ = node_.advertise<relative_slam::AdmissionDecision>("admission_decisions", 100);
+  if(pose_publish_period > 0.0)
+    pose_pub_ = node_.advertise<geometry_msgs::PoseStamped>("pose", 10);
 
   // Create a thread to periodically publish the latest map->odom
   // transform; it needs to go out regularly, uninterrupted by potentially
   // long periods of computation in our main loop.
   transform_thread_ = new boost::thread(boost::bind(&RelativeSlam::publishLoop, this, transform_publish_period));
   vis_thread_ = new boost::thread(boost::bind(&RelativeSlam::publishVis, this, vis_publish_period));
-
-  // Initialize Karto structures
-  scan_manager_ = new karto::MapperSensorManager(scan_buffer_size_, scan_buffer_max_distance_);
-  sequential_scan_matcher_ = karto::ScanMatcher::Create(corr_search_space_dim_, corr_search_space_res_, corr_search_space_smear_dev_, laser_range_threshold_, false);
-  loop_scan_matcher_ = karto::ScanMatcher::Create(loop_search_space_dim_, loop_search_space_res_, loop_search_space_smear_dev_, laser_range_threshold_, false);
-  loop_closure_thread_ = boost::make_shared<boost::thread>(boost::bind(&RelativeSlam::TryCloseLoopThread, this));
-  // Use SRBA for graph structures and solving
-  //SRBASolver* solver_ = new SRBASolver();
+  if(pose_publish_period > 0.0)
+    pose_thread_ = boost::make_shared<boost::thread>(boost::bind(&RelativeSlam::publishPoseLoop, this, pose_publish_period));
+  if(graph_export_period > 0.0)
+    graph_export_thread_ = boost::make_shared<boost::thread>(boost::bind(&RelativeSlam::graphExportLoop, this, graph_export_period));
+
+  // Start the node's stages: the front-end matches scans through the core,
+  // whose keyframes feed the map stages
+  map_stage_ = boost::make_shared<MapStage>("map", 1, MapStage::DropOldest);
+  map_stage_->Start(boost::bind(&RelativeSlam::mapStep, this, _1, _2));
+  if(local_map_)
+  {
+    local_map_stage_ = boost::make_shared<MapStage>("local_map", 1, MapStage::DropOldest);
+    local_map_stage_->Start(boost::bind(&RelativeSlam::localMapStep, this, _1, _2));
+  }
+  frontend_stage_ = boost::make_shared<FrontendStage>("frontend", std::max(1, frontend_queue_size), FrontendStage::DropOldest);
+  frontend_stage_->Start(boost::bind(&RelativeSlam::frontendStep, this, _1, _2));
+  double pipeline_period = admission_controller_ ? admission_period : pipeline_stats_period_;
+  if(pipeline_period > 0.0)
+    pipeline_timer_ = node_.createWallTimer(ros::WallDuration(pipeline_period), &RelativeSlam::monitorPipeline, this);
 }
 
 RelativeSlam::~RelativeSlam()
 {
+  // No more input; then stop the stages upstream first, so none of them
+  // pushes into a stopped one, and the core only once nothing uses it
+  if (scan_filter_sub_)
+    scan_filter_sub_->unsubscribe();
+  odom_sub_.shutdown();
+  shutdown_ = true;
+  pipeline_timer_.stop();
+  log_level_timer_.stop();
+  if(frontend_stage_)
+    frontend_stage_->Stop();
+  if(map_stage_)
+    map_stage_->Stop();
+  if(local_map_stage_)
+    local_map_stage_->Stop();
+  if(graph_export_thread_)
+  {
+    graph_export_thread_->interrupt();
+    graph_export_thread_->join();
+  }
   if(transform_thread_)
   {
     transform_thread_->join();
     delete transform_thread_;
   }
+  if(vis_thread_)
+  {
+    vis_thread_->join();
+    delete vis_thread_;
+  }
+  if(pose_thread_)
+    pose_thread_->join();
   if (scan_filter_)
     delete scan_filter_;
   if (scan_filter_sub_)
     delete scan_filter_sub_;
-  if (scan_manager_)
-    delete scan_manager_;
-  if (sequential_scan_matcher_)
-    delete sequential_scan_matcher_;
-  //if (solver_)
-   // delete solver_;
+  core_.reset();
+}
+
+void RelativeSlam::updateLogLevel(const ros::WallTimerEvent& event)
+{
+  SetLogLevel(RosLogLevel());
+}
+
+void RelativeSlam::graphExportLoop(double graph_export_period)
+{
+  // Exporting is background work; don't let it compete with the pipeline.
+  // Linux applies niceness to single threads.
+  if(setpriority(PRIO_PROCESS, syscall(SYS_gettid), graph_export_niceness_) != 0)
+    ROS_WARN("Could not lower the priority of the graph export thread");
+
+  // The graph is optimized before export whenever a loop was closed since the previous one
+  int exported_loop_closures = 0;
+  try
+  {
+    while(!shutdown_)
+    {
+      boost::this_thread::sleep(boost::posix_time::milliseconds((int)(graph_export_period * 1000)));
+
+      bool publish = graph_poses_pub_.getNumSubscribers() > 0;
+      if(!publish && graph_export_file_.empty() && graph_export_scene_file_.empty())
+        continue;
+
+      GraphSnapshotPtr graph = core_->getGraph();
+      if(!graph)
+        continue;
+
+      std::vector<karto::Pose2> poses;
+      bool optimize = graph->loop_closures != exported_loop_closures;
+      bool exported = false;
+      try
+      {
+        exported = core_->exportGraph(*graph, optimize, graph_export_file_, graph_export_scene_file_, publish ? &poses : NULL);
+      }
+      catch(std::exception& e)
+      {
+        // MRPT throws on a bad path or a full disk; that must not take the node down
+        ROS_ERROR_THROTTLE(60.0, "Failed to export the graph: %s", e.what());
+      }
+      if(exported)
+      {
+        exported_loop_closures = graph->loop_closures;
+        if(publish)
+        {
+          geometry_msgs::PoseArray msg;
+          msg.header.frame_id = global_map_frame_;
+          msg.header.stamp = ros::Time::now();
+          msg.poses.resize(poses.size());
+          for(size_t i = 0; i < poses.size(); i++)
+          {
+            msg.poses[i].position.x = poses[i].GetX();
+            msg.poses[i].position.y = poses[i].GetY();
+            msg.poses[i].orientation = tf::createQuaternionMsgFromYaw(poses[i].GetHeading());
+          }
+          graph_poses_pub_.publish(msg);
+        }
+      }
+    }
+  }
+  catch(boost::thread_interrupted&)
+  {
+  }
 }
 
 void RelativeSlam::publishLoop(double transform_publish_period)
@@ -297,19 +412,75 @@ void RelativeSlam::publishLoop(double transform_publish_period)
     return;
 
    ros::Rate r(1.0 / transform_publish_period);
-   while(ros::ok())
+   while(!shutdown_)
    {
     publishTransform();
     r.sleep();
    }
 }
 
+static tf::Transform PlanarTransform(double x, double y, double yaw)
+{
+  return tf::Transform(tf::createQuaternionFromRPY(0, 0, yaw), tf::Vector3(x, y, 0));
+}
+
 void RelativeSlam::publishTransform()
 {
-  boost::mutex::scoped_lock(map_to_odom_mutex_);
-  ros::Time tf_expiration = ros::Time::now() + ros::Duration(0.05);
-  tfB_->sendTransform(tf::StampedTransform (global_map_to_odom_, ros::Time::now(), global_map_frame_, odom_frame_));
-  tfB_->sendTransform(tf::StampedTransform (global_map_to_relative_map_, ros::Time::now(), global_map_frame_, relative_map_frame_));
+  MapCorrection correction = core_->getCorrection();
+  ros::Time now = ros::Time::now();
+  tfB_->sendTransform(tf::StampedTransform (PlanarTransform(correction.odom_x, correction.odom_y, correction.odom_yaw),
+                                            now, global_map_frame_, odom_frame_));
+  tfB_->sendTransform(tf::StampedTransform (PlanarTransform(correction.relative_map_x, correction.relative_map_y, correction.relative_map_yaw),
+                                            now, global_map_frame_, relative_map_frame_));
+}
+
+void RelativeSlam::publishPoseLoop(double pose_publish_period)
+{
+  ros::Rate r(1.0 / pose_publish_period);
+  ros::Time last_stamp;
+  while(!shutdown_)
+  {
+    // The newest odometry there is, not the one of the last keyframe
+    tf::StampedTransform odom_to_base;
+    OdometrySample newest;
+    if(odom_buffer_)
+    {
+      if(!odom_buffer_->Newest(newest))
+      {
+        r.sleep();
+        continue;
+      }
+      odom_to_base = tf::StampedTransform(PlanarTransform(newest.x, newest.y, newest.yaw),
+                                          ros::Time(newest.stamp), odom_frame_, base_frame_);
+    }
+    else
+    {
+      try
+      {
+        tf_.lookupTransform(odom_frame_, base_frame_, ros::Time(0), odom_to_base);
+      }
+      catch(tf::TransformException e)
+      {
+        ROS_WARN_THROTTLE(5.0, "Failed to look up the odom pose (%s)", e.what());
+        r.sleep();
+        continue;
+      }
+    }
+
+    if(odom_to_base.stamp_ != last_stamp)
+    {
+      MapCorrection correction = core_->getCorrection();
+      tf::Transform pose = PlanarTransform(correction.odom_x, correction.odom_y, correction.odom_yaw) * odom_to_base;
+
+      geometry_msgs::PoseStamped msg;
+      msg.header.stamp = odom_to_base.stamp_;
+      msg.header.frame_id = global_map_frame_;
+      tf::poseTFToMsg(pose, msg.pose);
+      pose_pub_.publish(msg);
+      last_stamp = odom_to_base.stamp_;
+    }
+    r.sleep();
+  }
 }
 
 void RelativeSlam::publishVis(double vis_publish_period)
@@ -318,18 +489,17 @@ void RelativeSlam::publishVis(double vis_publish_period)
     return;
 
    ros::Rate r(1.0 / vis_publish_period);
-   while(ros::ok())
+   while(!shutdown_)
    {
     publishGraphVisualization();
     r.sleep();
    }
 }
 
-karto::LaserRangeFinder*
-RelativeSlam::getLaser(const sensor_msgs::LaserScan::ConstPtr& scan)
+bool RelativeSlam::getLaser(const sensor_msgs::LaserScan::ConstPtr& scan)
 {
   // Check whether we know about this laser yet
-  if(lasers_.find(scan->header.frame_id) == lasers_.end())
+  if(!core_->hasLaser(scan->header.frame_id))
   {
     // New laser; need to create a Karto device for it.
 
@@ -347,7 +517,7 @@ RelativeSlam::getLaser(const sensor_msgs::LaserScan::ConstPtr& scan)
     {
       ROS_WARN("Failed to compute laser pose, aborting initialization (%s)",
          e.what());
-      return NULL;
+      return false;
     }
 
     double yaw = tf::getYaw(laser_pose.getRotation());
@@ -373,7 +543,7 @@ RelativeSlam::getLaser(const sensor_msgs::LaserScan::ConstPtr& scan)
     catch (tf::TransformException& e)
     {
       ROS_WARN("Unable to determine orientation of laser: %s", e.what());
-      return NULL;
+      return false;
     }
 
     bool inverse = lasers_inverted_[scan->header.frame_id] = up.z() <= 0;
@@ -381,94 +551,101 @@ RelativeSlam::getLaser(const sensor_msgs::LaserScan::ConstPtr& scan)
       ROS_INFO("laser is mounted upside-down");
 
 
-    // Create a laser range finder device and copy in data from the first
-    // scan
-    sensor_name_.SetName(karto::String(scan->header.frame_id.c_str()));
-    karto::LaserRangeFinder* laser = 
-      karto::LaserRangeFinder::CreateLaserRangeFinder(karto::LaserRangeFinder_Custom, sensor_name_);
-    laser->SetOffsetPose(karto::Pose2(laser_pose.getOrigin().x(),
-              laser_pose.getOrigin().y(),
-              yaw));
-    laser->SetMinimumRange(scan->range_min);
-    laser->SetMaximumRange(scan->range_max);
-    laser->SetMinimumAngle(scan->angle_min);
-    laser->SetMaximumAngle(scan->angle_max);
-    laser->SetAngularResolution(scan->angle_increment);
-    // TODO: expose this, and many other parameters
-    //laser_->SetRangeThreshold(12.0);
-
-    // Store this laser device for later
-    lasers_[scan->header.frame_id] = laser;
-
-    // Register with the "Mapper"
-    scan_manager_->RegisterSensor(sensor_name_);
+    // Register a laser with the core, using the geometry of the first scan
+    core_->addLaser(scan->header.frame_id, karto::Pose2(laser_pose.getOrigin().x(), laser_pose.getOrigin().y(), yaw),
+                    scan->range_min, scan->range_max, scan->angle_min, scan->angle_max, scan->angle_increment);
   }
-  return lasers_[scan->header.frame_id];
+  return true;
 }
 
-bool
-RelativeSlam::getOdomPose(karto::Pose2& karto_pose, const ros::Time& t)
+void RelativeSlam::odomCallback(const nav_msgs::Odometry::ConstPtr& odom)
 {
-  // Get the robot's pose
-  tf::Stamped<tf::Pose> ident (tf::Transform(tf::createQuaternionFromRPY(0,0,0),
-                                           tf::Vector3(0,0,0)), t, base_frame_);
-  tf::Stamped<tf::Transform> odom_pose;
-  try
+  if(!odom->child_frame_id.empty() && odom->child_frame_id != base_frame_)
   {
-    tf_.transformPose(odom_frame_, ident, odom_pose);
+    ROS_WARN_ONCE("Odometry on %s is for %s, not %s; ignoring it",
+                  odom_sub_.getTopic().c_str(), odom->child_frame_id.c_str(), base_frame_.c_str());
+    return;
   }
-  catch(tf::TransformException e)
+  odom_buffer_->Add(OdometrySample(odom->header.stamp.toSec(), odom->pose.pose.position.x,
+                                   odom->pose.pose.position.y, tf::getYaw(odom->pose.pose.orientation)));
+}
+
+bool RelativeSlam::lookupOdom(const ros::Time& t, karto::Pose2& rOdomPose)
+{
+  if(!odom_buffer_)
   {
-    ROS_WARN("Failed to compute odom pose, skipping scan (%s)", e.what());
-    return false;
+    // Get the robot's pose
+    tf::Stamped<tf::Pose> ident (tf::Transform(tf::createQuaternionFromRPY(0,0,0),
+                                             tf::Vector3(0,0,0)), t, base_frame_);
+    tf::Stamped<tf::Transform> odom_pose;
+    try
+    {
+      tf_.transformPose(odom_frame_, ident, odom_pose);
+    }
+    catch(tf::TransformException e)
+    {
+      ROS_WARN("Failed to compute odom pose, skipping scan (%s)", e.what());
+      return false;
+    }
+    rOdomPose = karto::Pose2(odom_pose.getOrigin().x(), odom_pose.getOrigin().y(), tf::getYaw(odom_pose.getRotation()));
+    return true;
   }
-  double yaw = tf::getYaw(odom_pose.getRotation());
 
-  if(!got_initial_pose_)
+  // Scans usually arrive slightly ahead of the odometry of their time
+  OdometrySample sample;
+  OdometryBuffer::LookupResult result = odom_buffer_->Lookup(t.toSec(), sample);
+  ros::WallTime deadline = ros::WallTime::now() + ros::WallDuration(odom_timeout_);
+  while((result == OdometryBuffer::TooNew || result == OdometryBuffer::Empty) && ros::WallTime::now() < deadline)
   {
-    got_initial_pose_ = true;
-    initial_pose_ = karto::Pose2(odom_pose.getOrigin().x(),
-      odom_pose.getOrigin().y(), yaw);
-    initial_odom_ = odom_pose;
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+    result = odom_buffer_->Lookup(t.toSec(), sample);
   }
-
-  karto_pose = karto::Pose2(odom_pose.getOrigin().x(),
-                       odom_pose.getOrigin().y(),
-                       yaw) - initial_pose_;
-
-  double x = karto_pose.GetX();
-  double y = karto_pose.GetY();
-  double th = initial_pose_.GetHeading();
-
-  double x_dash = x*cos(th) + y*sin(th);
-  double y_dash = -x*sin(th)+y*cos(th);
-
-  karto_pose.SetX(x_dash);
-  karto_pose.SetY(y_dash);
-  karto_pose.SetHeading(yaw-th);
+  if(result != OdometryBuffer::Found)
+  {
+    ROS_WARN_THROTTLE(5.0, "No odometry at %.3f (%s), skipping scan", t.toSec(),
+                      result == OdometryBuffer::TooOld ? "older than the buffer" : "not received yet");
+    return false;
+  }
+  rOdomPose = karto::Pose2(sample.x, sample.y, sample.yaw);
   return true;
 }
 
 void RelativeSlam::publishGraphVisualization()
 {
-  visualization_msgs::MarkerArray marray;
-  solver_.publishGraphVisualization(marray); 
-  marker_publisher_.publish(marray);
-  //solver_.publishGlobalGraph();
+  // Nobody is listening; a new subscriber gets the whole graph, the others only changes
+  size_t subscribers = marker_publisher_.getNumSubscribers();
+  if(subscribers > marker_subscribers_)
+    visualizer_->Reset();
+  marker_subscribers_ = subscribers;
+  if(subscribers == 0)
+    return;
+
+  GraphSnapshotPtr graph = core_->getGraph();
+  if(!graph)
+    return;
+
+  // Published by pointer, so subscribers in the same process get it uncopied
+  boost::shared_ptr<visualization_msgs::MarkerArray> marray = boost::make_shared<visualization_msgs::MarkerArray>();
+  visualizer_->Update(*graph, *marray);
+  if(!marray->markers.empty())
+    marker_publisher_.publish(marray);
 }
 
 void RelativeSlam::laserCallback(const sensor_msgs::LaserScan::ConstPtr& scan)
 {
   laser_count_++;
-  if ((laser_count_ % throttle_scans_) != 0)
+  if ((laser_count_ % core_->getAdmissionLimits()->throttle_scans) != 0)
     return;
 
-  static ros::Time last_map_update(0,0);
+  // Matching happens on the front-end stage, not in the ROS callback
+  if(!frontend_stage_->Push(scan))
+    ROS_DEBUG("Front-end is falling behind, dropped oldest queued scan");
+}
 
+void RelativeSlam::frontendStep(const sensor_msgs::LaserScan::ConstPtr& scan, double wait)
+{
   // Check whether we know about this laser yet
-  karto::LaserRangeFinder* laser = getLaser(scan);
-
-  if(!laser)
+  if(!getLaser(scan))
   {
     ROS_WARN("Failed to create laser device for %s; discarding scan",
        scan->header.frame_id.c_str());
@@ -476,7 +653,17 @@ void RelativeSlam::laserCallback(const sensor_msgs::LaserScan::ConstPtr& scan)
   }
 
   karto::Pose2 odom_pose;
-  if(addScan(laser, scan, odom_pose))
+  if(!lookupOdom(scan->header.stamp, odom_pose))
+    return;
+
+  // The core wants the ranges counterclockwise
+  std::vector<kt_double> readings;
+  if (lasers_inverted_[scan->header.frame_id])
+    readings.assign(scan->ranges.rbegin(), scan->ranges.rend());
+  else
+    readings.assign(scan->ranges.begin(), scan->ranges.end());
+
+  if(core_->addScan(scan->header.frame_id, readings, odom_pose, scan->header.stamp.toSec()))
   {
     ROS_INFO("added scan at pose: %.3f %.3f %.3f", 
               odom_pose.GetX(),
@@ -485,995 +672,363 @@ void RelativeSlam::laserCallback(const sensor_msgs::LaserScan::ConstPtr& scan)
 
     //CorrectPoses();
     if(!got_map_ || 
-       (scan->header.stamp - last_map_update) > map_update_interval_)
+       (scan->header.stamp - last_map_update_) > map_update_interval_)
     {
-      if(updateMap())
-      {
-        last_map_update = scan->header.stamp;
-        got_map_ = true;
-        ROS_DEBUG("Updated the map");
-      }
+      // Hand off to the map stage; a large rebuild must not delay the next scan
+      map_stage_->Push(scan->header.stamp);
+      last_map_update_ = scan->header.stamp;
     }
-  }
-}
-
-bool RelativeSlam::hasMovedEnough(karto::LocalizedRangeScan* pScan, karto::LocalizedRangeScan* pLastScan) const
-{
-    // test if first scan
-    if (pLastScan == NULL)
+    if(local_map_ && (scan->header.stamp - last_local_map_update_) > local_map_update_interval_)
     {
-      return true;
+      local_map_stage_->Push(scan->header.stamp);
+      last_local_map_update_ = scan->header.stamp;
     }
-
-    karto::Pose2 lastScannerPose = pLastScan->GetSensorAt(pLastScan->GetOdometricPose());
-    karto::Pose2 scannerPose = pScan->GetSensorAt(pScan->GetOdometricPose());
-
-    // test if we have turned enough
-    kt_double deltaHeading = karto::math::NormalizeAngle(scannerPose.GetHeading() - lastScannerPose.GetHeading());
-    if (fabs(deltaHeading) >= minimum_travel_heading_)
-    {
-      return true;
-    }
-
-    // test if we have moved enough
-    kt_double squaredTravelDistance = lastScannerPose.GetPosition().SquaredDistance(scannerPose.GetPosition());
-    if (squaredTravelDistance >= karto::math::Square(minimum_travel_distance_) - karto::KT_TOLERANCE)
-    {
-      return true;
-    }
-
-    return false;
-}
-
-bool RelativeSlam::process(karto::LocalizedRangeScan* pScan)
-{
-
-  karto::LocalizedObject* pLocalizedObject = dynamic_cast<karto::LocalizedObject*>(pScan);
-  if (pScan != NULL)
-  {
-    karto::LaserRangeFinder* pLaserRangeFinder = pScan->GetLaserRangeFinder();
-    
-    // validate scan
-    if (pLaserRangeFinder == NULL)
-    {
-      return false;
-    }
-
-    pLaserRangeFinder->Validate(pScan);
-
-    // ensures sensor has been registered with mapper--does nothing if the sensor has already been registered
-    scan_manager_->RegisterSensor(pLocalizedObject->GetSensorIdentifier());
-
-    
-    boost::mutex::scoped_lock(scan_manager_mutex_);
-    karto::LocalizedRangeScan* pLastScan = dynamic_cast<karto::LocalizedRangeScan *>(scan_manager_->GetLastScan(pLocalizedObject->GetSensorIdentifier()));
-    
-    // update scans corrected pose based on last correction
-    if (pLastScan != NULL)
-    {
-      karto::Transform lastTransform(pLastScan->GetOdometricPose(), pLastScan->GetCorrectedPose());
-      pScan->SetCorrectedPose(lastTransform.TransformPose(pLocalizedObject->GetOdometricPose()));
-      
-      // test if scan is outside minimum boundary or if heading is larger then minimum heading
-      if (!hasMovedEnough(pScan, pLastScan))
-      {
-        return false;
-      }
-
-      karto::Matrix3 covariance;
-      covariance.SetToIdentity();
-
-      // Correct scan
-      karto::Pose2 bestPose;
-      boost::mutex::scoped_lock lock(scan_matcher_mutex_);
-      sequential_scan_matcher_->MatchScan(pScan,
-                               scan_manager_->GetRunningScans(pScan->GetSensorIdentifier()),
-                                           bestPose,
-                                           covariance);
-      pScan->SetSensorPose(bestPose);
-
-      // Hook called before loop closing 
-      //karto::ScanMatched(pScan); 
-    }
-
-    // Add scan to buffer and assign id
-    //
-    /*if(loop_closed_)
-    {
-      CorrectPoses();
-      //solver_.setLoopClosed();
-      loop_closed_ = false;
-    }*/
-    int id = solver_.AddNode(pScan->GetCorrectedPose());
-    pScan->SetUniqueId(id);
-    scan_manager_->AddLocalizedObject(pLocalizedObject);
-    
-    // Add edges
-    if(pLastScan != NULL)
-    {
-      addEdges(pScan); 
-    
-      loop_closure_candidate_ = pScan;
-      //TryCloseLoop();
-      scan_manager_->AddRunningScan(pScan);
-  
-      // TO-DO: Loop closing attempts here
-
-      //List<Identifier> sensorNames = scan_manager_->GetSensorNames();
-      //karto_const_forEach(List<Identifier>, &sensorNames)
-      //{
-      //} 
-    }
-    else
-      scan_manager_->AddRunningScan(pScan);
-    
-    if(pScan == NULL)
-    {
-      ROS_ERROR("SCAN IS NULL!!!!!!");
-    }
-    else
-    {
-      scan_manager_->SetLastScan(pScan);
-    }
-
-    //karto::ScanMatchingEnd(pScan);
-    return true;
   }
-  return false;
 }
 
-bool RelativeSlam::addEdges(karto::LocalizedObject *pObject)
+void RelativeSlam::mapStep(const ros::Time& stamp, double wait)
 {
-  // loose "spring"
-  Matrix3 covariance;
-  covariance(0, 0) = MAX_VARIANCE;
-  covariance(1, 1) = MAX_VARIANCE;
-  covariance(2, 2) = MAX_VARIANCE;
-    
-  karto::LocalizedLaserScanPtr pScan = dynamic_cast<karto::LocalizedLaserScan*>(pObject);
-  if (pScan != NULL)
-  {      
-    AddEdges(pScan, covariance);
-  }
-  else
+  if(updateMap())
   {
-    //MapperSensorManager* pSensorManager = m_pOpenMapper->m_pMapperSensorManager;      
-    const Identifier& rSensorName = pObject->GetSensorIdentifier();
-      
-    boost::mutex::scoped_lock(scan_manager_mutex_);
-    LocalizedLaserScan* pLastScan = scan_manager_->GetLastScan(rSensorName);
-    if (pLastScan != NULL)
-    {
-      LinkObjects(pLastScan, pObject, pObject->GetCorrectedPose(), covariance);
-    }
+    got_map_ = true;
+    ROS_DEBUG("Updated the map for the scan at %.3f", stamp.toSec());
   }
 }
 
-void RelativeSlam::LinkObjects(LocalizedObject* pFromObject, LocalizedObject* pToObject, const Pose2& rMean, const Matrix3& rCovariance)
+void RelativeSlam::localMapStep(const ros::Time& stamp, double wait)
 {
-    //kt_bool isNewEdge = true;
-    //Edge<LocalizedObjectPtr>* pEdge = AddEdge(pFromObject, pToObject, isNewEdge);
-    
-    // only attach link information if the edge is new
-    //if (isNewEdge == true)
-    //{
-
-    // Calculate the difference
-    LocalizedLaserScanPtr pScan = dynamic_cast<LocalizedLaserScan*>(pFromObject);
-    Pose2 pose1, pose2;
-    if (pScan != NULL)
-    {
-        pose1 = pScan->GetSensorPose();
-    }
-    else
-    {
-        pose1 = pScan->GetCorrectedPose();
-    }
-
-    // Do the update
-    // transform second pose into the coordinate system of the first pose
-    Transform transform(pose1, Pose2());
-    Pose2 poseDiff = transform.TransformPose(rMean);
-
-    // transform covariance into reference of first pose
-    Matrix3 rotationMatrix;
-    rotationMatrix.FromAxisAngle(0, 0, 1, -pose1.GetHeading());
-    
-    Matrix3 covariance = rotationMatrix * rCovariance * rotationMatrix.Transpose();
-    ROS_INFO("Adding constraint:  %f, %f, %f", poseDiff.GetX(), poseDiff.GetY(), poseDiff.GetHeading()); 
-    solver_.AddConstraint(pFromObject->GetUniqueId(), pToObject->GetUniqueId(), poseDiff, covariance);
-}
-
-bool RelativeSlam::AddEdges(LocalizedLaserScanPtr pScan, const Matrix3& rCovariance)
-{
-    const Identifier& rSensorName = pScan->GetSensorIdentifier();
-    
-    Pose2List means;
-    List<Matrix3> covariances;
-    
-    boost::mutex::scoped_lock(scan_manager_mutex_);
-    LocalizedLaserScanPtr pLastScan = scan_manager_->GetLastScan(rSensorName);
-    if (pLastScan == NULL)
-    {
-      // first scan (link to first scan of other robots)
-
-      boost::mutex::scoped_lock(scan_manager_mutex_);
-      assert(scan_manager_->GetScans(rSensorName).Size() == 1);
-      
-      List<Identifier> sensorNames = scan_manager_->GetSensorNames();
-      karto_const_forEach(List<Identifier>, &sensorNames)
-      {
-        const Identifier& rCandidateSensorName = *iter;
-        
-        // skip if candidate sensor is the same or other sensor has no scans
-        if ((rCandidateSensorName == rSensorName) || (scan_manager_->GetScans(rCandidateSensorName).IsEmpty()))
-        {
-          continue;
-        }
-        
-        Pose2 bestPose;
-        Matrix3 covariance;
-        boost::mutex::scoped_lock lock(scan_matcher_mutex_);
-        kt_double response = sequential_scan_matcher_->MatchScan(pScan, scan_manager_->GetScans(rCandidateSensorName), bestPose, covariance);
-        LinkObjects(scan_manager_->GetScans(rCandidateSensorName)[0], pScan, bestPose, covariance);
-        
-        // only add to means and covariances if response was high "enough"
-        //if (response > m_pOpenMapper->m_pLinkMatchMinimumResponseFine->GetValue())
-        if (response > link_match_min_response_fine_)
-        {
-          means.Add(bestPose);
-          covariances.Add(covariance);
-        }
-      }
-    }
-    else
-    {
-      // link to previous scan
-      LinkObjects(pLastScan, pScan, pScan->GetSensorPose(), rCovariance);
-
-      // link to running scans
-      Pose2 scanPose = pScan->GetSensorPose();
-      means.Add(scanPose);
-      covariances.Add(rCovariance);
-      LinkChainToScan(scan_manager_->GetRunningScans(rSensorName), pScan, scanPose, rCovariance);
-    }
-    
-    // link to other near chains (chains that include new scan are invalid)
-    LinkNearChains(pScan, means, covariances);
-    
-    if (!means.IsEmpty())
-    {
-      pScan->SetSensorPose(ComputeWeightedMean(means, covariances));
-    }
+  updateLocalMap();
 }
 
-void RelativeSlam::LinkChainToScan(const LocalizedLaserScanList& rChain, LocalizedLaserScanPtr pScan,
-                                  const Pose2& rMean, const Matrix3& rCovariance)
+// Moves rays computed for a scan whose base was at rFrom so that its base is at rTo
+static void TransformRays(ScanRays& rRays, const Pose2& rFrom, const Pose2& rTo)
 {
-  Pose2 pose = pScan->GetReferencePose(use_scan_barycenter_);
-
-  LocalizedLaserScanPtr pClosestScan = GetClosestScanToPose(rChain, pose);
-  assert(pClosestScan != NULL);
-
-  Pose2 closestScanPose = pClosestScan->GetReferencePose(use_scan_barycenter_);
-
-  kt_double squaredDistance = pose.GetPosition().SquaredDistance(closestScanPose.GetPosition());
-  if (squaredDistance < math::Square(link_scan_max_distance_) + KT_TOLERANCE)
+  kt_double angle = rTo.GetHeading() - rFrom.GetHeading();
+  kt_double c = cos(angle);
+  kt_double s = sin(angle);
+  kt_double tx = rTo.GetX() - (c * rFrom.GetX() - s * rFrom.GetY());
+  kt_double ty = rTo.GetY() - (s * rFrom.GetX() + c * rFrom.GetY());
+
+  kt_double x = rRays.x;
+  rRays.x = c * x - s * rRays.y + tx;
+  rRays.y = s * x + c * rRays.y + ty;
+  rRays.heading = math::NormalizeAngle(rRays.heading + angle);
+  for (size_t i = 0; i < rRays.end_x.size(); i++)
   {
-    ROS_INFO("LinkChainToScan calling LinkObjects on %d to %d", pClosestScan->GetUniqueId(), pScan->GetUniqueId());
-    if(pClosestScan->GetUniqueId() < 0)
-    {
-      ROS_ERROR("Invalid scan id!!!!");
-      return;
-    }
-    LinkObjects(pClosestScan, pScan, rMean, rCovariance);
+    x = rRays.end_x[i];
+    rRays.end_x[i] = c * x - s * rRays.end_y[i] + tx;
+    rRays.end_y[i] = s * x + c * rRays.end_y[i] + ty;
   }
 }
 
-void RelativeSlam::LinkNearChains(LocalizedLaserScanPtr pScan, Pose2List& rMeans, List<Matrix3>& rCovariances)
+bool RelativeSlam::updateLocalMap()
 {
-    const List<LocalizedLaserScanList> nearChains = FindNearChains(pScan);
-
-    kt_bool gotTbb = false;
-    if (is_multithreaded_)
-    {
-#ifdef USE_TBB
-      gotTbb = true;
-      kt_bool* pWasChainLinked = new kt_bool[nearChains.Size()];
-
-      Pose2List means;
-      means.Resize(nearChains.Size());
-
-      List<Matrix3> covariances;
-      covariances.Resize(nearChains.Size());
-
-      int grainSize = 100;
-      Parallel_LinkNearChains myTask(m_pOpenMapper, pScan, &nearChains, pWasChainLinked, &means, &covariances,
-        loop_match_min_chain_size_,
-        link_match_min_response_fine_);
-      tbb::parallel_for(tbb::blocked_range<kt_int32s>(0, static_cast<kt_int32s>(nearChains.Size()), grainSize), myTask);
-
-      for (kt_int32u i = 0; i < nearChains.Size(); i++)
-      {
-        if (pWasChainLinked[i] == true)
-        {
-          rMeans.Add(means[i]);
-          rCovariances.Add(covariances[i]);
-          LinkChainToScan(nearChains[i], pScan, means[i], covariances[i]);
-        }
-      }
+  GraphSnapshotPtr graph = core_->getGraph();
+  if (!graph || graph->keyframes.empty())
+    return false;
 
-      delete [] pWasChainLinked;
-#endif
-    }
+  // The relative map frame sits at the newest keyframe, so every nearby
+  // keyframe's rays are moved by its pose relative to that one
+  const KeyframeRecord& root = graph->keyframes.back();
+  std::vector<std::pair<int, int> > linked;
+  graph->FindLinked(root.id, local_map_distance_, linked);
 
-    if (gotTbb == false)
-    {
-      karto_const_forEach(List<LocalizedLaserScanList>, &nearChains)
-      {
-#ifdef KARTO_DEBUG2
-        std::cout << "Near chain for " << pScan->GetStateId() << ": [ ";
-        karto_const_forEachAs(LocalizedLaserScanList, iter, iter2)
-        {
-          std::cout << (*iter2)->GetStateId() << " ";
-        }
-        std::cout << "]: ";
-#endif
+  Transform toRoot(root.corrected_pose, Pose2());
+  std::vector<std::pair<int, ScanRays> > rays;
+  for (size_t i = 0; i < linked.size(); i++)
+  {
+    const KeyframeRecord* pKeyframe = graph->Find(linked[i].first);
+    rays.push_back(std::make_pair(pKeyframe->id, core_->computeScanRays(pKeyframe->scan)));
+    TransformRays(rays.back().second, pKeyframe->corrected_pose, toRoot.TransformPose(pKeyframe->corrected_pose));
+  }
 
-        if (iter->Size() < loop_match_min_chain_size_)
-        {
-#ifdef KARTO_DEBUG2
-          std::cout << iter->Size() << "(< " << loop_match_min_chain_size_ << ") REJECTED" << std::endl;
-#endif
-          continue;
-        }
+  local_grid_.Clear();
+  local_grid_.AddScans(rays, NULL);
+  if (local_grid_.IsEmpty())
+    return false;
 
-        Pose2 mean;
-        Matrix3 covariance;
-        // match scan against "near" chain
-        boost::mutex::scoped_lock lock(scan_matcher_mutex_);
-        kt_double response = sequential_scan_matcher_->MatchScan(pScan, *iter, mean, covariance, false);
-        if (response > link_match_min_response_fine_ - KT_TOLERANCE)
-        {
-#ifdef KARTO_DEBUG2
-          std::cout << " ACCEPTED" << std::endl;
-#endif
-          rMeans.Add(mean);
-          rCovariances.Add(covariance);
-          LinkChainToScan(*iter, pScan, mean, covariance);
-        }
-        else
-        {
-#ifdef KARTO_DEBUG2
-          std::cout << response << "(< " << link_match_min_response_fine_ << ") REJECTED" << std::endl;
-#endif        
-        }
-      }
-    }
+  boost::shared_ptr<nav_msgs::OccupancyGrid> mapPtr = boost::make_shared<nav_msgs::OccupancyGrid>();
+  nav_msgs::OccupancyGrid& map = *mapPtr;
+  map.header.stamp = ros::Time::now();
+  map.header.frame_id = relative_map_frame_;
+  map.info.map_load_time = map.header.stamp;
+  map.info.resolution = local_grid_.Resolution();
+  map.info.width = local_grid_.Width();
+  map.info.height = local_grid_.Height();
+  map.info.origin.position.x = local_grid_.OriginX();
+  map.info.origin.position.y = local_grid_.OriginY();
+  map.info.origin.orientation.w = 1.0;
+  map.data.assign(map.info.width * map.info.height, -1);
+
+  std::vector<IncrementalOccupancyGrid::TileIndex> tiles;
+  local_grid_.GetTiles(tiles);
+  const int tileSize = IncrementalOccupancyGrid::TileSize;
+  for (size_t i = 0; i < tiles.size(); i++)
+  {
+    const unsigned char* states = local_grid_.TileStates(tiles[i]);
+    int x0 = tiles[i].first * tileSize - local_grid_.OriginCellX();
+    int y0 = tiles[i].second * tileSize - local_grid_.OriginCellY();
+    for (int y = 0; y < tileSize; y++)
+      ConvertCellStates(states + y * tileSize, tileSize, &map.data[MAP_IDX(map.info.width, x0, y0 + y)]);
   }
 
-
+  local_map_pub_.publish(mapPtr);
+  ROS_DEBUG("Published local map of %d keyframes around %d", (int)rays.size(), root.id);
+  return true;
+}
 
 bool RelativeSlam::updateMap()
 {
-  boost::mutex::scoped_lock(map_mutex_);
-
-  boost::mutex::scoped_lock(scan_manager_mutex_);
-  karto::OccupancyGrid* occ_grid = 
-          karto::OccupancyGrid::CreateFromScans(scan_manager_->GetScans(sensor_name_), resolution_);
-
-  if(!occ_grid)
-  {
-    ROS_INFO("No occupancy grid");
+  // The core raycasts the keyframes; only the changed tiles are exported
+  std::vector<IncrementalOccupancyGrid::TileIndex> tiles;
+  if(!core_->updateMap(tiles))
     return false;
-  }
-
-  ROS_INFO("Got occupancy grid");
-  
-  if(!got_map_) {
-    map_.map.info.resolution = resolution_;
-    map_.map.info.origin.position.x = 0.0;
-    map_.map.info.origin.position.y = 0.0;
-    map_.map.info.origin.position.z = 0.0;
-    map_.map.info.origin.orientation.x = 0.0;
-    map_.map.info.origin.orientation.y = 0.0;
-    map_.map.info.origin.orientation.z = 0.0;
-    map_.map.info.origin.orientation.w = 1.0;
-  } 
 
   // Translate to ROS format
-  kt_int32s width = occ_grid->GetWidth();
-  kt_int32s height = occ_grid->GetHeight();
-  karto::Vector2<kt_double> offset = occ_grid->GetCoordinateConverter()->GetOffset();
-
-  ROS_INFO("Offset is %f, %f", offset.GetX(), offset.GetY());
-  if(map_.map.info.width != (unsigned int) width || 
-     map_.map.info.height != (unsigned int) height ||
-     map_.map.info.origin.position.x != offset.GetX() ||
-     map_.map.info.origin.position.y != offset.GetY())
+  kt_int32s width = core_->getGrid().Width();
+  kt_int32s height = core_->getGrid().Height();
+  karto::Vector2<kt_double> offset(core_->getGrid().OriginX(), core_->getGrid().OriginY());
+
+  boost::shared_ptr<MapResponse> map = takeMapBuffer();
+  std::vector<IncrementalOccupancyGrid::TileIndex> exported = tiles;
+  exported.insert(exported.end(), map_back_stale_.begin(), map_back_stale_.end());
+
+  if(map->map.info.width != (unsigned int) width || 
+     map->map.info.height != (unsigned int) height ||
+     map->map.info.origin.position.x != offset.GetX() ||
+     map->map.info.origin.position.y != offset.GetY())
   {
-    map_.map.info.origin.position.x = offset.GetX(); 
-    map_.map.info.origin.position.y = offset.GetY();
-    map_.map.info.width = width;
-    map_.map.info.height = height;
-    map_.map.data.resize(map_.map.info.width * map_.map.info.height);
+    map->map.info.origin.position.x = offset.GetX(); 
+    map->map.info.origin.position.y = offset.GetY();
+    map->map.info.width = width;
+    map->map.info.height = height;
+
+    // Every tile moved within the buffer, so assemble the whole map again
+    map->map.data.assign(map->map.info.width * map->map.info.height, -1);
+    exported.clear();
+    core_->getGrid().GetTiles(exported);
   }
 
-  for (kt_int32s y=0; y<height; y++)
-  {
-    for (kt_int32s x=0; x<width; x++) 
-    {
-      // Getting the value at position x,y
-      kt_int8u value = occ_grid->GetValue(karto::Vector2<kt_int32s>(x, y));
-
-      switch (value)
-      {
-        case karto::GridStates_Unknown:
-          map_.map.data[MAP_IDX(map_.map.info.width, x, y)] = -1;
-          break;
-        case karto::GridStates_Occupied:
-          map_.map.data[MAP_IDX(map_.map.info.width, x, y)] = 100;
-          break;
-        case karto::GridStates_Free:
-          map_.map.data[MAP_IDX(map_.map.info.width, x, y)] = 0;
-          break;
-        default:
-          ROS_WARN("Encountered unknown cell value at %d, %d", x, y);
-          break;
-      }
-    }
-  }
+  for (size_t i = 0; i < exported.size(); i++)
+    exportTile(*map, exported[i]);
   
   // Set the header information on the map
-  map_.map.header.stamp = ros::Time::now();
-  map_.map.header.frame_id = global_map_frame_;
-
-  sst_.publish(map_.map);
-  sstm_.publish(map_.map.info);
+  map->map.header.stamp = ros::Time::now();
+  map->map.header.frame_id = global_map_frame_;
 
-  //delete occ_grid;
+  if(map_pyramid_->Update(core_->getGrid(), tiles))
+    publishMapPyramid(map->map.header);
 
-  return true;
-}
+  bool publishFull = !map_front_ || (map->map.header.stamp - last_full_map_publish_) > map_full_publish_interval_;
+  if(map_front_ && (map_front_->map.info.width != map->map.info.width ||
+                    map_front_->map.info.height != map->map.info.height ||
+                    map_front_->map.info.origin.position.x != map->map.info.origin.position.x ||
+                    map_front_->map.info.origin.position.y != map->map.info.origin.position.y))
+  {
+    ROS_INFO("Map bounds changed, offset is %f, %f", offset.GetX(), offset.GetY());
+    publishFull = true;
+  }
 
-bool RelativeSlam::addScan(karto::LaserRangeFinder* laser,
-       const sensor_msgs::LaserScan::ConstPtr& scan, 
-                   karto::Pose2& karto_pose)
-{
-  if(!getOdomPose(karto_pose, scan->header.stamp))
-     return false;
-  
-  // Create a vector of doubles for karto
-  std::vector<kt_double> readings;
+  // Publish the snapshot; the old one becomes the next back buffer and
+  // lacks only the tiles changed in this update
+  boost::atomic_store(&map_snapshot_, boost::shared_ptr<const MapResponse>(map));
+  map_back_ = map_front_;
+  map_front_ = map;
+  map_back_stale_.swap(tiles);
 
-  if (lasers_inverted_[scan->header.frame_id]) {
-    for(std::vector<float>::const_reverse_iterator it = scan->ranges.rbegin();
-      it != scan->ranges.rend();
-      ++it)
-    {
-      readings.push_back(*it);
-    }
-  } else {
-    for(std::vector<float>::const_iterator it = scan->ranges.begin();
-      it != scan->ranges.end();
-      ++it)
-    {
-      readings.push_back(*it);
-    }
+  if(publishFull)
+  {
+    // Shares the snapshot with subscribers in the same process; the buffer
+    // is only reused once nobody holds it any more
+    sst_.publish(boost::shared_ptr<const nav_msgs::OccupancyGrid>(map, &map->map));
+    sstm_.publish(map->map.info);
+    last_full_map_publish_ = map->map.header.stamp;
   }
-  
-  // create localized range scan
-  karto::LocalizedRangeScan* range_scan = 
-    new karto::LocalizedRangeScan(scan->header.frame_id.c_str(), readings);
-  range_scan->SetOdometricPose(karto_pose);
-  range_scan->SetCorrectedPose(karto_pose);
-
-  // Add the localized range scan to the mapper
-  bool processed;
-  if((processed = process(range_scan)))
+  else
   {
-    //std::cout << "Pose: " << range_scan->GetOdometricPose() << " Corrected Pose: " << range_scan->GetCorrectedPose() << std::endl;
-    
-    karto::Pose2 corrected_pose = range_scan->GetCorrectedPose();
+    for (size_t i = 0; i < map_back_stale_.size(); i++)
+      sstu_.publish(makeTileUpdate(*map, map_back_stale_[i]));
+    ROS_DEBUG("Published %d changed map tiles", (int)map_back_stale_.size());
+  }
 
-    // Compute the map->odom transform
-  /*  tf::Stamped<tf::Pose> odom_to_map;
-    try
-    {
-      tf_.transformPose(odom_frame_,tf::Stamped<tf::Pose> (tf::Transform(tf::createQuaternionFromRPY(0, 0, corrected_pose.GetHeading()),
-                                                                    tf::Vector3(corrected_pose.GetX(), corrected_pose.GetY(), 0.0)),
-                                                                    scan->header.stamp, base_frame_), odom_to_map);
-    }
-    catch(tf::TransformException e)
+  if(publish_compressed_map_)
+  {
+    // Only the tiles of this update can differ from the previous message
+    relative_slam::CompressedMap compressed;
+    std::vector<MapEncoder::TileIndex> changed;
+    for (size_t i = 0; i < map_back_stale_.size(); i++)
     {
-      ROS_ERROR("Transform from base_link to odom failed\n");
-      odom_to_map.setIdentity();
+      changed.push_back(MapEncoder::TileIndex(map_back_stale_[i].first - core_->getGrid().OriginCellX() / IncrementalOccupancyGrid::TileSize,
+                                              map_back_stale_[i].second - core_->getGrid().OriginCellY() / IncrementalOccupancyGrid::TileSize));
     }
-*/
-    LocalizedObject* pObject = scan_manager_->GetLocalizedObject(0);
-    LocalizedRangeScan* pScan0 = dynamic_cast<LocalizedRangeScan *>(pObject);
-    karto::Pose2 corrected_p0 = pScan0->GetCorrectedPose();
+    map_encoder_->Encode(map->map, changed, compressed);
+    smc_.publish(compressed);
 
-    // Compute the global_map->odom transform
-    tf::Stamped<tf::Pose> odom_to_global_map;
-    try
+    if(compressed_map_loopback_)
     {
-      tf_.transformPose(odom_frame_,tf::Stamped<tf::Pose> (tf::Transform(tf::createQuaternionFromRPY(0, 0, corrected_pose.GetHeading()),
-                                                                    tf::Vector3(corrected_pose.GetX(), corrected_pose.GetY(), 0.0)).inverse(),
-                                                                    scan->header.stamp, base_frame_), odom_to_global_map);
-    }
-    catch(tf::TransformException e)
-    {
-      ROS_ERROR("Transform from base_link to odom failed\n");
-      odom_to_global_map.setIdentity();
+      if(!map_loopback_decoder_.Apply(compressed) || map_loopback_decoder_.Map().data != map->map.data)
+      {
+        ROS_ERROR("Compressed map %u does not decode to the published map", compressed.seq);
+        map_encoder_->ForceKeyframe();
+      }
     }
-
-    map_to_odom_mutex_.lock();
-    global_map_to_odom_ = tf::Transform(tf::Quaternion( odom_to_global_map.getRotation() ),
-                                 tf::Point(      odom_to_global_map.getOrigin() ) ).inverse();
-    //relative_map_to_odom_ = tf::Transform( tf::createQuaternionFromRPY(0,0,corrected_pose.GetHeading()), tf::Vector3(corrected_pose.GetX(), corrected_pose.GetY(), 0)).inverse();
-    global_map_to_relative_map_ = tf::Transform( tf::createQuaternionFromRPY(0,0,corrected_pose.GetHeading()), tf::Vector3(corrected_pose.GetX(), corrected_pose.GetY(), 0));
-    map_to_odom_mutex_.unlock();
-
-
-    // Add the localized range scan to the dataset (for memory management)
-    //dataset_->Add(range_scan);
   }
-  //else
-   // delete range_scan;
 
-  return processed;
+  return true;
 }
 
-bool RelativeSlam::mapCallback(nav_msgs::GetMap::Request  &req,
-                       nav_msgs::GetMap::Response &res)
+void RelativeSlam::publishMapPyramid(const std_msgs::Header& rHeader)
 {
-  boost::mutex::scoped_lock(map_mutex_);
-  if(got_map_ && map_.map.info.width && map_.map.info.height)
+  for(size_t i = 0; i < map_pyramid_->NumLevels(); i++)
   {
-    res = map_;
-    return true;
+    nav_msgs::OccupancyGrid level;
+    level.header = rHeader;
+    level.info.map_load_time = rHeader.stamp;
+    level.info.resolution = core_->getGrid().Resolution() * map_pyramid_->Factor(i);
+    level.info.width = map_pyramid_->Width(i);
+    level.info.height = map_pyramid_->Height(i);
+    level.info.origin.position.x = core_->getGrid().OriginX();
+    level.info.origin.position.y = core_->getGrid().OriginY();
+    level.info.origin.orientation.w = 1.0;
+    level.data.assign(map_pyramid_->Data(i).begin(), map_pyramid_->Data(i).end());
+    map_pyramid_pubs_[i].publish(level);
   }
-  else
-    return false;
 }
 
-Pose2 RelativeSlam::ComputeWeightedMean(const Pose2List& rMeans, const List<Matrix3>& rCovariances) const
+boost::shared_ptr<RelativeSlam::MapResponse> RelativeSlam::takeMapBuffer()
 {
-  assert(rMeans.Size() == rCovariances.Size());
-  
-  // compute sum of inverses and create inverse list
-  List<Matrix3> inverses;
-  inverses.EnsureCapacity(rCovariances.Size());
-  
-  Matrix3 sumOfInverses;
-  karto_const_forEach(List<Matrix3>, &rCovariances)
-  {
-    Matrix3 inverse = iter->Inverse();
-    inverses.Add(inverse);
-    
-    sumOfInverses += inverse;
-  }
-  Matrix3 inverseOfSumOfInverses = sumOfInverses.Inverse();
-  
-  // compute weighted mean
-  Pose2 accumulatedPose;
-  kt_double thetaX = 0.0;
-  kt_double thetaY = 0.0;
-  
-  Pose2List::ConstIterator meansIter = rMeans.GetConstIterator();
-  karto_const_forEach(List<Matrix3>, &inverses)
-  {
-    Pose2 pose = *meansIter;
-    kt_double angle = pose.GetHeading();
-    thetaX += cos(angle);
-    thetaY += sin(angle);
-    
-    Matrix3 weight = inverseOfSumOfInverses * (*iter);
-    accumulatedPose += weight * pose;
-    
-    meansIter++;
-  }
-  
-  thetaX /= rMeans.Size();
-  thetaY /= rMeans.Size();
-  accumulatedPose.SetHeading(atan2(thetaY, thetaX));
-  
-  return accumulatedPose;
+  boost::shared_ptr<MapResponse> map;
+  map.swap(map_back_);
+
+  // Reuse the previous snapshot only if no service call is still copying it
+  // and no subscriber in this process still holds the published map;
+  // the snapshot pointer itself no longer refers to it at this point
+  if(map && map.unique())
+    return map;
+
+  map_back_stale_.clear();
+  if(map_front_)
+    return boost::make_shared<MapResponse>(*map_front_);
+
+  map = boost::make_shared<MapResponse>();
+  map->map.info.resolution = resolution_;
+  map->map.info.origin.position.x = 0.0;
+  map->map.info.origin.position.y = 0.0;
+  map->map.info.origin.position.z = 0.0;
+  map->map.info.origin.orientation.x = 0.0;
+  map->map.info.origin.orientation.y = 0.0;
+  map->map.info.origin.orientation.z = 0.0;
+  map->map.info.origin.orientation.w = 1.0;
+  return map;
 }
 
-List<LocalizedLaserScanList> RelativeSlam::FindNearChains(LocalizedLaserScanPtr pScan)
+void RelativeSlam::exportTile(MapResponse& rMap, const IncrementalOccupancyGrid::TileIndex& rIndex) const
 {
-  List<LocalizedLaserScanList> nearChains;
-  
-  Pose2 scanPose = pScan->GetReferencePose(use_scan_barycenter_);
-  
-  // to keep track of which scans have been added to a chain
-  LocalizedLaserScanList processed;
-  
-  const LocalizedLaserScanList nearLinkedScans = FindNearLinkedScans(pScan, link_scan_max_distance_);
-  karto_const_forEach(LocalizedLaserScanList, &nearLinkedScans)
+  const unsigned char* states = core_->getGrid().TileStates(rIndex);
+  if(states == NULL)
+    return;
+
+  const int tileSize = IncrementalOccupancyGrid::TileSize;
+  int x0 = rIndex.first * tileSize - core_->getGrid().OriginCellX();
+  int y0 = rIndex.second * tileSize - core_->getGrid().OriginCellY();
+
+  // Tile rows are contiguous in the map buffer, so convert them in bulk
+  for (kt_int32s y=0; y<tileSize; y++)
   {
-    LocalizedLaserScanPtr pNearScan = *iter;
-    
-    if (pNearScan == pScan)
-    {
-      continue;
-    }
-    
-    // scan has already been processed, skip
-    if (processed.Contains(pNearScan) == true)
-    {
-      continue;
-    }
-    
-#ifdef KARTO_DEBUG2
-    std::cout << "BUILDING CHAIN: Scan " << pScan->GetStateId() << " is near " << pNearScan->GetStateId() << " (< " << link_scan_max_distance_ << ")" << std::endl;
-#endif
-    
-    processed.Add(pNearScan);
-    
-    // build up chain
-    kt_bool isValidChain = true;
-    LocalizedLaserScanList chain;
-     
-    boost::mutex::scoped_lock(scan_manager_mutex_);
-    LocalizedLaserScanList scans = scan_manager_->GetScans(pNearScan->GetSensorIdentifier());
-    
-    kt_int32s nearScanIndex = scan_manager_->GetScanIndex(pNearScan);
-    assert(nearScanIndex >= 0);
-    
-    // add scans before current scan being processed
-    for (kt_int32s candidateScanIndex = nearScanIndex - 1; candidateScanIndex >= 0; candidateScanIndex--)
-    {
-      LocalizedLaserScanPtr pCandidateScan = scans[candidateScanIndex];
-      
-      // chain is invalid--contains scan being added
-      if (pCandidateScan == pScan)
-      {
-#ifdef KARTO_DEBUG2
-        std::cout << "INVALID CHAIN: Scan " << pScan->GetStateId() << " is not allowed in chain." << std::endl;
-#endif
-        isValidChain = false;
-      }
-      
-      Pose2 candidatePose = pCandidateScan->GetReferencePose(use_scan_barycenter_);
-      kt_double squaredDistance = scanPose.GetPosition().SquaredDistance(candidatePose.GetPosition());
-      
-      if (squaredDistance < math::Square(link_scan_max_distance_ + KT_TOLERANCE))
-      {
-        chain.Add(pCandidateScan);
-        processed.Add(pCandidateScan);
-        
-#ifdef KARTO_DEBUG2
-        std::cout << "Building chain for " << pScan->GetStateId() << ": [ ";
-        karto_const_forEachAs(LocalizedLaserScanList, &chain, iter2)
-        {
-          std::cout << (*iter2)->GetStateId() << " ";
-        }
-        std::cout << "]" << std::endl;
-#endif          
-      }
-      else
-      {
-        break;
-      }
-    }
-    
-    chain.Add(pNearScan);
-    
-    // add scans after current scan being processed
-    kt_size_t end = scans.Size();
-    for (kt_size_t candidateScanIndex = nearScanIndex + 1; candidateScanIndex < end; candidateScanIndex++)
-    {
-      LocalizedLaserScanPtr pCandidateScan = scans[candidateScanIndex];
-      
-      if (pCandidateScan == pScan)
-      {
-#ifdef KARTO_DEBUG2
-        std::cout << "INVALID CHAIN: Scan " << pScan->GetStateId() << " is not allowed in chain." << std::endl;
-#endif          
-        isValidChain = false;
-      }
-      
-      Pose2 candidatePose = pCandidateScan->GetReferencePose(use_scan_barycenter_);;
-      kt_double squaredDistance = scanPose.GetPosition().SquaredDistance(candidatePose.GetPosition());
-      
-      if (squaredDistance < math::Square(link_scan_max_distance_) + KT_TOLERANCE)
-      {
-        chain.Add(pCandidateScan);
-        processed.Add(pCandidateScan);
-        
-#ifdef KARTO_DEBUG2
-        std::cout << "Building chain for " << pScan->GetStateId() << ": [ ";
-        karto_const_forEachAs(LocalizedLaserScanList, &chain, iter2)
-        {
-          std::cout << (*iter2)->GetStateId() << " ";
-        }
-        std::cout << "]" << std::endl;
-#endif                    
-      }
-      else
-      {
-        break;
-      }
-    }
-    
-    if (isValidChain)
-    {
-      // add chain to collection
-      nearChains.Add(chain);
-    }
+    ConvertCellStates(states + y * tileSize, tileSize, &rMap.map.data[MAP_IDX(rMap.map.info.width, x0, y0 + y)]);
   }
-  
-  return nearChains;
 }
 
-LocalizedLaserScanPtr RelativeSlam::GetClosestScanToPose(const LocalizedLaserScanList& rScans, const Pose2& rPose) const
+map_msgs::OccupancyGridUpdate RelativeSlam::makeTileUpdate(const MapResponse& rMap, const IncrementalOccupancyGrid::TileIndex& rIndex) const
 {
-  LocalizedLaserScanPtr pClosestScan = NULL;
-  kt_double bestSquaredDistance = DBL_MAX;
-  
-  karto_const_forEach(LocalizedLaserScanList, &rScans)
+  const int tileSize = IncrementalOccupancyGrid::TileSize;
+  map_msgs::OccupancyGridUpdate update;
+  update.header = rMap.map.header;
+  update.x = rIndex.first * tileSize - core_->getGrid().OriginCellX();
+  update.y = rIndex.second * tileSize - core_->getGrid().OriginCellY();
+  update.width = tileSize;
+  update.height = tileSize;
+  update.data.resize(tileSize * tileSize);
+  for (int y = 0; y < tileSize; y++)
   {
-    Pose2 scanPose = (*iter)->GetReferencePose(use_scan_barycenter_);
-    
-    kt_double squaredDistance = rPose.GetPosition().SquaredDistance(scanPose.GetPosition());
-    if (squaredDistance < bestSquaredDistance)
-    {
-      bestSquaredDistance = squaredDistance;
-      pClosestScan = *iter;
-    }
+    std::vector<int8_t>::const_iterator row = rMap.map.data.begin() + MAP_IDX(rMap.map.info.width, update.x, update.y + y);
+    std::copy(row, row + tileSize, update.data.begin() + y * tileSize);
   }
-  
-  return pClosestScan;
+  return update;
 }
 
-
-LocalizedLaserScanList RelativeSlam::FindNearLinkedScans(LocalizedLaserScanPtr pScan, kt_double maxDistance)
+bool RelativeSlam::mapCallback(nav_msgs::GetMap::Request  &req,
+                       nav_msgs::GetMap::Response &res)
 {
-  //NearScanVisitor* pVisitor = new NearScanVisitor(pScan, maxDistance, use_scan_barycenter_);
-  //LocalizedObjectList nearLinkedObjects = m_pTraversal->Traverse(GetVertex(pScan), pVisitor);
-  //LocalizedObjectList nearLinkedObjects = solver_.bfs_visitor(pScan->GetUniqueId(), 100, false, pVisitor, NULL, NULL, NULL);
-  //LocalizedObjectList nearLinkedObjects; 
-  int max_topo_distance = maxDistance/minimum_travel_distance_;
-  std::vector<int> linked_scans_ids = solver_.GetNearLinkedObjects(pScan->GetUniqueId(),max_topo_distance );
-  
-  LocalizedLaserScanList nearLinkedScans;
-  //karto_const_forEach(LocalizedObjectList, &nearLinkedObjects)
-  //{
-  //  LocalizedObject* pObject = *iter;
-  //  LocalizedLaserScan* pScan = dynamic_cast<LocalizedLaserScan*>(pObject);
-  //  if (pScan != NULL)
-  //  {
-  //    nearLinkedScans.Add(pScan);
-  //  }
-  //}
-  //
-  for(int i=0; i < linked_scans_ids.size(); i++)
+  boost::shared_ptr<const MapResponse> map = boost::atomic_load(&map_snapshot_);
+  if(map && map->map.info.width && map->map.info.height)
   {
-    LocalizedObject* pObject = scan_manager_->GetLocalizedObject(linked_scans_ids[i]);
-    LocalizedLaserScanPtr pScan2 = dynamic_cast<LocalizedLaserScan*>(pObject);
-    // In threaded mode it seems that the +1 scan can sometimes appear here
-    if (pScan != NULL)  
-    {
-      nearLinkedScans.Add(pScan2);
-    }
+    res = *map;
+    return true;
   }
-
-  return nearLinkedScans;
+  else
+    return false;
 }
 
-void RelativeSlam::TryCloseLoop(LocalizedLaserScanPtr pScan)
-//void RelativeSlam::TryCloseLoop()
-  {
-
-      if(pScan == NULL)
-        return;
-
-      sensor_name_ = pScan->GetSensorIdentifier();
-      kt_bool loopClosed = false;
-      
-      kt_int32u scanIndex = 0;
-      
-      std::list<LocalizedLaserScanPtr> candidateChainTemp = FindPossibleLoopClosure(pScan, sensor_name_, scanIndex);
-      while (!candidateChainTemp.empty())
-      {
-        // Nasty, but for now TODO FIX THIS
-        LocalizedLaserScanList candidateChain;
-        std::cout << "Candidate chain for " << pScan->GetStateId() << ": [ ";
-        for( std::list<LocalizedLaserScanPtr>::iterator iter = candidateChainTemp.begin();iter != candidateChainTemp.end(); ++iter)
-        {
-          if( (*iter)->GetStateId() < pScan->GetUniqueId())
-          {
-            std::cout << (*iter)->GetStateId() << " ";
-            candidateChain.Add(*iter);
-          }
-        }
-        std::cout << "]" << std::endl;
-          
-        Pose2 bestPose;
-        Matrix3 covariance;
-        ROS_INFO("Computing coarse response");
-        kt_double coarseResponse = loop_scan_matcher_->MatchScan(pScan, candidateChain, bestPose, covariance, false, false);
-        ROS_INFO("Done");
-        
-        StringBuilder message;
-        ROS_INFO_STREAM("COARSE RESPONSE: " << coarseResponse << " (> " << loop_match_min_response_coarse_ << ")");
-        ROS_INFO_STREAM("            var: " << covariance(0, 0) << ",  " << covariance(1, 1) << " (< " << loop_match_max_variance_coarse_ << ")");
-        
-        // This is just messaging 
-        //MapperEventArguments eventArguments(message.ToString());
-        //m_pOpenMapper->Message.Notify(this, eventArguments);
-        
-        if ( ( (coarseResponse > loop_match_min_response_coarse_) &&
-             (covariance(0, 0) < loop_match_max_variance_coarse_) &&
-             (covariance(1, 1) < loop_match_max_variance_coarse_ ))
-            ||
-            // be more lenient if the variance is really small
-            ((coarseResponse > 0.9 * loop_match_min_response_coarse_ ) &&
-             (covariance(0, 0) < 0.01 * loop_match_max_variance_coarse_) &&
-             (covariance(1, 1) < 0.01 * loop_match_max_variance_coarse_)))
-        {
-          // save for reversion
-          Pose2 oldPose = pScan->GetSensorPose();
-          
-          pScan->SetSensorPose(bestPose);
-          boost::mutex::scoped_lock lock(scan_matcher_mutex_);
-          kt_double fineResponse = sequential_scan_matcher_->MatchScan(pScan, candidateChain, bestPose, covariance, false);
-         
-          std::cout << "  BEST POSE = " << bestPose << "  VARIANCE = " << covariance(0, 0) << ", " << covariance(1, 1) << std::endl;
-
-          //message.Clear();
-          ROS_INFO_STREAM("FINE RESPONSE: " << fineResponse << " (>" << loop_match_min_response_fine_ << ")");
-          //MapperEventArguments eventArguments(message.ToString());
-          //m_pOpenMapper->Message.Notify(this, eventArguments);
-          
-          if (fineResponse < loop_match_min_response_fine_)
-          {
-            // failed verification test, revert
-            pScan->SetSensorPose(oldPose);
-            
-            //MapperEventArguments eventArguments("REJECTED!");
-            //m_pOpenMapper->Message.Notify(this, eventArguments);
-            ROS_INFO_STREAM("Rejected");
-          }
-          else
-          {
-            //MapperEventArguments eventArguments1("Closing loop...");
-            //m_pOpenMapper->PreLoopClosed.Notify(this, eventArguments1);
-            ROS_INFO_STREAM("Closing loop..."); 
-            pScan->SetSensorPose(bestPose);
-            LinkChainToScan(candidateChain, pScan, bestPose, covariance);
-            CorrectPoses();
-          
-            // solver_.setLoopClosed();
-            //MapperEventArguments eventArguments2("Loop closed!");
-            //m_pOpenMapper->PostLoopClosed.Notify(this, eventArguments2);
-            
-            //m_pOpenMapper->ScansUpdated.Notify(this, karto::EventArguments::Empty());      
-            ROS_INFO_STREAM("Loop closed!");
-          }
-        }
-        
-        candidateChainTemp = FindPossibleLoopClosure(pScan, sensor_name_, scanIndex);
-      }
-  }
+static void LogStageReport(const std::string& rName, const StageReport& rReport)
+{
+  ROS_INFO("Stage %s: %.1f items/s, queue %d/%d, %d dropped, wait %.3f s, busy %.3f s avg %.3f s max, %.0f%% utilized",
+           rName.c_str(), rReport.Throughput(), (int)rReport.queue_size, (int)rReport.queue_capacity, (int)rReport.dropped,
+           rReport.MeanWait(), rReport.MeanBusy(), rReport.busy_max, 100.0 * rReport.Utilization());
+}
 
+template <typename T>
+StageReport RelativeSlam::takeStageReport(PipelineStage<T>& rStage)
+{
+  StageReport report = rStage.TakeReport();
+  stage_totals_[rStage.Name()].Merge(report);
+  return report;
+}
 
-//kt_bool RelativeSlam::TryCloseLoop(LocalizedLaserScanPtr pScan, const Identifier& rSensorName)
-void RelativeSlam::TryCloseLoopThread()
+void RelativeSlam::monitorPipeline(const ros::WallTimerEvent& event)
+{
+  StageReport frontend = takeStageReport(*frontend_stage_);
+  takeStageReport(*map_stage_);
+  if (local_map_stage_)
+    takeStageReport(*local_map_stage_);
+  std::map<std::string, StageReport> coreReports;
+  core_->takeStageReports(coreReports);
+  for (std::map<std::string, StageReport>::const_iterator it = coreReports.begin(); it != coreReports.end(); ++it)
+    stage_totals_[it->first].Merge(it->second);
+  const StageReport& backend = coreReports["backend"];
+
+  if (admission_controller_)
   {
-    ros::Rate r(10);
-
-    while (ros::ok())
+    AdmissionController::Decision decision = admission_controller_->Update(frontend, backend);
+    if (decision.action != AdmissionController::Hold)
     {
-      LocalizedLaserScanPtr pScan = loop_closure_candidate_;
-
-      if(pScan == NULL)
-      {
-        r.sleep();
-        continue;
-      }
-      TryCloseLoop(pScan);
-      r.sleep();
+      core_->setAdmissionLimits(decision.limits);
+      ROS_INFO("Admission control %s at load %.2f: throttle_scans %d, minimum travel %.3f m %.3f rad",
+               decision.reason.c_str(), decision.load, decision.limits.throttle_scans,
+               decision.limits.minimum_travel_distance, decision.limits.minimum_travel_heading);
     }
-  }
 
-  std::list<LocalizedLaserScanPtr> RelativeSlam::FindPossibleLoopClosure(LocalizedLaserScanPtr pScan, const Identifier& rSensorName, kt_int32u& rStartScanIndex)
-  {
-    // This is pretty nasty, Clear() calls destructor on smart pointer objects ...
-    //LocalizedLaserScanList chain; // return value
-    std::list<LocalizedLaserScanPtr> chain;
-
-    Pose2 pose = pScan->GetReferencePose(use_scan_barycenter_);
-    
-    // possible loop closure chain should not include close scans that have a
-    // path of links to the scan of interest
-    const LocalizedLaserScanList nearLinkedScans = FindNearLinkedScans(pScan, loop_search_max_distance_);
-   
-    boost::mutex::scoped_lock(scan_manager_mutex_);
-    LocalizedLaserScanList scans = scan_manager_->GetScans(rSensorName);
-    kt_size_t nScans = scans.Size();
-    for (; rStartScanIndex < nScans; rStartScanIndex++)
-    {
-      LocalizedLaserScanPtr pCandidateScan = scans[rStartScanIndex];
-      
-      Pose2 candidateScanPose = pCandidateScan->GetReferencePose(use_scan_barycenter_);
-      
-      kt_double squaredDistance = candidateScanPose.GetPosition().SquaredDistance(pose.GetPosition());
-      if (squaredDistance < math::Square(loop_search_max_distance_) + KT_TOLERANCE)
-      {
-        // a linked scan cannot be in the chain
-        if (nearLinkedScans.Contains(pCandidateScan) == true)
-        {
-          chain.clear();
-        }
-        else
-        {
-          chain.push_back(pCandidateScan);
-        }
-      }
-      else
-      {
-        // return chain if it is long "enough"
-        if (chain.size() >= loop_match_min_chain_size_) 
-        {
-          return chain;
-        }
-        else
-        {
-          chain.clear();
-        }
-      }
-    }
-    ROS_INFO("Possible loop closures: %d", chain.size());
-    return chain;
+    relative_slam::AdmissionDecision msg;
+    msg.header.stamp = ros::Time::now();
+    msg.action = decision.action == AdmissionController::Shed ? (uint8_t)relative_slam::AdmissionDecision::SHED :
+                 decision.action == AdmissionController::Relax ? (uint8_t)relative_slam::AdmissionDecision::RELAX :
+                 (uint8_t)relative_slam::AdmissionDecision::HOLD;
+    msg.reason = decision.reason;
+    msg.throttle_scans = decision.limits.throttle_scans;
+    msg.minimum_travel_distance = decision.limits.minimum_travel_distance;
+    msg.minimum_travel_heading = decision.limits.minimum_travel_heading;
+    msg.load = decision.load;
+    msg.frontend_latency = decision.frontend_latency;
+    msg.frontend_queue_fill = decision.frontend_queue_fill;
+    msg.backend_queue_fill = decision.backend_queue_fill;
+    msg.dropped_scans = decision.dropped;
+    admission_pub_.publish(msg);
   }
-  
-  void RelativeSlam::CorrectPoses()
-  {
-    // optimize scans!
-      //solver_.Compute();
-     
-      IdPoseVector vec = solver_.GetCorrections(); 
-      ROS_INFO("Got %d corrections", vec.size());
-      for(int i=0; i < vec.size(); i++)
-      {
-        boost::mutex::scoped_lock(scan_manager_mutex_);
-        LocalizedObject* pObject;
-        try
-        {
-          pObject = scan_manager_->GetLocalizedObject(vec[i].first);
-        }
-        catch (karto::Exception e)
-        {
-          ROS_ERROR("Tried to grab a non-existant object %d", vec[i].first);
-          continue;
-        }
 
-        LocalizedLaserScanPtr pScan = dynamic_cast<LocalizedLaserScan*>(pObject);
-        
-        if (pScan != NULL)
-        {
-          pScan->SetSensorPose(vec[i].second);
-        }
-        else
-        {
-          pObject->SetCorrectedPose(vec[i].second);
-        }
-      }
-      
-      solver_.Clear();
+  if (pipeline_stats_period_ > 0.0 && stage_totals_[frontend_stage_->Name()].period >= pipeline_stats_period_ - 1e-3)
+  {
+    for (std::map<std::string, StageReport>::const_iterator it = stage_totals_.begin(); it != stage_totals_.end(); ++it)
+      LogStageReport(it->first, it->second);
+    stage_totals_.clear();
   }
-
-int main(int argc, char** argv)
-{
-  ros::init(argc, argv, "relative_slam");
-
-  RelativeSlam rs;
-
-  ros::spin();
-
-  return 0;
 }
@@ -0,0 +1,12 @@
+#include <relative_slam/relative_slam.h>
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "relative_slam");
+
+  RelativeSlam rs(ros::NodeHandle(), ros::NodeHandle("~"));
+
+  ros::spin();
+
+  return 0;
+}
@@ -0,0 +1,25 @@
+#include <relative_slam/relative_slam.h>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+namespace relative_slam
+{
+
+// Runs RelativeSlam inside a nodelet manager, so scans from a driver and
+// maps and markers for a planner in the same manager are passed by pointer
+// instead of being serialized
+class RelativeSlamNodelet : public nodelet::Nodelet
+{
+private:
+  virtual void onInit()
+  {
+    // RelativeSlam runs its own threads; the callbacks only hand off work
+    slam_.reset(new RelativeSlam(getNodeHandle(), getPrivateNodeHandle()));
+  }
+
+  boost::shared_ptr<RelativeSlam> slam_;
+};
+
+} // namespace relative_slam
+
+PLUGINLIB_EXPORT_CLASS(relative_slam::RelativeSlamNodelet, nodelet::Nodelet)
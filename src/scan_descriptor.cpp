@@ -0,0 +1,82 @@
+#include <relative_slam/scan_descriptor.h>
+#include <cmath>
+
+ScanDescriptor::ScanDescriptor(const std::vector<double>& ranges, double max_range, size_t bins)
+{
+  if(bins == 0 || max_range <= 0.0)
+    return;
+
+  std::vector<float> histogram(bins, 0.0f);
+  size_t count = 0;
+  for(size_t i = 0; i < ranges.size(); i++)
+  {
+    double range = ranges[i];
+    if(!(range > 0.0) || range >= max_range)
+      continue;
+    size_t bin = (size_t)(range / max_range * bins);
+    if(bin >= bins)
+      bin = bins - 1;
+    histogram[bin] += 1.0f;
+    count++;
+  }
+
+  if(count == 0)
+    return;
+
+  for(size_t i = 0; i < bins; i++)
+    histogram[i] /= count;
+  histogram_.swap(histogram);
+}
+
+double ScanDescriptor::Distance(const ScanDescriptor& rOther) const
+{
+  if(IsEmpty() || rOther.IsEmpty() || histogram_.size() != rOther.histogram_.size())
+    return 1.0;
+
+  double sum = 0.0;
+  for(size_t i = 0; i < histogram_.size(); i++)
+    sum += fabs(histogram_[i] - rOther.histogram_[i]);
+  return 0.5 * sum;
+}
+
+void ScanDescriptorIndex::Insert(int id, const ScanDescriptor& rDescriptor)
+{
+  if(id < 0)
+    return;
+
+  boost::mutex::scoped_lock lock(mutex_);
+  if((size_t)id >= descriptors_.size())
+    descriptors_.resize(id + 1);
+  descriptors_[id] = rDescriptor;
+}
+
+bool ScanDescriptorIndex::Get(int id, ScanDescriptor& rDescriptor) const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if(id < 0 || (size_t)id >= descriptors_.size() || descriptors_[id].IsEmpty())
+    return false;
+  rDescriptor = descriptors_[id];
+  return true;
+}
+
+double ScanDescriptorIndex::MinDistance(const ScanDescriptor& rQuery, const std::vector<int>& rIds) const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  double best = 1.0;
+  for(size_t i = 0; i < rIds.size(); i++)
+  {
+    int id = rIds[i];
+    if(id < 0 || (size_t)id >= descriptors_.size())
+      continue;
+    double distance = rQuery.Distance(descriptors_[id]);
+    if(distance < best)
+      best = distance;
+  }
+  return best;
+}
+
+size_t ScanDescriptorIndex::Size() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return descriptors_.size();
+}
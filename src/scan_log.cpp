@@ -0,0 +1,95 @@
+#include <relative_slam/scan_log.h>
+#include <cerrno>
+#include <cstdlib>
+#include <sstream>
+
+// Whitespace separated fields of a line, parsed in place
+static bool NextWord(const char*& rCursor, std::string& rWord)
+{
+  while(*rCursor == ' ' || *rCursor == '\t' || *rCursor == '\r')
+    rCursor++;
+  const char* start = rCursor;
+  while(*rCursor != '\0' && *rCursor != ' ' && *rCursor != '\t' && *rCursor != '\r')
+    rCursor++;
+  rWord.assign(start, rCursor);
+  return rCursor != start;
+}
+
+static bool NextDouble(const char*& rCursor, double& rValue)
+{
+  char* end;
+  errno = 0;
+  rValue = strtod(rCursor, &end);
+  if(end == rCursor || errno == ERANGE)
+    return false;
+  rCursor = end;
+  return true;
+}
+
+static bool AtEnd(const char* cursor)
+{
+  while(*cursor == ' ' || *cursor == '\t' || *cursor == '\r')
+    cursor++;
+  return *cursor == '\0';
+}
+
+TextScanLog::TextScanLog(const std::string& path) : file_(path.c_str()), line_number_(0)
+{
+}
+
+TextScanLog::Record TextScanLog::fail(const std::string& rMessage)
+{
+  std::ostringstream error;
+  error << "line " << line_number_ << ": " << rMessage;
+  error_ = error.str();
+  return Error;
+}
+
+TextScanLog::Record TextScanLog::Next()
+{
+  std::string type;
+  while(std::getline(file_, line_))
+  {
+    line_number_++;
+    const char* cursor = line_.c_str();
+    if(!NextWord(cursor, type) || type[0] == '#')
+      continue;
+
+    if(type == "laser")
+    {
+      if(!NextWord(cursor, laser_.name) ||
+         !NextDouble(cursor, laser_.x) || !NextDouble(cursor, laser_.y) || !NextDouble(cursor, laser_.yaw) ||
+         !NextDouble(cursor, laser_.min_range) || !NextDouble(cursor, laser_.max_range) ||
+         !NextDouble(cursor, laser_.min_angle) || !NextDouble(cursor, laser_.max_angle) ||
+         !NextDouble(cursor, laser_.angle_increment) || !AtEnd(cursor))
+        return fail("expected laser <name> <x> <y> <yaw> <min_range> <max_range> <min_angle> <max_angle> <angle_increment>");
+      return Laser;
+    }
+    if(type == "odom")
+    {
+      if(!NextDouble(cursor, odometry_.stamp) || !NextDouble(cursor, odometry_.x) ||
+         !NextDouble(cursor, odometry_.y) || !NextDouble(cursor, odometry_.yaw) || !AtEnd(cursor))
+        return fail("expected odom <stamp> <x> <y> <yaw>");
+      return Odometry;
+    }
+    if(type == "scan")
+    {
+      double count;
+      if(!NextDouble(cursor, scan_.stamp) || !NextWord(cursor, scan_.laser) ||
+         !NextDouble(cursor, count) || count < 0 || count != (int)count)
+        return fail("expected scan <stamp> <laser> <count> <range>...");
+      scan_.ranges.resize((size_t)count);
+      for(size_t i = 0; i < scan_.ranges.size(); i++)
+      {
+        // inf and nan parse as such, as they were recorded
+        if(!NextDouble(cursor, scan_.ranges[i]))
+          return fail("fewer ranges than the count");
+      }
+      if(!AtEnd(cursor))
+        return fail("more ranges than the count");
+      return Scan;
+    }
+    return fail("unknown record type " + type);
+  }
+  return file_.eof() ? End : fail("read error");
+}
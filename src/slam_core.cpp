@@ -0,0 +1,1460 @@
+#include <relative_slam/slam_core.h>
+#include <relative_slam/slam_log.h>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/make_shared.hpp>
+#include <algorithm>
+#include <cmath>
+
+#define MAX_VARIANCE            500.0
+using namespace karto;
+using namespace srba;
+
+// A chain of old scans that may close a loop with the current keyframe
+struct SlamCore::LoopCandidate
+{
+  // Frozen copies from a graph snapshot
+  LocalizedLaserScanPtr query;
+  LocalizedLaserScanList chain;
+  std::vector<int> chain_ids;
+  LoopClosureCache::Place place;   // of the query, for the cache
+  size_t chain_hash;
+  double descriptor_distance;
+  double priority;
+  kt_double coarse_response;
+  Pose2 coarse_pose;
+  Matrix3 coarse_covariance;
+
+  static bool HigherPriority(const LoopCandidate& rA, const LoopCandidate& rB)
+  {
+    return rA.priority > rB.priority;
+  }
+
+  static bool HigherCoarseResponse(const LoopCandidate& rA, const LoopCandidate& rB)
+  {
+    return rA.coarse_response > rB.coarse_response;
+  }
+};
+
+SlamCore::SlamCore(const SlamParams& params) : params_(params),
+  next_keyframe_id_(0),
+  got_initial_pose_(false),
+  loop_descriptor_rejected_(0),
+  loop_descriptor_tested_(0),
+  travel_since_loop_closure_(0.0),
+  loop_closure_attempts_(0),
+  loop_closure_stale_(0),
+  loop_closure_latency_sum_(0.0),
+  loop_closure_latency_max_(0.0)
+{
+  occupancy_grid_.Clear(params_.resolution);
+  loop_closure_cache_.SetMaxEntries(std::max(0, params_.loop_cache_size));
+
+  AdmissionLimits limits;
+  limits.minimum_travel_distance = params_.minimum_travel_distance;
+  limits.minimum_travel_heading = params_.minimum_travel_heading;
+  admission_limits_ = boost::make_shared<const AdmissionLimits>(limits);
+
+  int map_threads = params_.map_threads;
+  if(map_threads <= 0)
+    map_threads = std::max(1u, boost::thread::hardware_concurrency());
+  int loop_closure_threads = params_.loop_closure_threads;
+  if(loop_closure_threads <= 0)
+    loop_closure_threads = std::max(1u, boost::thread::hardware_concurrency());
+
+  // Initialize Karto structures
+  scan_manager_ = new karto::MapperSensorManager(params_.scan_buffer_size, params_.scan_buffer_max_distance);
+  sequential_scan_matcher_ = karto::ScanMatcher::Create(params_.corr_search_space_dim, params_.corr_search_space_res,
+                                                        params_.corr_search_space_smear_dev, params_.laser_range_threshold, false);
+  loop_fine_matcher_ = karto::ScanMatcher::Create(params_.corr_search_space_dim, params_.corr_search_space_res,
+                                                  params_.corr_search_space_smear_dev, params_.laser_range_threshold, false);
+  for(int i = 0; i < loop_closure_threads; i++)
+    loop_scan_matchers_.push_back(karto::ScanMatcher::Create(params_.loop_search_space_dim, params_.loop_search_space_res,
+                                                             params_.loop_search_space_smear_dev, params_.laser_range_threshold, false));
+  loop_closure_pool_ = boost::make_shared<ThreadPool>(loop_scan_matchers_.size());
+  map_pool_ = boost::make_shared<ThreadPool>(map_threads);
+
+  // The front-end feeds the back-end (solver) and loop closure; scan
+  // matching, the front-end itself, runs in the caller.
+  // In synchronous mode the stages only exist for their (empty) reports.
+  loop_closure_stage_ = boost::make_shared<LoopClosureStage>("loop_closure", std::max(0, params_.loop_closure_queue_size), LoopClosureStage::DropOldest);
+  backend_stage_ = boost::make_shared<BackendStage>("backend", std::max(1, params_.backend_queue_size), BackendStage::Block);
+  if(!params_.synchronous)
+  {
+    loop_closure_stage_->Start(boost::bind(&SlamCore::loopClosureStep, this, _1, _2),
+                               boost::bind(&SlamCore::loopClosureIdle, this));
+    backend_stage_->Start(boost::bind(&SlamCore::backendStep, this, _1, _2));
+  }
+}
+
+SlamCore::~SlamCore()
+{
+  if(loop_closure_stage_)
+    loop_closure_stage_->Stop();
+  if(backend_stage_)
+    backend_stage_->Stop();
+  map_pool_.reset();
+  loop_closure_pool_.reset();
+  if (scan_manager_)
+    delete scan_manager_;
+  if (sequential_scan_matcher_)
+    delete sequential_scan_matcher_;
+  if (loop_fine_matcher_)
+    delete loop_fine_matcher_;
+  for(size_t i = 0; i < loop_scan_matchers_.size(); i++)
+    delete loop_scan_matchers_[i];
+}
+
+void SlamCore::addLaser(const std::string& name, const karto::Pose2& offset, double min_range, double max_range,
+                        double min_angle, double max_angle, double angular_resolution)
+{
+  if(hasLaser(name))
+    return;
+
+  // Create a laser range finder device
+  karto::Identifier sensor_name;
+  sensor_name.SetName(karto::String(name.c_str()));
+  karto::LaserRangeFinder* laser =
+    karto::LaserRangeFinder::CreateLaserRangeFinder(karto::LaserRangeFinder_Custom, sensor_name);
+  laser->SetOffsetPose(offset);
+  laser->SetMinimumRange(min_range);
+  laser->SetMaximumRange(max_range);
+  laser->SetMinimumAngle(min_angle);
+  laser->SetMaximumAngle(max_angle);
+  laser->SetAngularResolution(angular_resolution);
+  // TODO: expose this, and many other parameters
+  //laser_->SetRangeThreshold(12.0);
+
+  // Store this laser device for later
+  lasers_[name] = laser;
+
+  // Register with the "Mapper"
+  scan_manager_->RegisterSensor(sensor_name);
+}
+
+bool SlamCore::hasLaser(const std::string& name) const
+{
+  return lasers_.find(name) != lasers_.end();
+}
+
+// Planar pose composition a * b, and the inverse of a
+static Pose2 ComposePoses(const Pose2& rA, const Pose2& rB)
+{
+  kt_double c = cos(rA.GetHeading());
+  kt_double s = sin(rA.GetHeading());
+  return Pose2(rA.GetX() + c * rB.GetX() - s * rB.GetY(),
+               rA.GetY() + s * rB.GetX() + c * rB.GetY(),
+               math::NormalizeAngle(rA.GetHeading() + rB.GetHeading()));
+}
+
+static Pose2 InversePose(const Pose2& rA)
+{
+  kt_double c = cos(rA.GetHeading());
+  kt_double s = sin(rA.GetHeading());
+  return Pose2(-c * rA.GetX() - s * rA.GetY(), s * rA.GetX() - c * rA.GetY(), -rA.GetHeading());
+}
+
+bool SlamCore::addScan(const std::string& laser, const std::vector<kt_double>& ranges, const karto::Pose2& odom_pose, double stamp)
+{
+  if(!hasLaser(laser))
+  {
+    SLAM_WARN("Scan of unregistered laser %s; discarding it", laser.c_str());
+    return false;
+  }
+
+  // Karto's frame starts at the odometry of the first scan
+  if(!got_initial_pose_)
+  {
+    got_initial_pose_ = true;
+    initial_pose_ = odom_pose;
+  }
+
+  karto::Pose2 karto_pose = odom_pose - initial_pose_;
+
+  double x = karto_pose.GetX();
+  double y = karto_pose.GetY();
+  double th = initial_pose_.GetHeading();
+
+  double x_dash = x*cos(th) + y*sin(th);
+  double y_dash = -x*sin(th)+y*cos(th);
+
+  karto_pose.SetX(x_dash);
+  karto_pose.SetY(y_dash);
+  karto_pose.SetHeading(odom_pose.GetHeading()-th);
+
+  // create localized range scan
+  karto::LocalizedRangeScan* range_scan =
+    new karto::LocalizedRangeScan(laser.c_str(), ranges);
+  range_scan->SetOdometricPose(karto_pose);
+  range_scan->SetCorrectedPose(karto_pose);
+
+  // Add the localized range scan to the mapper
+  bool processed;
+  if((processed = process(range_scan)))
+  {
+    karto::Pose2 corrected_pose = range_scan->GetCorrectedPose();
+
+    // Compute the global_map->odom transform from the odometry the scan was
+    // placed with, rather than looking it up again
+    Pose2 global_map_to_odom = ComposePoses(corrected_pose, InversePose(odom_pose));
+    MapCorrection correction;
+    correction.odom_x = global_map_to_odom.GetX();
+    correction.odom_y = global_map_to_odom.GetY();
+    correction.odom_yaw = global_map_to_odom.GetHeading();
+    correction.relative_map_x = corrected_pose.GetX();
+    correction.relative_map_y = corrected_pose.GetY();
+    correction.relative_map_yaw = corrected_pose.GetHeading();
+    map_correction_.Store(correction);
+  }
+
+  MapCorrection correction = map_correction_.Load();
+  Pose2 pose = ComposePoses(Pose2(correction.odom_x, correction.odom_y, correction.odom_yaw), odom_pose);
+  StampedPose stamped;
+  stamped.stamp = stamp;
+  stamped.x = pose.GetX();
+  stamped.y = pose.GetY();
+  stamped.yaw = pose.GetHeading();
+  pose_.Store(stamped);
+
+  return processed;
+}
+
+void SlamCore::flush()
+{
+  applyCorrections();
+  // In synchronous mode the solver sends the corrections for these back at once
+  applyLoopClosures();
+  applyCorrections();
+}
+
+bool SlamCore::getPose(StampedPose& rPose) const
+{
+  if(pose_.Version() == 0)
+    return false;
+  rPose = pose_.Load();
+  return true;
+}
+
+GraphSnapshotPtr SlamCore::getGraph() const
+{
+  return boost::atomic_load(&graph_snapshot_);
+}
+
+bool SlamCore::updateMap(std::vector<IncrementalOccupancyGrid::TileIndex>& rChangedTiles)
+{
+  rChangedTiles.clear();
+  GraphSnapshotPtr graph = getGraph();
+  if (!graph)
+    return false;
+
+  // Raycast new scans, and subtract and re-add the ones a correction moved
+  std::vector<std::pair<int, ScanRays> > rays;
+  int added = 0;
+  int moved = 0;
+  for (size_t i = 0; i < graph->keyframes.size(); i++)
+  {
+    const KeyframeRecord& keyframe = graph->keyframes[i];
+    if (keyframe.id < 0)
+      continue;
+    const LocalizedLaserScan* pScan = keyframe.scan;
+    const ScanRays* pRays = occupancy_grid_.GetScan(pScan->GetUniqueId());
+    if (pRays != NULL)
+    {
+      const Pose2& sensorPose = keyframe.sensor_pose;
+      kt_double dx = sensorPose.GetX() - pRays->x;
+      kt_double dy = sensorPose.GetY() - pRays->y;
+      if (dx * dx + dy * dy <= math::Square(params_.map_reraycast_distance) &&
+          fabs(math::NormalizeAngle(sensorPose.GetHeading() - pRays->heading)) <= params_.map_reraycast_angle)
+        continue;
+      moved++;
+    }
+    else
+      added++;
+    rays.push_back(std::make_pair(pScan->GetUniqueId(), computeScanRays(pScan)));
+  }
+  occupancy_grid_.AddScans(rays, map_pool_.get());
+  SLAM_DEBUG("Map update raycast %d new and %d moved scans", added, moved);
+
+  if(occupancy_grid_.IsEmpty())
+  {
+    SLAM_INFO("No occupancy grid");
+    return false;
+  }
+
+  SLAM_INFO("Got occupancy grid");
+  occupancy_grid_.TakeDirtyTiles(rChangedTiles);
+  return true;
+}
+
+bool SlamCore::getMap(GridMap& rMap)
+{
+  std::vector<IncrementalOccupancyGrid::TileIndex> tiles;
+  if(!updateMap(tiles))
+    return false;
+
+  rMap.resolution = occupancy_grid_.Resolution();
+  rMap.origin_x = occupancy_grid_.OriginX();
+  rMap.origin_y = occupancy_grid_.OriginY();
+  rMap.width = occupancy_grid_.Width();
+  rMap.height = occupancy_grid_.Height();
+  rMap.data.assign((size_t)rMap.width * rMap.height, -1);
+
+  occupancy_grid_.GetTiles(tiles);
+  const int tileSize = IncrementalOccupancyGrid::TileSize;
+  for (size_t i = 0; i < tiles.size(); i++)
+  {
+    const unsigned char* states = occupancy_grid_.TileStates(tiles[i]);
+    if (states == NULL)
+      continue;
+    int x0 = tiles[i].first * tileSize - occupancy_grid_.OriginCellX();
+    int y0 = tiles[i].second * tileSize - occupancy_grid_.OriginCellY();
+    for (int y = 0; y < tileSize; y++)
+      ConvertCellStates(states + y * tileSize, tileSize, &rMap.data[(size_t)rMap.width * (y0 + y) + x0]);
+  }
+  return true;
+}
+
+bool SlamCore::exportGraph(const GraphSnapshot& rGraph, bool optimize, const std::string& graph_file,
+                           const std::string& scene_file, std::vector<karto::Pose2>* pPoses) const
+{
+  // Only reads the snapshot, never the solver's own graph
+  return solver_.ExportGlobalGraph(rGraph, optimize, graph_file, scene_file, pPoses);
+}
+
+void SlamCore::setAdmissionLimits(const AdmissionLimits& limits)
+{
+  boost::atomic_store(&admission_limits_, boost::make_shared<const AdmissionLimits>(limits));
+}
+
+boost::shared_ptr<const AdmissionLimits> SlamCore::getAdmissionLimits() const
+{
+  return boost::atomic_load(&admission_limits_);
+}
+
+void SlamCore::takeStageReports(std::map<std::string, StageReport>& rReports)
+{
+  rReports[backend_stage_->Name()] = backend_stage_->TakeReport();
+  rReports[loop_closure_stage_->Name()] = loop_closure_stage_->TakeReport();
+}
+
+bool SlamCore::hasMovedEnough(karto::LocalizedRangeScan* pScan, karto::LocalizedRangeScan* pLastScan) const
+{
+    // test if first scan
+    if (pLastScan == NULL)
+    {
+      return true;
+    }
+
+    karto::Pose2 lastScannerPose = pLastScan->GetSensorAt(pLastScan->GetOdometricPose());
+    karto::Pose2 scannerPose = pScan->GetSensorAt(pScan->GetOdometricPose());
+    // The thresholds admission control currently allows
+    boost::shared_ptr<const AdmissionLimits> limits = boost::atomic_load(&admission_limits_);
+
+    // test if we have turned enough
+    kt_double deltaHeading = karto::math::NormalizeAngle(scannerPose.GetHeading() - lastScannerPose.GetHeading());
+    if (fabs(deltaHeading) >= limits->minimum_travel_heading)
+    {
+      return true;
+    }
+
+    // test if we have moved enough
+    kt_double squaredTravelDistance = lastScannerPose.GetPosition().SquaredDistance(scannerPose.GetPosition());
+    if (squaredTravelDistance >= karto::math::Square(limits->minimum_travel_distance) - karto::KT_TOLERANCE)
+    {
+      return true;
+    }
+
+    return false;
+}
+
+bool SlamCore::process(karto::LocalizedRangeScan* pScan)
+{
+  applyCorrections();
+  applyLoopClosures();
+
+  karto::LocalizedObject* pLocalizedObject = dynamic_cast<karto::LocalizedObject*>(pScan);
+  if (pScan != NULL)
+  {
+    karto::LaserRangeFinder* pLaserRangeFinder = pScan->GetLaserRangeFinder();
+    
+    // validate scan
+    if (pLaserRangeFinder == NULL)
+    {
+      return false;
+    }
+
+    pLaserRangeFinder->Validate(pScan);
+
+    // ensures sensor has been registered with mapper--does nothing if the sensor has already been registered
+    scan_manager_->RegisterSensor(pLocalizedObject->GetSensorIdentifier());
+
+    karto::LocalizedRangeScan* pLastScan = dynamic_cast<karto::LocalizedRangeScan *>(scan_manager_->GetLastScan(pLocalizedObject->GetSensorIdentifier()));
+    
+    // update scans corrected pose based on last correction
+    if (pLastScan != NULL)
+    {
+      karto::Transform lastTransform(pLastScan->GetOdometricPose(), pLastScan->GetCorrectedPose());
+      pScan->SetCorrectedPose(lastTransform.TransformPose(pLocalizedObject->GetOdometricPose()));
+      
+      // test if scan is outside minimum boundary or if heading is larger then minimum heading
+      if (!hasMovedEnough(pScan, pLastScan))
+      {
+        return false;
+      }
+
+      karto::Matrix3 covariance;
+      covariance.SetToIdentity();
+
+      // Correct scan
+      karto::Pose2 bestPose;
+      sequential_scan_matcher_->MatchScan(pScan,
+                               scan_manager_->GetRunningScans(pScan->GetSensorIdentifier()),
+                                           bestPose,
+                                           covariance);
+      pScan->SetSensorPose(bestPose);
+
+      // Hook called before loop closing 
+      //karto::ScanMatched(pScan); 
+    }
+
+    // Add scan to buffer and assign id
+    // Ids are handed out in the same order the solver assigns them
+    int id = next_keyframe_id_++;
+    backend_job_.node_id = id;
+    backend_job_.node_pose = pScan->GetCorrectedPose();
+    pScan->SetUniqueId(id);
+    scan_manager_->AddLocalizedObject(pLocalizedObject);
+    descriptor_index_.Insert(id, ComputeDescriptor(pScan));
+    
+    // Add edges
+    if(pLastScan != NULL)
+    {
+      addEdges(pScan); 
+      {
+        boost::mutex::scoped_lock lock(loop_closure_mutex_);
+        travel_since_loop_closure_ += sqrt(pLastScan->GetCorrectedPose().GetPosition().SquaredDistance(pScan->GetCorrectedPose().GetPosition()));
+      }
+    }
+
+    // The keyframe's pose is final now; let the other threads see it
+    recordKeyframe(pScan);
+    publishGraphSnapshot();
+    submitBackendJob();
+
+    if(pLastScan != NULL)
+    {
+      if(params_.synchronous)
+        loopClosureStep(id, 0.0);
+      else if(!loop_closure_stage_->Push(id))
+        SLAM_WARN("Loop closure is falling behind, dropped oldest queued keyframe");
+    }
+    scan_manager_->AddRunningScan(pScan);
+    scan_manager_->SetLastScan(pScan);
+
+    //karto::ScanMatchingEnd(pScan);
+    return true;
+  }
+  return false;
+}
+
+bool SlamCore::addEdges(karto::LocalizedObject *pObject)
+{
+  // loose "spring"
+  Matrix3 covariance;
+  covariance(0, 0) = MAX_VARIANCE;
+  covariance(1, 1) = MAX_VARIANCE;
+  covariance(2, 2) = MAX_VARIANCE;
+    
+  karto::LocalizedLaserScanPtr pScan = dynamic_cast<karto::LocalizedLaserScan*>(pObject);
+  if (pScan != NULL)
+  {      
+    AddEdges(pScan, covariance);
+  }
+  else
+  {
+    //MapperSensorManager* pSensorManager = m_pOpenMapper->m_pMapperSensorManager;      
+    const Identifier& rSensorName = pObject->GetSensorIdentifier();
+      
+    LocalizedLaserScan* pLastScan = scan_manager_->GetLastScan(rSensorName);
+    if (pLastScan != NULL)
+    {
+      LinkObjects(pLastScan, pObject, pObject->GetCorrectedPose(), covariance);
+    }
+  }
+}
+
+void SlamCore::LinkObjects(LocalizedObject* pFromObject, LocalizedObject* pToObject, const Pose2& rMean, const Matrix3& rCovariance)
+{
+    //kt_bool isNewEdge = true;
+    //Edge<LocalizedObjectPtr>* pEdge = AddEdge(pFromObject, pToObject, isNewEdge);
+    
+    // only attach link information if the edge is new
+    //if (isNewEdge == true)
+    //{
+
+    // Calculate the difference
+    LocalizedLaserScanPtr pScan = dynamic_cast<LocalizedLaserScan*>(pFromObject);
+    Pose2 pose1, pose2;
+    if (pScan != NULL)
+    {
+        pose1 = pScan->GetSensorPose();
+    }
+    else
+    {
+        pose1 = pScan->GetCorrectedPose();
+    }
+
+    addConstraint(pFromObject->GetUniqueId(), pose1, pToObject->GetUniqueId(), rMean, rCovariance, false);
+}
+
+void SlamCore::addConstraint(int fromId, const Pose2& rFromPose, int toId, const Pose2& rMean, const Matrix3& rCovariance, bool loopClosure)
+{
+    // Do the update
+    // transform second pose into the coordinate system of the first pose
+    Transform transform(rFromPose, Pose2());
+    Pose2 poseDiff = transform.TransformPose(rMean);
+
+    // transform covariance into reference of first pose
+    Matrix3 rotationMatrix;
+    rotationMatrix.FromAxisAngle(0, 0, 1, -rFromPose.GetHeading());
+    
+    Matrix3 covariance = rotationMatrix * rCovariance * rotationMatrix.Transpose();
+    SLAM_INFO("Adding constraint:  %f, %f, %f", poseDiff.GetX(), poseDiff.GetY(), poseDiff.GetHeading()); 
+    GraphEdge edge;
+    edge.from = fromId;
+    edge.to = toId;
+    edge.diff = poseDiff;
+    edge.covariance = covariance;
+    edge.loop_closure = loopClosure;
+    backend_job_.constraints.push_back(edge);
+
+    // The solver drops repeated constraints between the same keyframes
+    if(fromId == toId || !constrained_pairs_.insert(std::make_pair(std::min(fromId, toId), std::max(fromId, toId))).second)
+      return;
+    graph_.edges.push_back(edge);
+    if(graph_.adjacency.size() <= (size_t)std::max(fromId, toId))
+      graph_.adjacency.resize(std::max(fromId, toId) + 1);
+    graph_.adjacency.Modify(fromId).push_back(toId);
+    graph_.adjacency.Modify(toId).push_back(fromId);
+}
+
+bool SlamCore::AddEdges(LocalizedLaserScanPtr pScan, const Matrix3& rCovariance)
+{
+    const Identifier& rSensorName = pScan->GetSensorIdentifier();
+    
+    Pose2List means;
+    List<Matrix3> covariances;
+    
+    LocalizedLaserScanPtr pLastScan = scan_manager_->GetLastScan(rSensorName);
+    if (pLastScan == NULL)
+    {
+      // first scan (link to first scan of other robots)
+
+      assert(scan_manager_->GetScans(rSensorName).Size() == 1);
+      
+      List<Identifier> sensorNames = scan_manager_->GetSensorNames();
+      karto_const_forEach(List<Identifier>, &sensorNames)
+      {
+        const Identifier& rCandidateSensorName = *iter;
+        
+        // skip if candidate sensor is the same or other sensor has no scans
+        if ((rCandidateSensorName == rSensorName) || (scan_manager_->GetScans(rCandidateSensorName).IsEmpty()))
+        {
+          continue;
+        }
+        
+        Pose2 bestPose;
+        Matrix3 covariance;
+        kt_double response = sequential_scan_matcher_->MatchScan(pScan, scan_manager_->GetScans(rCandidateSensorName), bestPose, covariance);
+        LinkObjects(scan_manager_->GetScans(rCandidateSensorName)[0], pScan, bestPose, covariance);
+        
+        // only add to means and covariances if response was high "enough"
+        //if (response > m_pOpenMapper->m_pLinkMatchMinimumResponseFine->GetValue())
+        if (response > params_.link_match_min_response_fine)
+        {
+          means.Add(bestPose);
+          covariances.Add(covariance);
+        }
+      }
+    }
+    else
+    {
+      // link to previous scan
+      LinkObjects(pLastScan, pScan, pScan->GetSensorPose(), rCovariance);
+
+      // link to running scans
+      Pose2 scanPose = pScan->GetSensorPose();
+      means.Add(scanPose);
+      covariances.Add(rCovariance);
+      LinkChainToScan(scan_manager_->GetRunningScans(rSensorName), pScan, scanPose, rCovariance);
+    }
+    
+    // link to other near chains (chains that include new scan are invalid)
+    LinkNearChains(pScan, means, covariances);
+    
+    if (!means.IsEmpty())
+    {
+      pScan->SetSensorPose(ComputeWeightedMean(means, covariances));
+    }
+}
+
+void SlamCore::LinkChainToScan(const LocalizedLaserScanList& rChain, LocalizedLaserScanPtr pScan,
+                                  const Pose2& rMean, const Matrix3& rCovariance)
+{
+  Pose2 pose = pScan->GetReferencePose(params_.use_scan_barycenter);
+
+  LocalizedLaserScanPtr pClosestScan = GetClosestScanToPose(rChain, pose);
+  assert(pClosestScan != NULL);
+
+  Pose2 closestScanPose = pClosestScan->GetReferencePose(params_.use_scan_barycenter);
+
+  kt_double squaredDistance = pose.GetPosition().SquaredDistance(closestScanPose.GetPosition());
+  if (squaredDistance < math::Square(params_.link_scan_max_distance) + KT_TOLERANCE)
+  {
+    SLAM_INFO("LinkChainToScan calling LinkObjects on %d to %d", pClosestScan->GetUniqueId(), pScan->GetUniqueId());
+    if(pClosestScan->GetUniqueId() < 0)
+    {
+      SLAM_ERROR("Invalid scan id!!!!");
+      return;
+    }
+    LinkObjects(pClosestScan, pScan, rMean, rCovariance);
+  }
+}
+
+void SlamCore::LinkNearChains(LocalizedLaserScanPtr pScan, Pose2List& rMeans, List<Matrix3>& rCovariances)
+{
+    const List<LocalizedLaserScanList> nearChains = FindNearChains(pScan);
+
+    kt_bool gotTbb = false;
+    if (params_.is_multithreaded)
+    {
+#ifdef USE_TBB
+      gotTbb = true;
+      kt_bool* pWasChainLinked = new kt_bool[nearChains.Size()];
+
+      Pose2List means;
+      means.Resize(nearChains.Size());
+
+      List<Matrix3> covariances;
+      covariances.Resize(nearChains.Size());
+
+      int grainSize = 100;
+      Parallel_LinkNearChains myTask(m_pOpenMapper, pScan, &nearChains, pWasChainLinked, &means, &covariances,
+        params_.loop_match_min_chain_size,
+        params_.link_match_min_response_fine);
+      tbb::parallel_for(tbb::blocked_range<kt_int32s>(0, static_cast<kt_int32s>(nearChains.Size()), grainSize), myTask);
+
+      for (kt_int32u i = 0; i < nearChains.Size(); i++)
+      {
+        if (pWasChainLinked[i] == true)
+        {
+          rMeans.Add(means[i]);
+          rCovariances.Add(covariances[i]);
+          LinkChainToScan(nearChains[i], pScan, means[i], covariances[i]);
+        }
+      }
+
+      delete [] pWasChainLinked;
+#endif
+    }
+
+    if (gotTbb == false)
+    {
+      karto_const_forEach(List<LocalizedLaserScanList>, &nearChains)
+      {
+        if (iter->Size() < params_.loop_match_min_chain_size)
+        {
+          continue;
+        }
+
+        Pose2 mean;
+        Matrix3 covariance;
+        // match scan against "near" chain
+        kt_double response = sequential_scan_matcher_->MatchScan(pScan, *iter, mean, covariance, false);
+        if (response > params_.link_match_min_response_fine - KT_TOLERANCE)
+        {
+          rMeans.Add(mean);
+          rCovariances.Add(covariance);
+          LinkChainToScan(*iter, pScan, mean, covariance);
+        }
+        else
+        {
+          SLAM_DEBUG("Near chain rejected for %d: response %g (< %g)", pScan->GetUniqueId(), response, params_.link_match_min_response_fine);
+        }
+      }
+    }
+  }
+
+ScanRays SlamCore::computeScanRays(const LocalizedLaserScan* pScan) const
+{
+  ScanRays rays;
+  Pose2 sensorPose = pScan->GetSensorPose();
+  rays.x = sensorPose.GetX();
+  rays.y = sensorPose.GetY();
+  rays.heading = sensorPose.GetHeading();
+
+  const Vector2dList& points = pScan->GetPointReadings();
+  rays.end_x.reserve(points.Size());
+  rays.end_y.reserve(points.Size());
+  rays.end_hit.reserve(points.Size());
+  karto_const_forEach(Vector2dList, &points)
+  {
+    kt_double dx = iter->GetX() - rays.x;
+    kt_double dy = iter->GetY() - rays.y;
+    kt_double range = sqrt(dx * dx + dy * dy);
+
+    // Like karto::OccupancyGrid, clip beams to the trusted range and don't count them as hits
+    bool hit = range < params_.laser_range_threshold - KT_TOLERANCE;
+    if (!hit && range > 0.0)
+    {
+      dx *= params_.laser_range_threshold / range;
+      dy *= params_.laser_range_threshold / range;
+    }
+    rays.end_x.push_back(rays.x + dx);
+    rays.end_y.push_back(rays.y + dy);
+    rays.end_hit.push_back(hit);
+  }
+  return rays;
+}
+
+Pose2 SlamCore::ComputeWeightedMean(const Pose2List& rMeans, const List<Matrix3>& rCovariances) const
+{
+  assert(rMeans.Size() == rCovariances.Size());
+  
+  // compute sum of inverses and create inverse list
+  List<Matrix3> inverses;
+  inverses.EnsureCapacity(rCovariances.Size());
+  
+  Matrix3 sumOfInverses;
+  karto_const_forEach(List<Matrix3>, &rCovariances)
+  {
+    Matrix3 inverse = iter->Inverse();
+    inverses.Add(inverse);
+    
+    sumOfInverses += inverse;
+  }
+  Matrix3 inverseOfSumOfInverses = sumOfInverses.Inverse();
+  
+  // compute weighted mean
+  Pose2 accumulatedPose;
+  kt_double thetaX = 0.0;
+  kt_double thetaY = 0.0;
+  
+  Pose2List::ConstIterator meansIter = rMeans.GetConstIterator();
+  karto_const_forEach(List<Matrix3>, &inverses)
+  {
+    Pose2 pose = *meansIter;
+    kt_double angle = pose.GetHeading();
+    thetaX += cos(angle);
+    thetaY += sin(angle);
+    
+    Matrix3 weight = inverseOfSumOfInverses * (*iter);
+    accumulatedPose += weight * pose;
+    
+    meansIter++;
+  }
+  
+  thetaX /= rMeans.Size();
+  thetaY /= rMeans.Size();
+  accumulatedPose.SetHeading(atan2(thetaY, thetaX));
+  
+  return accumulatedPose;
+}
+
+List<LocalizedLaserScanList> SlamCore::FindNearChains(LocalizedLaserScanPtr pScan)
+{
+  List<LocalizedLaserScanList> nearChains;
+  
+  Pose2 scanPose = pScan->GetReferencePose(params_.use_scan_barycenter);
+  
+  // to keep track of which scans have been added to a chain
+  LocalizedLaserScanList processed;
+  
+  const LocalizedLaserScanList nearLinkedScans = FindNearLinkedScans(pScan, params_.link_scan_max_distance);
+  karto_const_forEach(LocalizedLaserScanList, &nearLinkedScans)
+  {
+    LocalizedLaserScanPtr pNearScan = *iter;
+    
+    if (pNearScan == pScan)
+    {
+      continue;
+    }
+    
+    // scan has already been processed, skip
+    if (processed.Contains(pNearScan) == true)
+    {
+      continue;
+    }
+    
+    processed.Add(pNearScan);
+    
+    // build up chain
+    kt_bool isValidChain = true;
+    LocalizedLaserScanList chain;
+     
+    LocalizedLaserScanList scans = scan_manager_->GetScans(pNearScan->GetSensorIdentifier());
+    
+    kt_int32s nearScanIndex = scan_manager_->GetScanIndex(pNearScan);
+    assert(nearScanIndex >= 0);
+    
+    // add scans before current scan being processed
+    for (kt_int32s candidateScanIndex = nearScanIndex - 1; candidateScanIndex >= 0; candidateScanIndex--)
+    {
+      LocalizedLaserScanPtr pCandidateScan = scans[candidateScanIndex];
+      
+      // chain is invalid--contains scan being added
+      if (pCandidateScan == pScan)
+      {
+        isValidChain = false;
+      }
+      
+      Pose2 candidatePose = pCandidateScan->GetReferencePose(params_.use_scan_barycenter);
+      kt_double squaredDistance = scanPose.GetPosition().SquaredDistance(candidatePose.GetPosition());
+      
+      if (squaredDistance < math::Square(params_.link_scan_max_distance + KT_TOLERANCE))
+      {
+        chain.Add(pCandidateScan);
+        processed.Add(pCandidateScan);
+      }
+      else
+      {
+        break;
+      }
+    }
+    
+    chain.Add(pNearScan);
+    
+    // add scans after current scan being processed
+    kt_size_t end = scans.Size();
+    for (kt_size_t candidateScanIndex = nearScanIndex + 1; candidateScanIndex < end; candidateScanIndex++)
+    {
+      LocalizedLaserScanPtr pCandidateScan = scans[candidateScanIndex];
+      
+      if (pCandidateScan == pScan)
+      {
+        isValidChain = false;
+      }
+      
+      Pose2 candidatePose = pCandidateScan->GetReferencePose(params_.use_scan_barycenter);;
+      kt_double squaredDistance = scanPose.GetPosition().SquaredDistance(candidatePose.GetPosition());
+      
+      if (squaredDistance < math::Square(params_.link_scan_max_distance) + KT_TOLERANCE)
+      {
+        chain.Add(pCandidateScan);
+        processed.Add(pCandidateScan);
+      }
+      else
+      {
+        break;
+      }
+    }
+    
+    if (isValidChain)
+    {
+      // add chain to collection
+      nearChains.Add(chain);
+    }
+  }
+  
+  return nearChains;
+}
+
+LocalizedLaserScanPtr SlamCore::GetClosestScanToPose(const LocalizedLaserScanList& rScans, const Pose2& rPose) const
+{
+  LocalizedLaserScanPtr pClosestScan = NULL;
+  kt_double bestSquaredDistance = DBL_MAX;
+  
+  karto_const_forEach(LocalizedLaserScanList, &rScans)
+  {
+    Pose2 scanPose = (*iter)->GetReferencePose(params_.use_scan_barycenter);
+    
+    kt_double squaredDistance = rPose.GetPosition().SquaredDistance(scanPose.GetPosition());
+    if (squaredDistance < bestSquaredDistance)
+    {
+      bestSquaredDistance = squaredDistance;
+      pClosestScan = *iter;
+    }
+  }
+  
+  return pClosestScan;
+}
+
+
+LocalizedLaserScanList SlamCore::FindNearLinkedScans(LocalizedLaserScanPtr pScan, kt_double maxDistance)
+{
+  //NearScanVisitor* pVisitor = new NearScanVisitor(pScan, maxDistance, params_.use_scan_barycenter);
+  //LocalizedObjectList nearLinkedObjects = m_pTraversal->Traverse(GetVertex(pScan), pVisitor);
+  //LocalizedObjectList nearLinkedObjects = solver_.bfs_visitor(pScan->GetUniqueId(), 100, false, pVisitor, NULL, NULL, NULL);
+  //LocalizedObjectList nearLinkedObjects; 
+  int max_topo_distance = maxDistance/params_.minimum_travel_distance;
+  std::vector<std::pair<int, int> > linked;
+  graph_.FindLinked(pScan->GetUniqueId(), max_topo_distance, linked);
+  std::vector<int> linked_scans_ids;
+  for(size_t i = 0; i < linked.size(); i++)
+    linked_scans_ids.push_back(linked[i].first);
+  
+  LocalizedLaserScanList nearLinkedScans;
+  //karto_const_forEach(LocalizedObjectList, &nearLinkedObjects)
+  //{
+  //  LocalizedObject* pObject = *iter;
+  //  LocalizedLaserScan* pScan = dynamic_cast<LocalizedLaserScan*>(pObject);
+  //  if (pScan != NULL)
+  //  {
+  //    nearLinkedScans.Add(pScan);
+  //  }
+  //}
+  //
+  for(int i=0; i < linked_scans_ids.size(); i++)
+  {
+    LocalizedObject* pObject = scan_manager_->GetLocalizedObject(linked_scans_ids[i]);
+    LocalizedLaserScanPtr pScan2 = dynamic_cast<LocalizedLaserScan*>(pObject);
+    // In threaded mode it seems that the +1 scan can sometimes appear here
+    if (pScan != NULL)  
+    {
+      nearLinkedScans.Add(pScan2);
+    }
+  }
+
+  return nearLinkedScans;
+}
+
+std::set<int> SlamCore::FindNearLinkedIds(const GraphSnapshot& rGraph, int id, kt_double maxDistance) const
+{
+  // Same hop limit as FindNearLinkedScans(), over the snapshot's constraints
+  int max_topo_distance = maxDistance/params_.minimum_travel_distance;
+  std::vector<std::pair<int, int> > linked;
+  rGraph.FindLinked(id, max_topo_distance, linked);
+
+  std::set<int> ids;
+  for (size_t i = 0; i < linked.size(); i++)
+    ids.insert(linked[i].first);
+  return ids;
+}
+
+ScanDescriptor SlamCore::ComputeDescriptor(const LocalizedLaserScan* pScan) const
+{
+  Vector2<kt_double> sensorPosition = pScan->GetSensorPose().GetPosition();
+  const Vector2dList& points = pScan->GetPointReadings();
+
+  std::vector<double> ranges;
+  ranges.reserve(points.Size());
+  karto_const_forEach(Vector2dList, &points)
+  {
+    ranges.push_back(sqrt(sensorPosition.SquaredDistance(*iter)));
+  }
+  return ScanDescriptor(ranges, params_.laser_range_threshold, params_.loop_descriptor_bins);
+}
+
+bool SlamCore::IsCoarseMatchAccepted(kt_double response, const Matrix3& rCovariance) const
+{
+  return ( (response > params_.loop_match_min_response_coarse) &&
+           (rCovariance(0, 0) < params_.loop_match_max_variance_coarse) &&
+           (rCovariance(1, 1) < params_.loop_match_max_variance_coarse ))
+         ||
+         // be more lenient if the variance is really small
+         ((response > 0.9 * params_.loop_match_min_response_coarse ) &&
+          (rCovariance(0, 0) < 0.01 * params_.loop_match_max_variance_coarse) &&
+          (rCovariance(1, 1) < 0.01 * params_.loop_match_max_variance_coarse));
+}
+
+void SlamCore::CoarseMatchCandidate(std::vector<LoopCandidate>* pCandidates, size_t index, size_t worker)
+{
+  LoopCandidate& candidate = (*pCandidates)[index];
+  candidate.coarse_response = loop_scan_matchers_[worker]->MatchScan(candidate.query, candidate.chain,
+                                                                     candidate.coarse_pose, candidate.coarse_covariance, false, false);
+}
+
+void SlamCore::GatherLoopCandidates(const GraphSnapshot& rGraph, const KeyframeRecord& rQuery)
+  {
+      LocalizedLaserScanPtr pScan = rQuery.scan;
+
+      ScanDescriptor queryDescriptor;
+      bool useDescriptor = params_.loop_descriptor_max_distance < 1.0 &&
+                           descriptor_index_.Get(pScan->GetUniqueId(), queryDescriptor);
+
+      double travelSinceClosure;
+      {
+        boost::mutex::scoped_lock lock(loop_closure_mutex_);
+        travelSinceClosure = travel_since_loop_closure_;
+      }
+
+      // Failures are remembered by where the query was taken, so a later
+      // keyframe at the same spot skips the chains that failed there
+      LoopClosureCache::Place place = LoopClosureCache::QuantizePlace(rQuery.corrected_pose.GetX(), rQuery.corrected_pose.GetY(),
+        rQuery.corrected_pose.GetHeading(), params_.loop_cache_cell_size, params_.loop_cache_cell_angle);
+
+      // Collect every candidate chain up front so they can be ranked and matched concurrently
+      size_t scanIndex = 0;
+      std::vector<int> candidateChainTemp;
+      FindPossibleLoopClosure(rGraph, rQuery, scanIndex, candidateChainTemp);
+      while (!candidateChainTemp.empty())
+      {
+        LoopCandidate candidate;
+        candidate.query = pScan;
+        candidate.place = place;
+        candidate.coarse_response = 0.0;
+        candidate.descriptor_distance = 0.0;
+        std::vector<int>& chainIds = candidate.chain_ids;
+        for (size_t i = 0; i < candidateChainTemp.size(); i++)
+        {
+          if (candidateChainTemp[i] < rQuery.id)
+          {
+            candidate.chain.Add(rGraph.keyframes[candidateChainTemp[i]].scan);
+            chainIds.push_back(candidateChainTemp[i]);
+          }
+        }
+        if (!chainIds.empty())
+          SLAM_DEBUG("Candidate chain for %d: %d scans, %d..%d", rQuery.id, (int)chainIds.size(), chainIds.front(), chainIds.back());
+        candidate.chain_hash = LoopClosureCache::HashChain(chainIds);
+
+        LoopClosureCache::Result cached;
+        if (useDescriptor && !chainIds.empty())
+        {
+          loop_descriptor_tested_++;
+          candidate.descriptor_distance = descriptor_index_.MinDistance(queryDescriptor, chainIds);
+        }
+
+        if (candidate.chain.IsEmpty())
+        {
+          // Nothing older than the query scan to match against
+        }
+        else if (candidate.descriptor_distance > params_.loop_descriptor_max_distance)
+        {
+          SLAM_DEBUG("Descriptor distance %.3f rejected chain for %d", candidate.descriptor_distance, pScan->GetUniqueId());
+          loop_descriptor_rejected_++;
+        }
+        else if (loop_closure_cache_.Find(place, candidate.chain_hash, cached))
+        {
+          SLAM_DEBUG("Chain already failed for %d (coarse %.3f, fine %.3f), skipping",
+                    pScan->GetUniqueId(), cached.coarse_response, cached.fine_response);
+        }
+        else
+        {
+          // Rank by how alike the places look, how far we have driven since the
+          // last closure and how much drift separates the chain from the query
+          double similarity = 1.0 - candidate.descriptor_distance;
+          double travel = std::min(1.0, travelSinceClosure / params_.loop_priority_travel_scale);
+          double gap = (pScan->GetUniqueId() - chainIds.back()) * params_.minimum_travel_distance;
+          double uncertainty = std::min(1.0, gap / params_.loop_priority_travel_scale);
+          candidate.priority = similarity + travel + uncertainty;
+          loop_backlog_.push_back(candidate);
+        }
+
+        FindPossibleLoopClosure(rGraph, rQuery, scanIndex, candidateChainTemp);
+      }
+
+      // Keep the backlog ranked and bounded, dropping the least promising candidates
+      std::stable_sort(loop_backlog_.begin(), loop_backlog_.end(), LoopCandidate::HigherPriority);
+      if (params_.loop_backlog_size > 0 && loop_backlog_.size() > (size_t)params_.loop_backlog_size)
+        loop_backlog_.resize(params_.loop_backlog_size);
+
+      SLAM_INFO_THROTTLE(10.0, "Descriptor prefilter rejected %d of %d candidate chains", loop_descriptor_rejected_, loop_descriptor_tested_);
+      SLAM_INFO_THROTTLE(10.0, "Loop closure cache: %d entries, %d hits, %d misses", (int)loop_closure_cache_.Size(),
+                        (int)loop_closure_cache_.Hits(), (int)loop_closure_cache_.Misses());
+  }
+
+bool SlamCore::VerifyLoopCandidate(LoopCandidate& rCandidate)
+  {
+        const LocalizedLaserScanList& candidateChain = rCandidate.chain;
+        Pose2 bestPose = rCandidate.coarse_pose;
+        Matrix3 covariance = rCandidate.coarse_covariance;
+
+        // The snapshot's scans are shared and never modified; match a private copy
+        LocalizedLaserScanPtr pScan = freezeScan(rCandidate.query);
+        pScan->SetSensorPose(bestPose);
+        kt_double fineResponse = loop_fine_matcher_->MatchScan(pScan, candidateChain, bestPose, covariance, false);
+
+        SLAM_DEBUG("  BEST POSE = %.3f %.3f %.3f  VARIANCE = %g, %g", bestPose.GetX(), bestPose.GetY(), bestPose.GetHeading(),
+                   covariance(0, 0), covariance(1, 1));
+
+        SLAM_INFO("FINE RESPONSE: %g (>%g)", fineResponse, params_.loop_match_min_response_fine);
+
+        if (fineResponse < params_.loop_match_min_response_fine)
+        {
+          SLAM_INFO("Rejected");
+
+          LoopClosureCache::Result result;
+          result.coarse_response = rCandidate.coarse_response;
+          result.fine_response = fineResponse;
+          loop_closure_cache_.Insert(rCandidate.place, rCandidate.chain_hash, pScan->GetUniqueId(), rCandidate.chain_ids, result);
+          return false;
+        }
+
+        // Link to the closest scan of the chain, like LinkChainToScan(), but
+        // leave adding the constraint to the front-end, which owns the solver
+        pScan->SetSensorPose(bestPose);
+        Pose2 pose = pScan->GetReferencePose(params_.use_scan_barycenter);
+        LocalizedLaserScanPtr pClosestScan = GetClosestScanToPose(candidateChain, pose);
+        assert(pClosestScan != NULL);
+        Pose2 closestScanPose = pClosestScan->GetReferencePose(params_.use_scan_barycenter);
+        if (pose.GetPosition().SquaredDistance(closestScanPose.GetPosition()) >= math::Square(params_.link_scan_max_distance) + KT_TOLERANCE)
+        {
+          SLAM_INFO("Closest scan of the chain is too far away");
+          return false;
+        }
+
+        SLAM_INFO("Closing loop...");
+        LoopClosure closure;
+        closure.query_id = pScan->GetUniqueId();
+        closure.closest_id = pClosestScan->GetUniqueId();
+        closure.closest_pose = pClosestScan->GetSensorPose();
+        closure.mean = bestPose;
+        closure.covariance = covariance;
+        loop_closure_results_.Push(closure);
+        return true;
+  }
+
+void SlamCore::EvaluateLoopCandidates(double budget)
+  {
+      typedef boost::chrono::steady_clock clock_t;
+      clock_t::time_point start = clock_t::now();
+      clock_t::time_point deadline = start + boost::chrono::duration_cast<clock_t::duration>(boost::chrono::duration<double>(budget));
+      int evaluated = 0;
+
+      // Work through the backlog in priority order. The batch size does not
+      // depend on the number of threads, so neither do the loops closed.
+      while (!loop_backlog_.empty() && (budget <= 0.0 || clock_t::now() < deadline))
+      {
+        size_t batchSize = std::min(loop_backlog_.size(), (size_t)std::max(1, params_.loop_closure_batch_size));
+        std::vector<LoopCandidate> batch(loop_backlog_.begin(), loop_backlog_.begin() + batchSize);
+        loop_backlog_.erase(loop_backlog_.begin(), loop_backlog_.begin() + batchSize);
+
+        loop_closure_pool_->Run(batch.size(),
+          boost::bind(&SlamCore::CoarseMatchCandidate, this, &batch, _1, _2));
+        evaluated += batch.size();
+
+        // Only the best accepted coarse matches go on to fine verification
+        std::vector<LoopCandidate> accepted;
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+          SLAM_INFO("COARSE RESPONSE: %g (> %g)", batch[i].coarse_response, params_.loop_match_min_response_coarse);
+          SLAM_INFO("            var: %g,  %g (< %g)", batch[i].coarse_covariance(0, 0), batch[i].coarse_covariance(1, 1), params_.loop_match_max_variance_coarse);
+          if (IsCoarseMatchAccepted(batch[i].coarse_response, batch[i].coarse_covariance))
+          {
+            accepted.push_back(batch[i]);
+          }
+          else
+          {
+            LoopClosureCache::Result result;
+            result.coarse_response = batch[i].coarse_response;
+            result.fine_response = -1.0;
+            loop_closure_cache_.Insert(batch[i].place, batch[i].chain_hash, batch[i].query->GetUniqueId(), batch[i].chain_ids, result);
+          }
+        }
+        std::sort(accepted.begin(), accepted.end(), LoopCandidate::HigherCoarseResponse);
+        if (params_.loop_match_max_fine_candidates > 0 && accepted.size() > (size_t)params_.loop_match_max_fine_candidates)
+          accepted.resize(params_.loop_match_max_fine_candidates);
+
+        for (size_t i = 0; i < accepted.size(); i++)
+        {
+          if (!VerifyLoopCandidate(accepted[i]))
+            continue;
+
+          // The correction will move the scans, so the other coarse poses of this batch
+          // are stale, and the query's loop is closed so its remaining candidates are moot
+          int queryId = accepted[i].query->GetUniqueId();
+          std::vector<LoopCandidate> remaining;
+          for (size_t j = 0; j < loop_backlog_.size(); j++)
+          {
+            if (loop_backlog_[j].query->GetUniqueId() != queryId)
+              remaining.push_back(loop_backlog_[j]);
+          }
+          loop_backlog_.swap(remaining);
+          break;
+        }
+      }
+
+      if (evaluated > 0)
+        SLAM_INFO("Evaluated %d loop candidates in %.3f s, %d carried over", evaluated,
+                 boost::chrono::duration<double>(clock_t::now() - start).count(), (int)loop_backlog_.size());
+  }
+
+void SlamCore::TryCloseLoop(const GraphSnapshot& rGraph, const KeyframeRecord& rQuery)
+  {
+      GatherLoopCandidates(rGraph, rQuery);
+      // No budget means the whole backlog
+      EvaluateLoopCandidates(params_.synchronous ? 0.0 : params_.loop_closure_budget);
+  }
+
+
+//kt_bool SlamCore::TryCloseLoop(LocalizedLaserScanPtr pScan, const Identifier& rSensorName)
+void SlamCore::loopClosureStep(const int& id, double wait)
+  {
+    loop_closure_latency_sum_ += wait;
+    loop_closure_latency_max_ = std::max(loop_closure_latency_max_, wait);
+    loop_closure_attempts_++;
+
+    if(params_.loop_closure_max_latency > 0.0 && wait > params_.loop_closure_max_latency)
+    {
+      SLAM_DEBUG("Skipping stale loop closure candidate %d (queued for %.3f s)", id, wait);
+      loop_closure_stale_++;
+      return;
+    }
+
+    // The keyframe was published before it was queued, so the current snapshot has it
+    GraphSnapshotPtr graph = boost::atomic_load(&graph_snapshot_);
+    const KeyframeRecord* pQuery = graph ? graph->Find(id) : NULL;
+    if (pQuery != NULL)
+      TryCloseLoop(*graph, *pQuery);
+
+    SLAM_INFO_THROTTLE(10.0, "Loop closure queue: %d keyframes, latency avg %.3f s max %.3f s, %d stale, %d dropped, %d pending",
+      loop_closure_attempts_, loop_closure_latency_sum_ / loop_closure_attempts_, loop_closure_latency_max_,
+      loop_closure_stale_, (int)loop_closure_stage_->Dropped(), (int)loop_closure_stage_->Size());
+  }
+
+  bool SlamCore::loopClosureIdle()
+  {
+    // Spend another budget on the candidates carried over
+    if (loop_backlog_.empty())
+      return false;
+    EvaluateLoopCandidates(params_.loop_closure_budget);
+    return true;
+  }
+
+  void SlamCore::FindPossibleLoopClosure(const GraphSnapshot& rGraph, const KeyframeRecord& rQuery, size_t& rStartIndex, std::vector<int>& rChain) const
+  {
+    rChain.clear();
+
+    const Pose2& pose = rQuery.reference_pose;
+    
+    // possible loop closure chain should not include close scans that have a
+    // path of links to the scan of interest
+    const std::set<int> nearLinkedIds = FindNearLinkedIds(rGraph, rQuery.id, params_.loop_search_max_distance);
+   
+    size_t nScans = rGraph.keyframes.size();
+    for (; rStartIndex < nScans; rStartIndex++)
+    {
+      const KeyframeRecord& candidate = rGraph.keyframes[rStartIndex];
+      if (candidate.id < 0)
+        continue;
+      
+      kt_double squaredDistance = candidate.reference_pose.GetPosition().SquaredDistance(pose.GetPosition());
+      if (squaredDistance < math::Square(params_.loop_search_max_distance) + KT_TOLERANCE)
+      {
+        // a linked scan cannot be in the chain
+        if (nearLinkedIds.count(candidate.id))
+        {
+          rChain.clear();
+        }
+        else
+        {
+          rChain.push_back(candidate.id);
+        }
+      }
+      else
+      {
+        // return chain if it is long "enough"
+        if (rChain.size() >= params_.loop_match_min_chain_size) 
+        {
+          return;
+        }
+        else
+        {
+          rChain.clear();
+        }
+      }
+    }
+    SLAM_INFO("Possible loop closures: %d", (int)rChain.size());
+  }
+  
+  void SlamCore::CorrectPoses(const IdPoseVector& vec)
+  {
+      SLAM_INFO("Got %d corrections", (int)vec.size());
+      // Keyframes moved far enough to invalidate cached loop closure failures
+      std::set<int> movedIds;
+      // Newest corrected keyframe, and its robot pose before and after
+      int newestId = -1;
+      Pose2 newestOld, newestNew;
+      for(int i=0; i < vec.size(); i++)
+      {
+        LocalizedObject* pObject;
+        try
+        {
+          pObject = scan_manager_->GetLocalizedObject(vec[i].first);
+        }
+        catch (karto::Exception e)
+        {
+          SLAM_ERROR("Tried to grab a non-existant object %d", vec[i].first);
+          continue;
+        }
+
+        LocalizedLaserScanPtr pScan = dynamic_cast<LocalizedLaserScan*>(pObject);
+        
+        if (pScan != NULL)
+        {
+          Pose2 oldPose = pScan->GetSensorPose();
+          Pose2 oldCorrected = pScan->GetCorrectedPose();
+          pScan->SetSensorPose(vec[i].second);
+          if (vec[i].first > newestId)
+          {
+            newestId = vec[i].first;
+            newestOld = oldCorrected;
+            newestNew = pScan->GetCorrectedPose();
+          }
+
+          Pose2 newPose = pScan->GetSensorPose();
+          if (oldPose.GetPosition().SquaredDistance(newPose.GetPosition()) > math::Square(params_.loop_cache_invalidate_distance) ||
+              fabs(math::NormalizeAngle(newPose.GetHeading() - oldPose.GetHeading())) > params_.loop_cache_invalidate_angle)
+          {
+            movedIds.insert(vec[i].first);
+          }
+
+          // Readers keep the old frozen copy; the next snapshot gets a new one
+          const KeyframeRecord* pRecord = graph_.Find(vec[i].first);
+          if (pRecord == NULL || !(pRecord->sensor_pose == newPose))
+          {
+            recordKeyframe(pScan);
+          }
+        }
+        else
+        {
+          pObject->SetCorrectedPose(vec[i].second);
+        }
+      }
+
+      // Keyframes added while the solver worked are not in the corrections.
+      // They were matched against the newest corrected one, so move them with
+      // it; otherwise the running scans and the last scan, which the next
+      // scans are matched and chained to, would stay in the old frame.
+      if (newestId >= 0)
+      {
+        Pose2 delta = ComposePoses(newestNew, InversePose(newestOld));
+        for(int id = newestId + 1; id < next_keyframe_id_; id++)
+        {
+          LocalizedLaserScanPtr pScan;
+          try
+          {
+            pScan = dynamic_cast<LocalizedLaserScan*>(scan_manager_->GetLocalizedObject(id));
+          }
+          catch (karto::Exception e)
+          {
+            SLAM_ERROR("Tried to grab a non-existant object %d", id);
+            continue;
+          }
+          if (pScan == NULL)
+            continue;
+
+          Pose2 oldPose = pScan->GetSensorPose();
+          pScan->SetCorrectedPose(ComposePoses(delta, pScan->GetCorrectedPose()));
+          Pose2 newPose = pScan->GetSensorPose();
+          if (oldPose.GetPosition().SquaredDistance(newPose.GetPosition()) > math::Square(params_.loop_cache_invalidate_distance) ||
+              fabs(math::NormalizeAngle(newPose.GetHeading() - oldPose.GetHeading())) > params_.loop_cache_invalidate_angle)
+          {
+            movedIds.insert(id);
+          }
+          recordKeyframe(pScan);
+        }
+      }
+      
+      loop_closure_cache_.Invalidate(movedIds);
+  }
+
+LocalizedLaserScanPtr SlamCore::freezeScan(const LocalizedLaserScan* pScan) const
+{
+  const LocalizedRangeScan* pRangeScan = dynamic_cast<const LocalizedRangeScan*>(pScan);
+  if (pRangeScan == NULL)
+    return NULL;
+
+  LocalizedRangeScan* pCopy = new LocalizedRangeScan(pRangeScan->GetSensorIdentifier(), pRangeScan->GetRangeReadings());
+  pCopy->SetUniqueId(pRangeScan->GetUniqueId());
+  pCopy->SetStateId(pRangeScan->GetStateId());
+  pCopy->SetOdometricPose(pRangeScan->GetOdometricPose());
+  pCopy->SetCorrectedPose(pRangeScan->GetCorrectedPose());
+
+  // Point readings are computed lazily; do it now so readers never write to the copy
+  pCopy->GetPointReadings();
+  return pCopy;
+}
+
+void SlamCore::recordKeyframe(LocalizedLaserScan* pScan)
+{
+  int id = pScan->GetUniqueId();
+  if (graph_.keyframes.size() <= (size_t)id)
+    graph_.keyframes.resize(id + 1);
+  if (graph_.adjacency.size() <= (size_t)id)
+    graph_.adjacency.resize(id + 1);
+
+  KeyframeRecord& record = graph_.keyframes.Modify(id);
+  record.id = id;
+  record.scan = freezeScan(pScan);
+  record.corrected_pose = pScan->GetCorrectedPose();
+  record.sensor_pose = pScan->GetSensorPose();
+  record.reference_pose = pScan->GetReferencePose(params_.use_scan_barycenter);
+}
+
+void SlamCore::publishGraphSnapshot()
+{
+  // Only shares the chunks of records with the previous snapshot; the ones
+  // changed since were copied when they were modified
+  graph_.version++;
+  boost::atomic_store(&graph_snapshot_, GraphSnapshotPtr(new GraphSnapshot(graph_)));
+}
+
+void SlamCore::applyLoopClosures()
+{
+  // Constraints found against an older snapshot are still valid: they are
+  // relative to the pose the closest scan had in that snapshot
+  LoopClosureResultQueue::Item item;
+  int applied = 0;
+  while (loop_closure_results_.Pop(item, 0.0))
+  {
+    const LoopClosure& closure = item.value;
+    addConstraint(closure.closest_id, closure.closest_pose, closure.query_id, closure.mean, closure.covariance, true);
+    graph_.loop_closures++;
+    applied++;
+  }
+  if (applied == 0)
+    return;
+
+  // The back-end sends the corrected poses back once the solver has the constraints
+  backend_job_.correct = true;
+  submitBackendJob();
+  {
+    boost::mutex::scoped_lock lock(loop_closure_mutex_);
+    travel_since_loop_closure_ = 0.0;
+  }
+  publishGraphSnapshot();
+  SLAM_INFO("Loop closed!");
+}
+
+void SlamCore::applyCorrections()
+{
+  WorkQueue<IdPoseVector>::Item item;
+  bool corrected = false;
+  while (corrections_queue_.Pop(item, 0.0))
+  {
+    CorrectPoses(item.value);
+    corrected = true;
+  }
+  if (corrected)
+    publishGraphSnapshot();
+}
+
+void SlamCore::submitBackendJob()
+{
+  if (params_.synchronous)
+    backendStep(backend_job_, 0.0);
+  else if (!backend_stage_->Push(backend_job_))
+    SLAM_WARN("Back-end stopped, dropping solver update");
+  backend_job_ = BackendJob();
+}
+
+void SlamCore::backendStep(const BackendJob& rJob, double wait)
+{
+  if (rJob.node_id >= 0)
+  {
+    int id = solver_.AddNode(rJob.node_pose);
+    if (id != rJob.node_id)
+      SLAM_ERROR("Solver assigned id %d to keyframe %d", id, rJob.node_id);
+  }
+  for (size_t i = 0; i < rJob.constraints.size(); i++)
+  {
+    const GraphEdge& edge = rJob.constraints[i];
+    solver_.AddConstraint(edge.from, edge.to, edge.diff, edge.covariance);
+  }
+  if (rJob.correct)
+  {
+    corrections_queue_.Push(solver_.GetCorrections());
+    solver_.Clear();
+  }
+}
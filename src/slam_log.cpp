@@ -0,0 +1,44 @@
+#include <relative_slam/slam_log.h>
+#include <boost/chrono.hpp>
+#include <cstdarg>
+#include <cstdio>
+
+static LogHandler log_handler;
+static boost::atomic<int> log_level(LogInfo);
+
+void SetLogHandler(const LogHandler& handler)
+{
+  log_handler = handler;
+}
+
+void SetLogLevel(LogLevel level)
+{
+  log_level.store(level, boost::memory_order_relaxed);
+}
+
+bool LogEnabled(LogLevel level)
+{
+  return level >= log_level.load(boost::memory_order_relaxed);
+}
+
+void LogPrintf(LogLevel level, const char* format, ...)
+{
+  char buffer[1024];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+
+  if(log_handler)
+  {
+    log_handler(level, buffer);
+    return;
+  }
+  static const char* names[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+  fprintf(stderr, "[%s] %s\n", names[level], buffer);
+}
+
+double LogTime()
+{
+  return boost::chrono::duration<double>(boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -1,8 +1,9 @@
 #include <relative_slam/srba_solver.h>
-#include <ros/ros.h>
-#include <mrpt/gui.h>  // For rendering results as a 3D scene
+#include <relative_slam/slam_log.h>
+#include <mrpt/opengl.h>  // For saving results as a 3D scene
+#include <cstdio>
 #include <string>
-#include <tf/transform_datatypes.h>
+#include <algorithm>
 
 using namespace srba;
 using mrpt::poses::CPose2D;
@@ -26,11 +27,9 @@ SRBASolver::SRBASolver()
   first_keyframe_ = true;
   curr_kf_id_ = 0;
 
-  marker_count_ = 0;
-
-  relative_map_frame_ = "relative_map";
-  global_map_frame_ = "global_map";
-  loop_closed_ = false;
+  constraints_added_ = 0;
+  constraints_duplicate_ = 0;
+  constraints_self_ = 0;
 
   // Information matrix for relative pose observations:
   {
@@ -50,7 +49,7 @@ SRBASolver::~SRBASolver()
 
 IdPoseVector& SRBASolver::GetCorrections() 
 {
-  ROS_INFO("Computing corrected poses up to %d", curr_kf_id_-1);
+  SLAM_INFO("Computing corrected poses up to %d", curr_kf_id_-1);
   corrections_.clear();
 
   if(!rba_.get_rba_state().keyframes.empty())
@@ -81,7 +80,7 @@ IdPoseVector& SRBASolver::GetCorrections()
 
 void SRBASolver::Compute()
 {
-  ROS_INFO("Computing corrected poses");
+  SLAM_INFO("Computing corrected poses");
   corrections_.clear();
 
   if(!rba_.get_rba_state().keyframes.empty())
@@ -109,7 +108,7 @@ void SRBASolver::Compute()
    
   // Get the global graph and return updated poses?
   //typedef std::vector<sba::Node2d, Eigen::aligned_allocator<sba::Node2d> > NodeVector;
-  //ROS_INFO("Calling SRBA compute");
+  //SLAM_INFO("Calling SRBA compute");
 
   // Do nothing here?
 }
@@ -117,7 +116,7 @@ void SRBASolver::Compute()
 
 int SRBASolver::AddNode(const karto::Pose2 &pose)
 {
-  ROS_INFO("Adding node: %d", curr_kf_id_);
+  SLAM_INFO("Adding node: %d", curr_kf_id_);
   srba_t::new_kf_observations_t  list_obs;
   srba_t::new_kf_observation_t obs_field;
   obs_field.is_fixed = false;
@@ -135,27 +134,41 @@ int SRBASolver::AddNode(const karto::Pose2 &pose)
     true // Also run local optimization?
   );
 
-  ROS_INFO("Added node: %d with self observation %d", (int)new_kf_info.kf_id, (int)list_obs[0].obs.feat_id);
+  SLAM_INFO("Added node: %d with self observation %d", (int)new_kf_info.kf_id, (int)list_obs[0].obs.feat_id);
   curr_kf_id_ = new_kf_info.kf_id+1;
   return new_kf_info.kf_id;
 }
 
-void SRBASolver::AddConstraint(int sourceId, int targetId, const karto::Pose2 &rDiff, const karto::Matrix3& rCovariance)
+bool SRBASolver::AddConstraint(int sourceId, int targetId, const karto::Pose2 &rDiff, const karto::Matrix3& rCovariance)
 {
+  int added, duplicates, self;
+  {
+    boost::mutex::scoped_lock lock(constraint_mutex_);
+    if(sourceId == targetId)
+    {
+      constraints_self_++;
+      SLAM_DEBUG("Dropping constraint from keyframe %d to itself", sourceId);
+      return false;
+    }
+    if(!constrained_pairs_.insert(std::make_pair(std::min(sourceId, targetId), std::max(sourceId, targetId))).second)
+    {
+      constraints_duplicate_++;
+      SLAM_DEBUG("Dropping duplicate constraint from %d to %d (%d added, %d dropped)",
+                sourceId, targetId, constraints_added_, constraints_duplicate_);
+      return false;
+    }
+    added = ++constraints_added_;
+    duplicates = constraints_duplicate_;
+    self = constraints_self_;
+  }
+
   // Need to call create_kf2kf_edge here
   srba_t::new_kf_observations_t  list_obs;
   srba_t::new_kf_observation_t obs_field;
   obs_field.is_fixed = false;   // "Landmarks" (relative poses) have unknown relative positions (i.e. treat them as unknowns to be estimated)
   obs_field.is_unknown_with_init_val = false; // Ignored, since all observed "fake landmarks" already have an initialized value.
 
-  bool reverse_edge = false;
-  if(sourceId < targetId)
-  {
-    ROS_ERROR("REVERSE EDGE");
-    reverse_edge = true;
-  }
-  else
-    ROS_ERROR("$$$$$$$$$$$$$$$$NOT REVERSE EDGE");
+  bool reverse_edge = sourceId < targetId;
 
   karto::Matrix3 precisionMatrix = rCovariance.Inverse();
   Eigen::Matrix<double,3,3> m;
@@ -194,8 +207,9 @@ void SRBASolver::AddConstraint(int sourceId, int targetId, const karto::Pose2 &r
  //     list_obs,
   //    new_edge_ids);
 
-    ROS_INFO("Created new edge from source: %d to target %d (%f, %f, %f)", sourceId, targetId, -rDiff.GetX(), -rDiff.GetY(), -rDiff.GetHeading());
+    SLAM_INFO("Created new edge from source: %d to target %d (%f, %f, %f)", sourceId, targetId, -rDiff.GetX(), -rDiff.GetY(), -rDiff.GetHeading());
   //}
+  SLAM_INFO_THROTTLE(10.0, "Constraints: %d added, %d duplicates and %d self constraints dropped", added, duplicates, self);
  /* else
   { 
     rba_.determine_kf2kf_edges_to_create(sourceId,
@@ -204,254 +218,82 @@ void SRBASolver::AddConstraint(int sourceId, int targetId, const karto::Pose2 &r
 
      rba_.add_observation(sourceId, obs_field.obs, NULL, NULL ); 
   }*/
+  return true;
 }
 
-void SRBASolver::getActiveIds(std::vector<int> &ids)
+bool SRBASolver::GetGlobalGraph(const GraphSnapshot &graph, bool optimize, mrpt::graphs::CNetworkOfPoses3D &poseGraph) const
 {
-  if(!rba_.get_rba_state().keyframes.empty())
+  poseGraph.clear();
+  for(size_t i = 0; i < graph.keyframes.size(); i++)
   {
-    srba_t::frameid2pose_map_t  spantree;
-    if(curr_kf_id_ == 0)
-      return;
-    
-    TKeyFrameID root_keyframe(curr_kf_id_-1);
-    rba_.create_complete_spanning_tree(root_keyframe,spantree, 30);
-
-    int id = 0;
-    for (srba_t::frameid2pose_map_t::const_iterator itP = spantree.begin();itP!=spantree.end();++itP)
-    {
-      ids.push_back(itP->first);
-    }
+    const KeyframeRecord& keyframe = graph.keyframes[i];
+    if(keyframe.id < 0)
+      continue;
+    const karto::Pose2& pose = keyframe.sensor_pose;
+    poseGraph.nodes[keyframe.id] = mrpt::poses::CPose3D(pose.GetX(), pose.GetY(), 0, pose.GetHeading(), 0, 0);
   }
-}
+  if(poseGraph.nodes.size() < 5)
+    return false;
 
-void SRBASolver::publishGlobalGraph()
-{
-  if(! (rba_.get_rba_state().keyframes.size() < 5))
+  for(size_t i = 0; i < graph.edges.size(); i++)
   {
-    mrpt::graphs::CNetworkOfPoses3D poseGraph;
-  rba_.get_global_graphslam_problem(poseGraph);
+    const GraphEdge& edge = graph.edges[i];
+    poseGraph.insertEdge(edge.from, edge.to,
+      mrpt::poses::CPose3D(edge.diff.GetX(), edge.diff.GetY(), 0, edge.diff.GetHeading(), 0, 0));
+  }
+  poseGraph.root = poseGraph.nodes.begin()->first;
 
   // Run optimization:
-  mrpt::graphslam::TResultInfoSpaLevMarq out_info;
-  mrpt::utils::TParametersDouble extra_params;
-  if(loop_closed_)
+  if(optimize)
   {
-  mrpt::graphslam::optimize_graph_spa_levmarq(
-    poseGraph, 
-    out_info,
-    NULL, /* in_nodes_to_optimize, NULL=all */
-    extra_params
-    );
-  loop_closed_ = false;
+    mrpt::graphslam::TResultInfoSpaLevMarq out_info;
+    mrpt::utils::TParametersDouble extra_params;
+    mrpt::graphslam::optimize_graph_spa_levmarq(
+      poseGraph, 
+      out_info,
+      NULL, /* in_nodes_to_optimize, NULL=all */
+      extra_params
+      );
   }
-  mrpt::gui::CDisplayWindow3D win2("Global optimized map",640,480);
+  return true;
+}
+
+bool SRBASolver::ExportGlobalGraph(const GraphSnapshot &graph, bool optimize, const std::string &graph_file, const std::string &scene_file,
+                                   std::vector<karto::Pose2> *poses) const
+{
+  mrpt::graphs::CNetworkOfPoses3D poseGraph;
+  if(!GetGlobalGraph(graph, optimize, poseGraph))
+    return false;
+  // Write next to the target and rename, so readers never see a partial file
+  if(!graph_file.empty())
   {
-    mrpt::opengl::COpenGLScenePtr &scene = win2.get3DSceneAndLock();
-    
-    mrpt::utils::TParametersDouble render_params;   // See docs for mrpt::opengl::graph_tools::graph_visualize()
-    render_params["show_ID_labels"] = 1;    
-    
-    // Get opengl representation of the graph:
-    mrpt::opengl::CSetOfObjectsPtr gl_global_map = mrpt::opengl::graph_tools::graph_visualize( poseGraph,render_params );
-    scene->insert(gl_global_map);
-    
-    win2.unlockAccess3DScene();
-    win2.repaint();
-    win2.waitForKey();
+    std::string tmp = graph_file + ".tmp";
+    poseGraph.saveToTextFile(tmp);
+    if(rename(tmp.c_str(), graph_file.c_str()) != 0)
+      SLAM_WARN("Failed to write the global graph to %s", graph_file.c_str());
   }
-  }
-}
 
-void SRBASolver::publishGraphVisualization(visualization_msgs::MarkerArray &marray)
-{ 
-  ROS_INFO("Visualizing");
-  // Vertices are round, red spheres
-  visualization_msgs::Marker m;
-  m.header.frame_id = relative_map_frame_;
-  m.header.stamp = ros::Time::now();
-  m.id = 0;
-  m.ns = "karto";
-  m.type = visualization_msgs::Marker::ARROW;
-  m.pose.position.x = 0.0;
-  m.pose.position.y = 0.0;
-  m.pose.position.z = 0.0;
-  m.scale.x = 0.15;
-  m.scale.y = 0.15;
-  m.scale.z = 0.15;
-  m.color.r = 1.0;
-  m.color.g = 0;
-  m.color.b = 0.0;
-  m.color.a = 1.0;
-  m.lifetime = ros::Duration(0);
-
-  // Odometry edges are opaque blue line strips 
-  visualization_msgs::Marker edge;
-  edge.header.frame_id = relative_map_frame_;
-  edge.header.stamp = ros::Time::now();
-  edge.action = visualization_msgs::Marker::ADD;
-  edge.ns = "karto";
-  edge.id = 0;
-  edge.type = visualization_msgs::Marker::LINE_STRIP;
-  edge.scale.x = 0.1;
-  edge.scale.y = 0.1;
-  edge.scale.z = 0.1;
-  edge.color.a = 1.0;
-  edge.color.r = 0.0;
-  edge.color.g = 0.0;
-  edge.color.b = 1.0;
-
-  // Loop edges are purple, opacity depends on backend state
-  visualization_msgs::Marker loop_edge;
-  loop_edge.header.frame_id = relative_map_frame_;
-  loop_edge.header.stamp = ros::Time::now();
-  loop_edge.action = visualization_msgs::Marker::ADD;
-  loop_edge.ns = "spanning_tree";
-  loop_edge.id = 0;
-  loop_edge.type = visualization_msgs::Marker::LINE_STRIP;
-  loop_edge.scale.x = 0.1;
-  loop_edge.scale.y = 0.1;
-  loop_edge.scale.z = 0.1;
-  loop_edge.color.a = 1.0;
-  loop_edge.color.r = 1.0;
-  loop_edge.color.g = 0.0;
-  loop_edge.color.b = 1.0;
- 
-  visualization_msgs::Marker node_text;
-  node_text.header.frame_id = relative_map_frame_;
-  node_text.header.stamp = ros::Time::now();
-  node_text.action = visualization_msgs::Marker::ADD;
-  node_text.ns = "karto";
-  node_text.id = 0;
-  node_text.type = visualization_msgs::Marker::TEXT_VIEW_FACING;
-  node_text.scale.z = 0.3;
-  node_text.color.a = 1.0;
-  node_text.color.r = 1.0;
-  node_text.color.g = 1.0;
-  node_text.color.b = 1.0;
- 
-  if(!rba_.get_rba_state().keyframes.empty())
+  if(!scene_file.empty())
   {
-    // Use a spanning tree to estimate the global pose of every node
-    //  starting (root) at the given keyframe:
+    mrpt::utils::TParametersDouble render_params;   // See docs for mrpt::opengl::graph_tools::graph_visualize()
+    render_params["show_ID_labels"] = 1;    
     
-    srba_t::frameid2pose_map_t  spantree;
-    if(curr_kf_id_ == 0)
-      return;
-    TKeyFrameID root_keyframe(curr_kf_id_ -1 );
-    rba_.create_complete_spanning_tree(root_keyframe,spantree);
-
-    int id = 0;
-    for (srba_t::frameid2pose_map_t::const_iterator itP = spantree.begin();itP!=spantree.end();++itP)
-    {
-      if (root_keyframe==itP->first) continue;
-
-      const CPose2D p = itP->second.pose;
-      
-      // Add the vertex to the marker array 
-      m.id = id;
-      m.pose.position.x = p.x();
-      m.pose.position.y = p.y();
-      geometry_msgs::Quaternion q = tf::createQuaternionMsgFromYaw(p.phi());
-
-      m.pose.orientation = q;
-      marray.markers.push_back(visualization_msgs::Marker(m));
-      id++;
-
-      node_text.id = id;
-      node_text.text= boost::lexical_cast<std::string>(itP->first);
-      node_text.pose.position.x = p.x()+0.15; 
-      node_text.pose.position.y = p.y()+0.15; 
-      marray.markers.push_back(visualization_msgs::Marker(node_text));
-      id++;
+    // Get opengl representation of the graph:
+    mrpt::opengl::COpenGLScene scene;
+    scene.insert(mrpt::opengl::graph_tools::graph_visualize( poseGraph,render_params ));
 
-    }
-    
-    for (srba_t::rba_problem_state_t::k2k_edges_deque_t::const_iterator itEdge = rba_.get_rba_state().k2k_edges.begin();
-        itEdge!=rba_.get_rba_state().k2k_edges.end();++itEdge)
-    {
-      CPose2D p1, p2;
-      if(itEdge->from != root_keyframe)
-      {
-        srba_t::frameid2pose_map_t::const_iterator itN1 = spantree.find(itEdge->from);
-        if(itN1==spantree.end())
-          continue;
-        p1 = itN1->second.pose;
-      }
-      if(itEdge->to != root_keyframe)
-      {
-        srba_t::frameid2pose_map_t::const_iterator itN2 = spantree.find(itEdge->to);
-        if(itN2==spantree.end())
-          continue;
-        p2 = itN2->second.pose;
-      }
-      geometry_msgs::Point pt1, pt2;
-      pt1.x = p1.x();
-      pt1.y = p1.y();
-      pt2.x = p2.x();
-      pt2.y = p2.y();
-
-      loop_edge.points.clear();
-      loop_edge.points.push_back(pt1);
-      loop_edge.points.push_back(pt2);
-      loop_edge.id = id;
-      marray.markers.push_back(visualization_msgs::Marker(loop_edge));
-      id++;
-    }
+    std::string tmp = scene_file + ".tmp";
+    if(!scene.saveToFile(tmp) || rename(tmp.c_str(), scene_file.c_str()) != 0)
+      SLAM_WARN("Failed to write the global graph scene to %s", scene_file.c_str());
+  }
 
-    // Render landmark as pose constraint
-    // For each KF: check all its "observations"
-    for (srba_t::frameid2pose_map_t::const_iterator it=spantree.begin();it!=spantree.end();++it)
-    {
-      const TKeyFrameID kf_id = it->first;
-      const srba_t::pose_flag_t & pf = it->second;
-
-      const typename srba_t::keyframe_info &kfi = rba_.get_rba_state().keyframes[kf_id];
-
-      for (size_t i=0;i<kfi.adjacent_k2f_edges.size();i++)
-      {
-        const srba_t::k2f_edge_t * k2f = kfi.adjacent_k2f_edges[i];
-        const TKeyFrameID other_kf_id = k2f->feat_rel_pos->id_frame_base;
-        if (kf_id==other_kf_id)
-          continue; // It's not an constraint with ANOTHER keyframe
-
-        // Is the other KF in the spanning tree?
-        srba_t::frameid2pose_map_t::const_iterator other_it=spantree.find(other_kf_id);
-        if (other_it==spantree.end()) continue;
-
-        const srba_t::pose_flag_t & other_pf = other_it->second;
-
-        // Add edge between the two KFs to represent the pose constraint:
-        mrpt::poses::CPose2D p1 = mrpt::poses::CPose2D(pf.pose);  // Convert to 3D
-        mrpt::poses::CPose2D p2 = mrpt::poses::CPose2D(other_pf.pose);
-
-        geometry_msgs::Point pt1, pt2;
-        pt1.x = p1.x();
-        pt1.y = p1.y();
-        pt2.x = p2.x();
-        pt2.y = p2.y();
-
-        edge.points.clear();
-        edge.points.push_back(pt1);
-        edge.points.push_back(pt2);
-        edge.id = id;
-        marray.markers.push_back(visualization_msgs::Marker(edge));
-        id++;
-      }
-
-  } // end for each KF
-
-  // Delete any excess markers whose ids haven't been reclaimed
-  m.action = visualization_msgs::Marker::DELETE;
-  for (; id < marker_count_; id++) 
+  if(poses)
   {
-    m.id = id;
-    marray.markers.push_back(visualization_msgs::Marker(m));
+    poses->clear();
+    for(mrpt::graphs::CNetworkOfPoses3D::global_poses_t::const_iterator it = poseGraph.nodes.begin(); it != poseGraph.nodes.end(); ++it)
+      poses->push_back(karto::Pose2(it->second.x(), it->second.y(), it->second.yaw()));
   }
-  marker_count_ = marray.markers.size();
-}
-  else
-    ROS_INFO("Graph is empty");
+  return true;
 }
 
 void SRBASolver::Clear()
@@ -0,0 +1,80 @@
+#include <relative_slam/thread_pool.h>
+#include <boost/bind.hpp>
+
+ThreadPool::ThreadPool(size_t num_threads) : count_(0), next_(0), finished_(0), shutdown_(false)
+{
+  if(num_threads == 0)
+    num_threads = 1;
+  for(size_t i = 0; i < num_threads; i++)
+    threads_.push_back(new boost::thread(boost::bind(&ThreadPool::workerLoop, this, i)));
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    shutdown_ = true;
+  }
+  work_cond_.notify_all();
+  for(size_t i = 0; i < threads_.size(); i++)
+  {
+    threads_[i]->join();
+    delete threads_[i];
+  }
+}
+
+void ThreadPool::Run(size_t count, const Task& task)
+{
+  if(count == 0)
+    return;
+
+  boost::mutex::scoped_lock run_lock(run_mutex_);
+  boost::mutex::scoped_lock lock(mutex_);
+  task_ = task;
+  count_ = count;
+  next_ = 0;
+  finished_ = 0;
+  work_cond_.notify_all();
+
+  while(finished_ < count_)
+    done_cond_.wait(lock);
+  task_.clear();
+
+  boost::exception_ptr error = error_;
+  error_ = boost::exception_ptr();
+  if(error)
+    boost::rethrow_exception(error);
+}
+
+void ThreadPool::workerLoop(size_t worker)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  while(true)
+  {
+    while(!shutdown_ && next_ >= count_)
+      work_cond_.wait(lock);
+    if(shutdown_)
+      return;
+
+    // Claim the next task of the current batch
+    size_t index = next_++;
+    Task task = task_;
+    lock.unlock();
+    // An escaping exception would end the worker without counting the task,
+    // and Run() would wait for it forever
+    boost::exception_ptr error;
+    try
+    {
+      task(index, worker);
+    }
+    catch(...)
+    {
+      error = boost::current_exception();
+    }
+    lock.lock();
+    if(error && !error_)
+      error_ = error;
+    if(++finished_ == count_)
+      done_cond_.notify_all();
+  }
+}
@@ -0,0 +1,52 @@
+#include <relative_slam/admission_controller.h>
+#include <gtest/gtest.h>
+
+static StageReport Report(size_t queue_size)
+{
+  StageReport report;
+  report.items = 10;
+  report.period = 1.0;
+  report.queue_size = queue_size;
+  report.queue_capacity = 10;
+  return report;
+}
+
+TEST(AdmissionController, ZeroLimitsWidenAndThenThrottle)
+{
+  AdmissionSettings settings;
+  settings.min_limits.minimum_travel_distance = 0.0;
+  settings.min_limits.minimum_travel_heading = 0.0;
+  settings.max_limits.minimum_travel_distance = 1.0;
+  settings.max_limits.minimum_travel_heading = 1.0;
+  settings.max_limits.throttle_scans = 3;
+  settings.relax_periods = 1;
+  AdmissionController controller(settings);
+
+  // The first overloaded update moves both thresholds off 0
+  AdmissionController::Decision decision = controller.Update(Report(10), Report(0));
+  EXPECT_EQ(AdmissionController::Shed, decision.action);
+  EXPECT_GT(decision.limits.minimum_travel_distance, 0.0);
+  EXPECT_GT(decision.limits.minimum_travel_heading, 0.0);
+  EXPECT_EQ(1, decision.limits.throttle_scans);
+
+  // Sustained overload reaches the maximum gating and then throttles
+  for(int i = 0; i < 100 && decision.action == AdmissionController::Shed; i++)
+    decision = controller.Update(Report(10), Report(0));
+  EXPECT_EQ(AdmissionController::Hold, decision.action);
+  EXPECT_DOUBLE_EQ(1.0, decision.limits.minimum_travel_distance);
+  EXPECT_DOUBLE_EQ(1.0, decision.limits.minimum_travel_heading);
+  EXPECT_EQ(3, decision.limits.throttle_scans);
+
+  // And relaxing returns to the configured 0
+  for(int i = 0; i < 100; i++)
+    decision = controller.Update(Report(0), Report(0));
+  EXPECT_EQ(1, decision.limits.throttle_scans);
+  EXPECT_DOUBLE_EQ(0.0, decision.limits.minimum_travel_distance);
+  EXPECT_DOUBLE_EQ(0.0, decision.limits.minimum_travel_heading);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,75 @@
+#include <relative_slam/loop_closure_cache.h>
+#include <gtest/gtest.h>
+
+static LoopClosureCache::Result Failed()
+{
+  LoopClosureCache::Result result;
+  result.coarse_response = 0.4;
+  result.fine_response = -1.0;
+  return result;
+}
+
+TEST(LoopClosureCache, RevisitHitsFailuresOfEarlierPass)
+{
+  LoopClosureCache cache(100);
+  std::vector<int> chain;
+  chain.push_back(3);
+  chain.push_back(4);
+  chain.push_back(5);
+  size_t hash = LoopClosureCache::HashChain(chain);
+
+  // First pass: keyframe 40 fails against the chain
+  LoopClosureCache::Place first = LoopClosureCache::QuantizePlace(2.1, -3.2, 0.3, 0.5, 0.5);
+  LoopClosureCache::Result result;
+  EXPECT_FALSE(cache.Find(first, hash, result));
+  cache.Insert(first, hash, 40, chain, Failed());
+
+  // Second pass: a new keyframe at nearly the same pose finds it
+  LoopClosureCache::Place second = LoopClosureCache::QuantizePlace(2.2, -3.1, 0.35, 0.5, 0.5);
+  EXPECT_EQ(first, second);
+  ASSERT_TRUE(cache.Find(second, hash, result));
+  EXPECT_DOUBLE_EQ(0.4, result.coarse_response);
+  EXPECT_EQ(1u, cache.Hits());
+
+  // Elsewhere, or against another chain, it is a miss
+  EXPECT_FALSE(cache.Find(LoopClosureCache::QuantizePlace(6.0, -3.1, 0.35, 0.5, 0.5), hash, result));
+  chain.push_back(6);
+  EXPECT_FALSE(cache.Find(second, LoopClosureCache::HashChain(chain), result));
+}
+
+TEST(LoopClosureCache, PlacesDifferInEveryCoordinate)
+{
+  LoopClosureCache::Place place = LoopClosureCache::QuantizePlace(-1.0, 2.0, -3.0, 0.5, 0.5);
+  EXPECT_NE(place, LoopClosureCache::QuantizePlace(-0.4, 2.0, -3.0, 0.5, 0.5));
+  EXPECT_NE(place, LoopClosureCache::QuantizePlace(-1.0, 2.6, -3.0, 0.5, 0.5));
+  EXPECT_NE(place, LoopClosureCache::QuantizePlace(-1.0, 2.0, 3.0, 0.5, 0.5));
+}
+
+TEST(LoopClosureCache, MovedQueryOrChainInvalidates)
+{
+  LoopClosureCache cache(100);
+  std::vector<int> chain(1, 7);
+  size_t hash = LoopClosureCache::HashChain(chain);
+  LoopClosureCache::Place a = LoopClosureCache::QuantizePlace(0.0, 0.0, 0.0, 0.5, 0.5);
+  LoopClosureCache::Place b = LoopClosureCache::QuantizePlace(9.0, 0.0, 0.0, 0.5, 0.5);
+  cache.Insert(a, hash, 20, chain, Failed());
+  cache.Insert(b, hash, 30, chain, Failed());
+
+  std::set<int> moved;
+  moved.insert(20);
+  cache.Invalidate(moved);
+  LoopClosureCache::Result result;
+  EXPECT_FALSE(cache.Find(a, hash, result));
+  EXPECT_TRUE(cache.Find(b, hash, result));
+
+  moved.clear();
+  moved.insert(7);
+  cache.Invalidate(moved);
+  EXPECT_EQ(0u, cache.Size());
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
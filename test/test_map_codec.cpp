@@ -0,0 +1,115 @@
+#include <relative_slam/map_codec.h>
+#include <gtest/gtest.h>
+#include <cstring>
+
+static nav_msgs::OccupancyGrid Map(unsigned int width, unsigned int height)
+{
+  nav_msgs::OccupancyGrid map;
+  map.info.resolution = 0.05;
+  map.info.width = width;
+  map.info.height = height;
+  map.info.origin.orientation.w = 1.0;
+  map.data.assign(width * height, -1);
+  return map;
+}
+
+TEST(MapCodec, RunLengthRoundTrip)
+{
+  int8_t data[600];
+  for(size_t i = 0; i < sizeof(data); i++)
+    data[i] = i < 300 ? -1 : (i % 7 == 0 ? 100 : 0);
+  std::vector<uint8_t> encoded;
+  EncodeRunLength(data, sizeof(data), encoded);
+
+  int8_t decoded[sizeof(data)];
+  ASSERT_TRUE(DecodeRunLength(encoded, decoded, sizeof(decoded)));
+  EXPECT_EQ(0, memcmp(data, decoded, sizeof(data)));
+  // Runs must cover exactly the requested size
+  EXPECT_FALSE(DecodeRunLength(encoded, decoded, sizeof(decoded) - 1));
+}
+
+TEST(MapCodec, KeyframeAndDeltasRoundTrip)
+{
+  // Not a multiple of the tile size, so the last row and column are partial
+  nav_msgs::OccupancyGrid map = Map(40, 25);
+  MapEncoder encoder(16, 0);
+  MapDecoder decoder;
+
+  relative_slam::CompressedMap msg;
+  encoder.Encode(map, msg);
+  EXPECT_TRUE(msg.keyframe);
+  EXPECT_EQ(6u, msg.tiles.size());
+  ASSERT_TRUE(decoder.Apply(msg));
+  EXPECT_EQ(map.data, decoder.Map().data);
+
+  // Only the changed tile is sent
+  map.data[20 * 40 + 35] = 100;
+  encoder.Encode(map, msg);
+  EXPECT_FALSE(msg.keyframe);
+  ASSERT_EQ(1u, msg.tiles.size());
+  EXPECT_EQ(32u, msg.tiles[0].x);
+  EXPECT_EQ(16u, msg.tiles[0].y);
+  ASSERT_TRUE(decoder.Apply(msg));
+  EXPECT_EQ(map.data, decoder.Map().data);
+
+  // The same, told which tiles changed
+  map.data[3 * 40 + 3] = 0;
+  map.data[20 * 40 + 35] = 0;
+  std::vector<MapEncoder::TileIndex> tiles;
+  tiles.push_back(MapEncoder::TileIndex(2, 1));
+  tiles.push_back(MapEncoder::TileIndex(0, 0));
+  encoder.Encode(map, tiles, msg);
+  EXPECT_FALSE(msg.keyframe);
+  EXPECT_EQ(2u, msg.tiles.size());
+  ASSERT_TRUE(decoder.Apply(msg));
+  EXPECT_EQ(map.data, decoder.Map().data);
+}
+
+TEST(MapCodec, DeltaAfterGapIsRejected)
+{
+  nav_msgs::OccupancyGrid map = Map(32, 32);
+  MapEncoder encoder(16, 0);
+  MapDecoder decoder;
+
+  relative_slam::CompressedMap msg;
+  encoder.Encode(map, msg);
+  ASSERT_TRUE(decoder.Apply(msg));
+
+  // The decoder misses this delta
+  map.data[0] = 100;
+  encoder.Encode(map, msg);
+  map.data[1] = 100;
+  encoder.Encode(map, msg);
+  EXPECT_FALSE(decoder.Apply(msg));
+  EXPECT_FALSE(decoder.HasMap());
+
+  // Until the next keyframe
+  encoder.ForceKeyframe();
+  encoder.Encode(map, msg);
+  ASSERT_TRUE(decoder.Apply(msg));
+  EXPECT_EQ(map.data, decoder.Map().data);
+}
+
+TEST(MapCodec, GeometryChangeSendsKeyframe)
+{
+  MapEncoder encoder(16, 0);
+  MapDecoder decoder;
+
+  relative_slam::CompressedMap msg;
+  encoder.Encode(Map(32, 32), msg);
+  ASSERT_TRUE(decoder.Apply(msg));
+
+  nav_msgs::OccupancyGrid map = Map(48, 32);
+  map.data[47] = 100;
+  std::vector<MapEncoder::TileIndex> tiles;
+  encoder.Encode(map, tiles, msg);
+  EXPECT_TRUE(msg.keyframe);
+  ASSERT_TRUE(decoder.Apply(msg));
+  EXPECT_EQ(map.data, decoder.Map().data);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,128 @@
+#include <relative_slam/odometry_buffer.h>
+#include <gtest/gtest.h>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <cmath>
+
+TEST(OdometryBuffer, InterpolatesBetweenSamples)
+{
+  OdometryBuffer buffer(10);
+  OdometrySample sample;
+  EXPECT_EQ(OdometryBuffer::Empty, buffer.Lookup(1.0, sample));
+  EXPECT_FALSE(buffer.Newest(sample));
+
+  EXPECT_TRUE(buffer.Add(OdometrySample(1.0, 0.0, 0.0, 0.0)));
+  EXPECT_TRUE(buffer.Add(OdometrySample(2.0, 2.0, -4.0, 1.0)));
+  // Not newer than the newest
+  EXPECT_FALSE(buffer.Add(OdometrySample(2.0, 9.0, 9.0, 9.0)));
+  EXPECT_FALSE(buffer.Add(OdometrySample(1.5, 9.0, 9.0, 9.0)));
+
+  ASSERT_EQ(OdometryBuffer::Found, buffer.Lookup(1.25, sample));
+  EXPECT_DOUBLE_EQ(1.25, sample.stamp);
+  EXPECT_DOUBLE_EQ(0.5, sample.x);
+  EXPECT_DOUBLE_EQ(-1.0, sample.y);
+  EXPECT_DOUBLE_EQ(0.25, sample.yaw);
+
+  // Exact stamps give the samples themselves
+  ASSERT_EQ(OdometryBuffer::Found, buffer.Lookup(1.0, sample));
+  EXPECT_DOUBLE_EQ(0.0, sample.x);
+  ASSERT_EQ(OdometryBuffer::Found, buffer.Lookup(2.0, sample));
+  EXPECT_DOUBLE_EQ(2.0, sample.x);
+  ASSERT_TRUE(buffer.Newest(sample));
+  EXPECT_DOUBLE_EQ(2.0, sample.stamp);
+}
+
+TEST(OdometryBuffer, InterpolatesYawAcrossPi)
+{
+  OdometryBuffer buffer(10);
+  buffer.Add(OdometrySample(0.0, 0.0, 0.0, M_PI - 0.1));
+  buffer.Add(OdometrySample(1.0, 0.0, 0.0, -M_PI + 0.1));
+
+  // The short way round, through pi rather than through 0
+  OdometrySample sample;
+  ASSERT_EQ(OdometryBuffer::Found, buffer.Lookup(0.25, sample));
+  EXPECT_NEAR(M_PI - 0.05, sample.yaw, 1e-9);
+  ASSERT_EQ(OdometryBuffer::Found, buffer.Lookup(0.5, sample));
+  EXPECT_NEAR(0.0, sin(sample.yaw), 1e-9);
+  EXPECT_LT(cos(sample.yaw), 0.0);
+  ASSERT_EQ(OdometryBuffer::Found, buffer.Lookup(0.75, sample));
+  EXPECT_NEAR(-M_PI + 0.05, sample.yaw, 1e-9);
+}
+
+TEST(OdometryBuffer, RejectsStampsOutsideTheSamples)
+{
+  OdometryBuffer buffer(10);
+  buffer.Add(OdometrySample(1.0, 0.0, 0.0, 0.0));
+  buffer.Add(OdometrySample(2.0, 1.0, 0.0, 0.0));
+
+  OdometrySample sample;
+  EXPECT_EQ(OdometryBuffer::TooOld, buffer.Lookup(0.5, sample));
+  EXPECT_EQ(OdometryBuffer::TooNew, buffer.Lookup(2.5, sample));
+}
+
+TEST(OdometryBuffer, WrapsAroundPastCapacity)
+{
+  OdometryBuffer buffer(8);
+  for(int i = 0; i < 50; i++)
+    buffer.Add(OdometrySample(i, i, 2 * i, 0.0));
+
+  OdometrySample sample;
+  ASSERT_TRUE(buffer.Newest(sample));
+  EXPECT_DOUBLE_EQ(49.0, sample.stamp);
+  // Long overwritten
+  EXPECT_EQ(OdometryBuffer::TooOld, buffer.Lookup(10.0, sample));
+
+  // The most recent samples, less the ones about to be overwritten, are kept
+  EXPECT_EQ(OdometryBuffer::TooOld, buffer.Lookup(43.5, sample));
+  ASSERT_EQ(OdometryBuffer::Found, buffer.Lookup(44.5, sample));
+  EXPECT_DOUBLE_EQ(44.5, sample.x);
+  EXPECT_DOUBLE_EQ(89.0, sample.y);
+  ASSERT_EQ(OdometryBuffer::Found, buffer.Lookup(48.75, sample));
+  EXPECT_DOUBLE_EQ(48.75, sample.x);
+}
+
+// Samples on a line, so any interpolated pose is consistent unless a read
+// was torn or mixed samples the writer had already replaced
+static void WriteSamples(OdometryBuffer* pBuffer, int count)
+{
+  for(int i = 1; i <= count; i++)
+    pBuffer->Add(OdometrySample(i, i, -3.0 * i, 0.001 * i));
+}
+
+TEST(OdometryBuffer, ConcurrentReadersSeeConsistentPoses)
+{
+  const int count = 200000;
+  OdometryBuffer buffer(16);
+  buffer.Add(OdometrySample(0.0, 0.0, 0.0, 0.0));
+  boost::thread writer(boost::bind(&WriteSamples, &buffer, count));
+
+  int found = 0;
+  OdometrySample newest;
+  do
+  {
+    ASSERT_TRUE(buffer.Newest(newest));
+    ASSERT_DOUBLE_EQ(newest.stamp, newest.x);
+    ASSERT_DOUBLE_EQ(-3.0 * newest.stamp, newest.y);
+
+    // Just behind the newest sample, where the writer is overwriting slots
+    double stamp = newest.stamp - 12.3;
+    OdometrySample sample;
+    if(buffer.Lookup(stamp, sample) == OdometryBuffer::Found)
+    {
+      ASSERT_DOUBLE_EQ(stamp, sample.stamp);
+      ASSERT_NEAR(stamp, sample.x, 1e-9);
+      ASSERT_NEAR(-3.0 * stamp, sample.y, 1e-9);
+      // Yaw comes back normalized to [-pi, pi]
+      ASSERT_NEAR(0.0, remainder(sample.yaw - 0.001 * stamp, 2 * M_PI), 1e-9);
+      found++;
+    }
+  } while(newest.stamp < count);
+  writer.join();
+  EXPECT_GT(found, 0);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,220 @@
+#include <relative_slam/binary_scan_log.h>
+#include <relative_slam/scan_log.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+// A file of the test's own, removed when the test ends
+class TempFile
+{
+public:
+  explicit TempFile(const std::string& name)
+  {
+    std::ostringstream path;
+    path << "/tmp/test_scan_log_" << getpid() << "_" << name;
+    path_ = path.str();
+  }
+  ~TempFile() { remove(path_.c_str()); }
+
+  const std::string& Path() const { return path_; }
+
+  void Write(const std::string& rContents) const
+  {
+    std::ofstream file(path_.c_str(), std::ios::binary);
+    file << rContents;
+  }
+
+  std::string Read() const
+  {
+    std::ifstream file(path_.c_str(), std::ios::binary);
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+  }
+
+private:
+  std::string path_;
+};
+
+static LogLaser Laser(const std::string& name)
+{
+  LogLaser laser;
+  laser.name = name;
+  laser.x = 0.1;
+  laser.yaw = M_PI;
+  laser.min_range = 0.05;
+  laser.max_range = 30.0;
+  laser.min_angle = -1.5;
+  laser.max_angle = 1.5;
+  laser.angle_increment = 0.5;
+  return laser;
+}
+
+static BinaryScanHeader ScanHeader(uint32_t laser, double stamp, uint32_t count)
+{
+  BinaryScanHeader header;
+  memset(&header, 0, sizeof(header));
+  header.stamp = stamp;
+  header.odom_x = stamp;
+  header.odom_y = -stamp;
+  header.odom_yaw = 0.25;
+  header.min_angle = -1.5f;
+  header.angle_increment = 0.5f;
+  header.max_range = 30.0f;
+  header.laser = laser;
+  header.count = count;
+  return header;
+}
+
+TEST(TextScanLog, ReadsEveryRecordType)
+{
+  TempFile file("records.txt");
+  file.Write("# recorded by hand\n"
+             "\n"
+             "laser front 0.1 0 3.14 0.05 30 -1.5 1.5 0.5\n"
+             "odom 1.0 2 3 0.5\n"
+             "scan 1.5 front 3 1.0 inf 2.5\n");
+  TextScanLog log(file.Path());
+  ASSERT_TRUE(log.IsOpen());
+
+  ASSERT_EQ(TextScanLog::Laser, log.Next());
+  EXPECT_EQ("front", log.GetLaser().name);
+  EXPECT_DOUBLE_EQ(0.5, log.GetLaser().angle_increment);
+  ASSERT_EQ(TextScanLog::Odometry, log.Next());
+  EXPECT_DOUBLE_EQ(1.0, log.GetOdometry().stamp);
+  EXPECT_DOUBLE_EQ(0.5, log.GetOdometry().yaw);
+  ASSERT_EQ(TextScanLog::Scan, log.Next());
+  EXPECT_EQ("front", log.GetScan().laser);
+  ASSERT_EQ(3u, log.GetScan().ranges.size());
+  EXPECT_TRUE(std::isinf(log.GetScan().ranges[1]));
+  EXPECT_DOUBLE_EQ(2.5, log.GetScan().ranges[2]);
+  EXPECT_EQ(TextScanLog::End, log.Next());
+}
+
+TEST(TextScanLog, RejectsMalformedLines)
+{
+  const char* lines[] = {
+    "scan 1.5 front 3 1.0 2.0\n",           // fewer ranges than the count
+    "scan 1.5 front 2 1.0 2.0 3.0\n",       // more ranges than the count
+    "scan 1.5 front 2.5 1.0 2.0\n",         // count is not an integer
+    "odom 1.0 2 x 0.5\n",                   // not a number
+    "laser front 0.1 0 3.14\n",             // fields missing
+    "imu 1.0 0 0 0\n"                       // unknown record type
+  };
+  for(size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++)
+  {
+    TempFile file("malformed.txt");
+    file.Write(std::string("# header\n") + lines[i]);
+    TextScanLog log(file.Path());
+    EXPECT_EQ(TextScanLog::Error, log.Next()) << lines[i];
+    // The error names the line
+    EXPECT_EQ(0u, log.GetError().find("line 2: ")) << log.GetError();
+  }
+}
+
+TEST(BinaryScanLog, RoundTrip)
+{
+  TempFile file("round_trip.bin");
+  BinaryScanLogWriter writer;
+  ASSERT_TRUE(writer.Open(file.Path()));
+  EXPECT_EQ(0, writer.AddLaser(Laser("front")));
+  EXPECT_EQ(1, writer.AddLaser(Laser("rear_laser")));
+  // Three ranges, so the payload needs padding
+  float ranges[] = { 1.0f, 2.0f, 3.0f };
+  ASSERT_TRUE(writer.AddScan(ScanHeader(1, 10.0, 3), ranges));
+  ASSERT_TRUE(writer.AddScan(ScanHeader(0, 11.0, 0), NULL));
+  // Not declared, so not written
+  EXPECT_FALSE(writer.AddScan(ScanHeader(2, 12.0, 3), ranges));
+  EXPECT_EQ(2u, writer.Scans());
+  ASSERT_TRUE(writer.Close());
+
+  ASSERT_TRUE(BinaryScanLog::IsBinaryLog(file.Path()));
+  BinaryScanLog log;
+  ASSERT_TRUE(log.Open(file.Path())) << log.GetError();
+  ASSERT_EQ(BinaryScanLog::Laser, log.Next());
+  EXPECT_EQ("front", log.GetLaser().name);
+  EXPECT_DOUBLE_EQ(M_PI, log.GetLaser().yaw);
+  ASSERT_EQ(BinaryScanLog::Laser, log.Next());
+  EXPECT_EQ("rear_laser", log.GetLaser().name);
+
+  ASSERT_EQ(BinaryScanLog::Scan, log.Next());
+  EXPECT_EQ(1u, log.GetScanHeader().laser);
+  EXPECT_EQ("rear_laser", *log.GetLaserName(log.GetScanHeader().laser));
+  EXPECT_DOUBLE_EQ(10.0, log.GetScanHeader().stamp);
+  EXPECT_DOUBLE_EQ(-10.0, log.GetScanHeader().odom_y);
+  ASSERT_EQ(3u, log.GetScanHeader().count);
+  EXPECT_EQ(0, memcmp(ranges, log.GetRanges(), sizeof(ranges)));
+
+  ASSERT_EQ(BinaryScanLog::Scan, log.Next());
+  EXPECT_EQ(0u, log.GetScanHeader().count);
+  EXPECT_EQ(BinaryScanLog::End, log.Next());
+  EXPECT_FALSE(log.Truncated());
+}
+
+TEST(BinaryScanLog, TruncatedTailEndsTheLog)
+{
+  TempFile file("truncated.bin");
+  BinaryScanLogWriter writer;
+  ASSERT_TRUE(writer.Open(file.Path()));
+  writer.AddLaser(Laser("front"));
+  float ranges[] = { 1.0f, 2.0f };
+  writer.AddScan(ScanHeader(0, 1.0, 2), ranges);
+  writer.AddScan(ScanHeader(0, 2.0, 2), ranges);
+  ASSERT_TRUE(writer.Close());
+
+  // Cut the last scan short, as a crash while writing it would
+  std::string contents = file.Read();
+  file.Write(contents.substr(0, contents.size() - 5));
+
+  BinaryScanLog log;
+  ASSERT_TRUE(log.Open(file.Path())) << log.GetError();
+  EXPECT_EQ(BinaryScanLog::Laser, log.Next());
+  EXPECT_EQ(BinaryScanLog::Scan, log.Next());
+  EXPECT_DOUBLE_EQ(1.0, log.GetScanHeader().stamp);
+  EXPECT_EQ(BinaryScanLog::End, log.Next());
+  EXPECT_TRUE(log.Truncated());
+}
+
+TEST(BinaryScanLog, ScanOfUndeclaredLaserIsAnError)
+{
+  TempFile file("undeclared.bin");
+  BinaryScanLogWriter writer;
+  ASSERT_TRUE(writer.Open(file.Path()));
+  writer.AddLaser(Laser("front"));
+  writer.AddScan(ScanHeader(0, 1.0, 0), NULL);
+  ASSERT_TRUE(writer.Close());
+
+  // The writer refuses such scans, so point the written one at laser 1
+  std::string contents = file.Read();
+  size_t laserOffset = contents.size() - sizeof(BinaryScanHeader) + offsetof(BinaryScanHeader, laser);
+  uint32_t laser = 1;
+  contents.replace(laserOffset, sizeof(laser), reinterpret_cast<const char*>(&laser), sizeof(laser));
+  file.Write(contents);
+
+  BinaryScanLog log;
+  ASSERT_TRUE(log.Open(file.Path())) << log.GetError();
+  EXPECT_EQ(BinaryScanLog::Laser, log.Next());
+  EXPECT_EQ(BinaryScanLog::Error, log.Next());
+  EXPECT_NE(std::string::npos, log.GetError().find("undeclared laser")) << log.GetError();
+}
+
+TEST(BinaryScanLog, RejectsOtherFiles)
+{
+  TempFile file("text.txt");
+  file.Write("laser front 0.1 0 3.14 0.05 30 -1.5 1.5 0.5\n");
+  EXPECT_FALSE(BinaryScanLog::IsBinaryLog(file.Path()));
+  BinaryScanLog log;
+  EXPECT_FALSE(log.Open(file.Path()));
+  EXPECT_NE(std::string::npos, log.GetError().find("not a binary scan log")) << log.GetError();
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
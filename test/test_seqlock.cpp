@@ -0,0 +1,70 @@
+#include <relative_slam/seqlock.h>
+#include <relative_slam/slam_core.h>
+#include <gtest/gtest.h>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+// Every field derived from the same n, so a mix of two stores shows
+static MapCorrection Correction(double n)
+{
+  MapCorrection correction;
+  correction.odom_x = n;
+  correction.odom_y = -n;
+  correction.odom_yaw = 2 * n;
+  correction.relative_map_x = n + 0.5;
+  correction.relative_map_y = -n - 0.5;
+  correction.relative_map_yaw = 3 * n;
+  return correction;
+}
+
+static bool IsConsistent(const MapCorrection& rCorrection)
+{
+  double n = rCorrection.odom_x;
+  return rCorrection.odom_y == -n && rCorrection.odom_yaw == 2 * n &&
+         rCorrection.relative_map_x == n + 0.5 && rCorrection.relative_map_y == -n - 0.5 &&
+         rCorrection.relative_map_yaw == 3 * n;
+}
+
+TEST(SeqLock, StoresAndLoads)
+{
+  SeqLock<MapCorrection> lock;
+  EXPECT_EQ(0u, lock.Version());
+  lock.Store(Correction(4));
+  lock.Store(Correction(7));
+  EXPECT_EQ(2u, lock.Version());
+  MapCorrection correction = lock.Load();
+  EXPECT_TRUE(IsConsistent(correction));
+  EXPECT_EQ(7.0, correction.odom_x);
+}
+
+static void StoreCorrections(SeqLock<MapCorrection>* pLock, int count)
+{
+  for(int i = 1; i <= count; i++)
+    pLock->Store(Correction(i));
+}
+
+TEST(SeqLock, ReadersNeverSeeTornValues)
+{
+  const int count = 500000;
+  SeqLock<MapCorrection> lock(Correction(0));
+  boost::thread writer(boost::bind(&StoreCorrections, &lock, count));
+
+  // Values only ever grow, and each load is one whole store
+  double previous = 0;
+  MapCorrection correction;
+  do
+  {
+    correction = lock.Load();
+    ASSERT_TRUE(IsConsistent(correction)) << "torn read after " << previous;
+    ASSERT_GE(correction.odom_x, previous);
+    previous = correction.odom_x;
+  } while(correction.odom_x < count);
+  writer.join();
+  EXPECT_EQ((unsigned long)count, lock.Version());
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,53 @@
+#include <relative_slam/shared_chunk_vector.h>
+#include <gtest/gtest.h>
+
+TEST(SharedChunkVector, GrowsAcrossChunks)
+{
+  SharedChunkVector<int, 4> vector;
+  EXPECT_TRUE(vector.empty());
+  for(int i = 0; i < 10; i++)
+    vector.push_back(i);
+  vector.resize(13);
+  // Never shrinks
+  vector.resize(2);
+
+  ASSERT_EQ(13u, vector.size());
+  for(int i = 0; i < 10; i++)
+    EXPECT_EQ(i, vector[i]);
+  EXPECT_EQ(0, vector[12]);
+  vector.Modify(12) = 7;
+  EXPECT_EQ(7, vector.back());
+}
+
+TEST(SharedChunkVector, CopiesShareUnchangedChunks)
+{
+  SharedChunkVector<int, 4> vector;
+  for(int i = 0; i < 10; i++)
+    vector.push_back(i);
+
+  SharedChunkVector<int, 4> copy(vector);
+  EXPECT_EQ(&vector[1], &copy[1]);
+  EXPECT_EQ(&vector[5], &copy[5]);
+
+  // Only the modified chunk is copied, and the copy does not see the change
+  vector.Modify(1) = 100;
+  EXPECT_EQ(100, vector[1]);
+  EXPECT_EQ(1, copy[1]);
+  EXPECT_NE(&vector[0], &copy[0]);
+  EXPECT_EQ(&vector[5], &copy[5]);
+
+  // Nor does it see elements added to its last chunk
+  vector.push_back(10);
+  vector.Modify(9) = 90;
+  EXPECT_EQ(10u, copy.size());
+  EXPECT_EQ(9, copy.back());
+  EXPECT_EQ(11u, vector.size());
+  EXPECT_EQ(90, vector[9]);
+  EXPECT_EQ(10, vector.back());
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,46 @@
+#include <relative_slam/thread_pool.h>
+#include <gtest/gtest.h>
+#include <boost/bind.hpp>
+#include <stdexcept>
+
+static void Count(std::vector<int>* pRuns, size_t task, size_t worker)
+{
+  (*pRuns)[task]++;
+}
+
+static void ThrowOnOdd(std::vector<int>* pRuns, size_t task, size_t worker)
+{
+  (*pRuns)[task]++;
+  if(task % 2 == 1)
+    throw std::runtime_error("odd task");
+}
+
+TEST(ThreadPool, RunsEveryTaskOnce)
+{
+  ThreadPool pool(4);
+  std::vector<int> runs(100, 0);
+  pool.Run(runs.size(), boost::bind(&Count, &runs, _1, _2));
+  for(size_t i = 0; i < runs.size(); i++)
+    EXPECT_EQ(1, runs[i]);
+}
+
+TEST(ThreadPool, RethrowsAfterTheBatchAndKeepsWorking)
+{
+  ThreadPool pool(2);
+  std::vector<int> runs(10, 0);
+  EXPECT_THROW(pool.Run(runs.size(), boost::bind(&ThrowOnOdd, &runs, _1, _2)), std::runtime_error);
+  for(size_t i = 0; i < runs.size(); i++)
+    EXPECT_EQ(1, runs[i]);
+
+  // The workers survived and the error does not leak into the next batch
+  runs.assign(10, 0);
+  pool.Run(runs.size(), boost::bind(&Count, &runs, _1, _2));
+  for(size_t i = 0; i < runs.size(); i++)
+    EXPECT_EQ(1, runs[i]);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}